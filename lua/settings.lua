@@ -533,6 +533,44 @@ settings.DatabaseSettings = SettingsScreen:new {
       database.auto_update:set(auto_update_sw:enabled())
     end)
 
+    local replay_gain_container = self.content:Object {
+      flex = {
+        flex_direction = "row",
+        justify_content = "flex-start",
+        align_items = "center",
+        align_content = "flex-start",
+      },
+      w = lvgl.PCT(100),
+      h = lvgl.SIZE_CONTENT,
+      pad_bottom = 4,
+    }
+    replay_gain_container:add_style(styles.list_item)
+    replay_gain_container:Label { text = "Normalise loudness", flex_grow = 1 }
+    local replay_gain_sw = replay_gain_container:Switch {}
+
+    replay_gain_sw:onevent(lvgl.EVENT.VALUE_CHANGED, function()
+      volume.replay_gain:set(replay_gain_sw:enabled())
+    end)
+
+    local loudness_container = self.content:Object {
+      flex = {
+        flex_direction = "row",
+        justify_content = "flex-start",
+        align_items = "center",
+        align_content = "flex-start",
+      },
+      w = lvgl.PCT(100),
+      h = lvgl.SIZE_CONTENT,
+      pad_bottom = 4,
+    }
+    loudness_container:add_style(styles.list_item)
+    loudness_container:Label { text = "Analyse loudness", flex_grow = 1 }
+    local loudness_sw = loudness_container:Switch {}
+
+    loudness_sw:onevent(lvgl.EVENT.VALUE_CHANGED, function()
+      database.analyse_loudness:set(loudness_sw:enabled())
+    end)
+
     local actions_container = self.content:Object {
       w = lvgl.PCT(100),
       h = lvgl.SIZE_CONTENT,
@@ -561,6 +599,20 @@ settings.DatabaseSettings = SettingsScreen:new {
           auto_update_sw:clear_state(lvgl.STATE.CHECKED)
         end
       end),
+      volume.replay_gain:bind(function(en)
+        if en then
+          replay_gain_sw:add_state(lvgl.STATE.CHECKED)
+        else
+          replay_gain_sw:clear_state(lvgl.STATE.CHECKED)
+        end
+      end),
+      database.analyse_loudness:bind(function(en)
+        if en then
+          loudness_sw:add_state(lvgl.STATE.CHECKED)
+        else
+          loudness_sw:clear_state(lvgl.STATE.CHECKED)
+        end
+      end),
     }
   end
 }
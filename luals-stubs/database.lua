@@ -4,6 +4,7 @@
 --- the device's LevelDB-backed track database.
 --- @class database
 --- @field updating Property Whether or not a database re-index is currently in progress.
+--- @field analyse_loudness Property Whether or not to measure the loudness of tracks without replay gain tags, in the background whilst nothing is playing.
 local database = {}
 
 --- Returns a list of all indexes in the database.
@@ -15,6 +16,34 @@ function database.indexes() end
 --- @return Track
 function database.track_by_id(id) end
 
+--- Returns the combined duration of the given tracks, in seconds. This uses
+--- only the durations stored in the database, so it's fast even for long
+--- lists of tracks. Tracks with no known duration are not counted.
+--- @param ids TrackId[]
+--- @return integer
+function database.total_duration(ids) end
+
+--- Searches the titles, artists, and albums of every track. A track matches if
+--- each word of the query begins one of its words, so this can be called again
+--- as each character of a query is typed.
+--- @param query string The text to search for
+--- @param limit? integer The maximum number of results to return. Defaults to 50.
+--- @return TrackId[] ids The matching tracks, in order of track id
+function database.search(query, limit) end
+
+--- Defines a new index, which is built in the background from the tracks
+--- already in the database. The index is included in `database.indexes()` once
+--- it has finished building.
+--- @param name string The human-readable name of the new index
+--- @param type integer The kind of media to index, from `database.MediaTypes`
+--- @param components string[] The tags to break the index down by, in order, e.g. `{ "album_artist", "album", "title" }`
+--- @return integer|nil id The id of the new index, or nil if it could not be created
+function database.add_index(name, type, components) end
+
+--- Removes an index, and deletes its records in the background.
+--- @param id integer The id of the index to remove
+--- @return boolean removed Whether or not there was an index with this id
+function database.remove_index(id) end
 
 --- @class Track
 --- @field id TrackId The track id of this track
@@ -22,6 +51,10 @@ function database.track_by_id(id) end
 --- @field saved_position integer The last saved position of this track
 --- @field play_count integer The number of times this track has finished playing
 --- @field tags table A mapping of any available tags to that tag's value
+--- @field duration integer|nil The length of this track in seconds, if known
+--- @field sample_rate integer|nil The sample rate of this track in Hz, if known
+--- @field channels integer|nil The number of audio channels in this track, if known
+--- @field bitrate_kbps integer|nil The approximate bitrate of this track, if known
 local Track = {}
 
 --- An iterator is a userdata type that behaves like an ordinary Lua iterator.
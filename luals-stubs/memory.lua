@@ -0,0 +1,18 @@
+--- @meta
+
+--- The `memory` module contains functions for inspecting how much memory each
+--- part of the firmware is using.
+--- @class memory
+local memory = {}
+
+--- @class MemoryUsage
+--- @field live integer Bytes currently allocated.
+--- @field peak integer The most bytes that have been allocated at once.
+--- @field allocs integer How many allocations have been made in total.
+
+--- Returns the heap usage of each subsystem, keyed by subsystem name (e.g.
+--- "database", "audio", "ui", "lua", "tts").
+--- @return table<string, MemoryUsage>
+function memory.usage() end
+
+return memory
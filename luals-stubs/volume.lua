@@ -6,6 +6,7 @@
 --- @field current_db Property The current volume in terms of decibels relative to line level (only applicable to headphone output)
 --- @field left_bias Property An additional modifier in decibels to apply to the left channel (only applicable to headphone output)
 --- @field limit_db Property The maximum allowed output volume, in terms of decibels relative to line level (only applicable to headphone output)
+--- @field replay_gain Property Whether or not to normalise the loudness of each track, using its replay gain tags or analysed loudness.
 local volume = {}
 
 return volume
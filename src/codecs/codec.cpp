@@ -57,4 +57,24 @@ auto CreateCodecForType(StreamType type) -> std::optional<ICodec*> {
   }
 }
 
+CodecPool::CodecPool() : codecs_() {}
+
+auto CodecPool::Acquire(StreamType type) -> std::optional<ICodec*> {
+  auto& slot = codecs_[static_cast<std::size_t>(type)];
+  if (!slot) {
+    auto codec = CreateCodecForType(type);
+    if (!codec) {
+      return {};
+    }
+    slot.reset(*codec);
+  }
+  return slot.get();
+}
+
+auto CodecPool::Release(ICodec* codec) -> void {
+  if (codec) {
+    codec->Reset();
+  }
+}
+
 }  // namespace codecs
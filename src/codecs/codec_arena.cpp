@@ -0,0 +1,149 @@
+/*
+ * Copyright 2023 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "codec_arena.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+namespace codecs {
+
+[[maybe_unused]] static constexpr char kTag[] = "arena";
+
+/*
+ * Prefixed to every allocation so that we can support realloc, and so that
+ * heap-allocated overflow blocks can be found and freed on reset.
+ */
+struct alignas(std::max_align_t) CodecArena::Header {
+  std::size_t size;
+  Header* prev_overflow;
+  Header* next_overflow;
+  bool is_overflow;
+};
+
+static constexpr auto AlignUp(std::size_t size) -> std::size_t {
+  constexpr std::size_t kAlign = alignof(std::max_align_t);
+  return (size + kAlign - 1) & ~(kAlign - 1);
+}
+
+CodecArena::CodecArena(std::size_t size, uint32_t caps)
+    : caps_(caps),
+      block_(reinterpret_cast<std::byte*>(heap_caps_malloc(size, caps)),
+             size),
+      offset_(0),
+      overflow_(nullptr) {
+  if (block_.data() == nullptr) {
+    ESP_LOGW(kTag, "failed to allocate %u byte arena", size);
+    block_ = {};
+  }
+}
+
+CodecArena::~CodecArena() {
+  Reset();
+  heap_caps_free(block_.data());
+}
+
+auto CodecArena::HeaderFor(void* ptr) -> Header* {
+  return reinterpret_cast<Header*>(ptr) - 1;
+}
+
+auto CodecArena::Allocate(std::size_t size) -> void* {
+  std::size_t total = sizeof(Header) + AlignUp(size);
+
+  Header* header;
+  if (offset_ + total <= block_.size_bytes()) {
+    header = reinterpret_cast<Header*>(block_.data() + offset_);
+    offset_ += total;
+    header->is_overflow = false;
+    header->prev_overflow = nullptr;
+    header->next_overflow = nullptr;
+  } else {
+    header = reinterpret_cast<Header*>(heap_caps_malloc(total, caps_));
+    if (header == nullptr) {
+      return nullptr;
+    }
+    header->is_overflow = true;
+    header->prev_overflow = nullptr;
+    header->next_overflow = overflow_;
+    if (overflow_) {
+      overflow_->prev_overflow = header;
+    }
+    overflow_ = header;
+  }
+
+  header->size = size;
+  return header + 1;
+}
+
+auto CodecArena::Reallocate(void* ptr, std::size_t size) -> void* {
+  if (ptr == nullptr) {
+    return Allocate(size);
+  }
+  Header* header = HeaderFor(ptr);
+  if (size <= AlignUp(header->size)) {
+    header->size = size;
+    return ptr;
+  }
+
+  // If this is the most recent allocation in the block, then we can grow it
+  // in place.
+  std::byte* end = reinterpret_cast<std::byte*>(ptr) + AlignUp(header->size);
+  if (!header->is_overflow && end == block_.data() + offset_ &&
+      offset_ + AlignUp(size) - AlignUp(header->size) <= block_.size_bytes()) {
+    offset_ += AlignUp(size) - AlignUp(header->size);
+    header->size = size;
+    return ptr;
+  }
+
+  void* new_ptr = Allocate(size);
+  if (new_ptr == nullptr) {
+    return nullptr;
+  }
+  std::memcpy(new_ptr, ptr, std::min(size, header->size));
+  Free(ptr);
+  return new_ptr;
+}
+
+auto CodecArena::Free(void* ptr) -> void {
+  if (ptr == nullptr) {
+    return;
+  }
+  Header* header = HeaderFor(ptr);
+  if (!header->is_overflow) {
+    // Reclaim the space if this was the last thing allocated; otherwise, wait
+    // for the next reset.
+    std::byte* end = reinterpret_cast<std::byte*>(ptr) + AlignUp(header->size);
+    if (end == block_.data() + offset_) {
+      offset_ = reinterpret_cast<std::byte*>(header) - block_.data();
+    }
+    return;
+  }
+
+  if (header->prev_overflow) {
+    header->prev_overflow->next_overflow = header->next_overflow;
+  } else {
+    overflow_ = header->next_overflow;
+  }
+  if (header->next_overflow) {
+    header->next_overflow->prev_overflow = header->prev_overflow;
+  }
+  heap_caps_free(header);
+}
+
+auto CodecArena::Reset() -> void {
+  while (overflow_) {
+    Header* next = overflow_->next_overflow;
+    heap_caps_free(overflow_);
+    overflow_ = next;
+  }
+  offset_ = 0;
+}
+
+}  // namespace codecs
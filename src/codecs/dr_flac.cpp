@@ -20,25 +20,26 @@ namespace codecs {
 
 [[maybe_unused]] static const char kTag[] = "flac";
 
+/*
+ * Size of the arena used for drflac's internal state. This comfortably fits
+ * the decoder struct plus its decoded sample buffers for typical block sizes
+ * (4608 frames, stereo), with room left over for seek tables. Streams with
+ * unusually large blocks spill over into the regular heap.
+ */
+static constexpr size_t kArenaSize = 64 * 1024;
+
 static void* onMalloc(size_t sz, void* pUserData) {
-  return heap_caps_malloc(sz, MALLOC_CAP_SPIRAM);
+  return reinterpret_cast<CodecArena*>(pUserData)->Allocate(sz);
 }
 
 static void* onRealloc(void* p, size_t sz, void* pUserData) {
-  return heap_caps_realloc(p, sz, MALLOC_CAP_SPIRAM);
+  return reinterpret_cast<CodecArena*>(pUserData)->Reallocate(p, sz);
 }
 
 static void onFree(void* p, void* pUserData) {
-  heap_caps_free(p);
+  reinterpret_cast<CodecArena*>(pUserData)->Free(p);
 }
 
-static drflac_allocation_callbacks kAllocCallbacks{
-    .pUserData = nullptr,
-    .onMalloc = onMalloc,
-    .onRealloc = onRealloc,
-    .onFree = onFree,
-};
-
 static size_t readProc(void* pUserData, void* pBufferOut, size_t bytesToRead) {
   IStream* stream = reinterpret_cast<IStream*>(pUserData);
   ssize_t res =
@@ -71,19 +72,36 @@ static drflac_bool32 seekProc(void* pUserData,
   return DRFLAC_TRUE;
 }
 
-DrFlacDecoder::DrFlacDecoder() : input_(), flac_() {}
+DrFlacDecoder::DrFlacDecoder()
+    : input_(),
+      arena_(kArenaSize, MALLOC_CAP_SPIRAM),
+      alloc_callbacks_{
+          .pUserData = &arena_,
+          .onMalloc = onMalloc,
+          .onRealloc = onRealloc,
+          .onFree = onFree,
+      },
+      flac_() {}
 
 DrFlacDecoder::~DrFlacDecoder() {
+  Reset();
+}
+
+auto DrFlacDecoder::Reset() -> void {
   if (flac_) {
-    drflac_free(flac_, &kAllocCallbacks);
+    drflac_free(flac_, &alloc_callbacks_);
+    flac_ = nullptr;
   }
+  // Anything drflac didn't explicitly free goes back in one go.
+  arena_.Reset();
+  input_.reset();
 }
 
 auto DrFlacDecoder::OpenStream(std::shared_ptr<IStream> input, uint32_t offset)
     -> cpp::result<OutputFormat, Error> {
   input_ = input;
 
-  flac_ = drflac_open(readProc, seekProc, input_.get(), &kAllocCallbacks);
+  flac_ = drflac_open(readProc, seekProc, input_.get(), &alloc_callbacks_);
   if (!flac_) {
     return cpp::fail(Error::kMalformedData);
   }
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -127,8 +128,46 @@ class ICodec {
    */
   virtual auto DecodeTo(std::span<sample::Sample> destination)
       -> cpp::result<OutputInfo, Error> = 0;
+
+  /*
+   * Releases the current input stream, and returns the codec to a state where
+   * `OpenStream` may be called again. Implementations should hold on to any
+   * buffers they own, so that reusing an instance doesn't touch the heap.
+   */
+  virtual auto Reset() -> void = 0;
 };
 
 auto CreateCodecForType(StreamType type) -> std::optional<ICodec*>;
 
+/*
+ * Owns at most one instance of each kind of codec, and lends them out for the
+ * duration of a single stream. Codecs are created lazily the first time their
+ * type is needed, and then kept alive so that moving between tracks doesn't
+ * repeatedly allocate and free large decoder state.
+ *
+ * Not thread-safe; each pool should belong to a single decoding task.
+ */
+class CodecPool {
+ public:
+  CodecPool();
+
+  /*
+   * Returns a codec, ready for `OpenStream`, that can decode the given type of
+   * stream. The codec must be given back via `Release` before it is acquired
+   * again.
+   */
+  auto Acquire(StreamType type) -> std::optional<ICodec*>;
+
+  /* Resets the given codec and returns it to the pool. */
+  auto Release(ICodec*) -> void;
+
+  CodecPool(const CodecPool&) = delete;
+  CodecPool& operator=(const CodecPool&) = delete;
+
+ private:
+  static constexpr std::size_t kNumTypes =
+      static_cast<std::size_t>(StreamType::kNative) + 1;
+  std::array<std::unique_ptr<ICodec>, kNumTypes> codecs_;
+};
+
 }  // namespace codecs
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2023 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "esp_heap_caps.h"
+
+namespace codecs {
+
+/*
+ * Bump allocator for the internal state of third-party decoder libraries.
+ *
+ * The arena's backing block is allocated once, and then handed out in pieces
+ * for the lifetime of a single stream. Individual frees are (mostly) ignored;
+ * instead, the whole arena is released in bulk via `Reset()` when the codec
+ * is done with the stream. This means moving between tracks never returns
+ * small, oddly-sized blocks to the heap.
+ *
+ * Allocations that don't fit in the backing block fall back to the regular
+ * heap. These are tracked, and are also released by `Reset()`.
+ */
+class CodecArena {
+ public:
+  CodecArena(std::size_t size, uint32_t caps);
+  ~CodecArena();
+
+  auto Allocate(std::size_t size) -> void*;
+  auto Reallocate(void* ptr, std::size_t size) -> void*;
+  auto Free(void* ptr) -> void;
+
+  /* Releases every allocation made since the last reset. */
+  auto Reset() -> void;
+
+  /* The number of bytes of the backing block currently in use. */
+  auto BytesUsed() const -> std::size_t { return offset_; }
+
+  CodecArena(const CodecArena&) = delete;
+  CodecArena& operator=(const CodecArena&) = delete;
+
+ private:
+  struct Header;
+
+  auto HeaderFor(void* ptr) -> Header*;
+
+  const uint32_t caps_;
+  std::span<std::byte> block_;
+  std::size_t offset_;
+  Header* overflow_;
+};
+
+}  // namespace codecs
@@ -16,6 +16,7 @@
 
 #include "dr_flac.h"
 #include "sample.hpp"
+#include "codec_arena.hpp"
 #include "source_buffer.hpp"
 
 #include "codec.hpp"
@@ -33,11 +34,15 @@ class DrFlacDecoder : public ICodec {
   auto DecodeTo(std::span<sample::Sample> destination)
       -> cpp::result<OutputInfo, Error> override;
 
+  auto Reset() -> void override;
+
   DrFlacDecoder(const DrFlacDecoder&) = delete;
   DrFlacDecoder& operator=(const DrFlacDecoder&) = delete;
 
  private:
   std::shared_ptr<IStream> input_;
+  CodecArena arena_;
+  drflac_allocation_callbacks alloc_callbacks_;
   drflac* flac_;
 };
 
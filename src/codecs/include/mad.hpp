@@ -32,6 +32,8 @@ class MadMp3Decoder : public ICodec {
   auto DecodeTo(std::span<sample::Sample> destination)
       -> cpp::result<OutputInfo, Error> override;
 
+  auto Reset() -> void override;
+
   MadMp3Decoder(const MadMp3Decoder&) = delete;
   MadMp3Decoder& operator=(const MadMp3Decoder&) = delete;
 
@@ -31,6 +31,8 @@ class NativeDecoder : public ICodec {
   auto DecodeTo(std::span<sample::Sample> destination)
       -> cpp::result<OutputInfo, Error> override;
 
+  auto Reset() -> void override;
+
   NativeDecoder(const NativeDecoder&) = delete;
   NativeDecoder& operator=(const NativeDecoder&) = delete;
 
@@ -32,12 +32,15 @@ class TremorVorbisDecoder : public ICodec {
   auto DecodeTo(std::span<sample::Sample> destination)
       -> cpp::result<OutputInfo, Error> override;
 
+  auto Reset() -> void override;
+
   TremorVorbisDecoder(const TremorVorbisDecoder&) = delete;
   TremorVorbisDecoder& operator=(const TremorVorbisDecoder&) = delete;
 
  private:
   std::shared_ptr<IStream> input_;
   std::unique_ptr<TremorOggVorbis_File> vorbis_;
+  bool is_open_;
 };
 
 }  // namespace codecs
@@ -51,6 +51,22 @@ MadMp3Decoder::~MadMp3Decoder() {
   mad_synth_finish(synth_.get());
 }
 
+auto MadMp3Decoder::Reset() -> void {
+  // Reinitialise libmad's state in-place, rather than reallocating it.
+  mad_stream_finish(stream_.get());
+  mad_frame_finish(frame_.get());
+  mad_synth_finish(synth_.get());
+  mad_stream_init(stream_.get());
+  mad_frame_init(frame_.get());
+  mad_synth_init(synth_.get());
+
+  input_.reset();
+  buffer_.Empty();
+  current_sample_ = -1;
+  is_eof_ = false;
+  is_eos_ = false;
+}
+
 auto MadMp3Decoder::GetBytesUsed() -> std::size_t {
   if (stream_->next_frame) {
     return stream_->next_frame - stream_->buffer;
@@ -23,6 +23,10 @@ namespace codecs {
 
 NativeDecoder::NativeDecoder() : input_() {}
 
+auto NativeDecoder::Reset() -> void {
+  input_.reset();
+}
+
 auto NativeDecoder::OpenStream(std::shared_ptr<IStream> input, uint32_t offset)
     -> cpp::result<OutputFormat, ICodec::Error> {
   input_ = input;
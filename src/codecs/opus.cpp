@@ -73,9 +73,15 @@ XiphOpusDecoder::XiphOpusDecoder()
     : input_(nullptr), opus_(nullptr), num_channels_() {}
 
 XiphOpusDecoder::~XiphOpusDecoder() {
+  Reset();
+}
+
+auto XiphOpusDecoder::Reset() -> void {
   if (opus_ != nullptr) {
     op_free(opus_);
+    opus_ = nullptr;
   }
+  input_.reset();
 }
 
 auto XiphOpusDecoder::OpenStream(std::shared_ptr<IStream> input,
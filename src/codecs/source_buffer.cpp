@@ -8,6 +8,7 @@
 #include <sys/_stdint.h>
 
 #include <algorithm>
+#include <cassert>
 #include <cstring>
 
 #include "esp_heap_caps.h"
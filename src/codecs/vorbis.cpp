@@ -71,15 +71,28 @@ TremorVorbisDecoder::TremorVorbisDecoder()
     : input_(),
       vorbis_(reinterpret_cast<TremorOggVorbis_File*>(
           heap_caps_malloc(sizeof(TremorOggVorbis_File),
-                           MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT))) {}
+                           MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT))),
+      is_open_(false) {}
 
 TremorVorbisDecoder::~TremorVorbisDecoder() {
-  ov_clear(vorbis_.get());
+  Reset();
+}
+
+auto TremorVorbisDecoder::Reset() -> void {
+  // The OggVorbis_File itself is kept around for the next stream; only its
+  // contents are freed.
+  if (is_open_) {
+    ov_clear(vorbis_.get());
+    is_open_ = false;
+  }
+  input_.reset();
 }
 
 auto TremorVorbisDecoder::OpenStream(std::shared_ptr<IStream> input,
                                      uint32_t offset)
     -> cpp::result<OutputFormat, Error> {
+  input_ = input;
+
   int res = ov_open_callbacks(input.get(), vorbis_.get(), NULL, 0, kCallbacks);
   if (res < 0) {
     std::string err;
@@ -105,6 +118,7 @@ auto TremorVorbisDecoder::OpenStream(std::shared_ptr<IStream> input,
     ESP_LOGE(kTag, "error beginning stream: %s", err.c_str());
     return cpp::fail(Error::kMalformedData);
   }
+  is_open_ = true;
 
   vorbis_info* info = ov_info(vorbis_.get(), -1);
   if (info == NULL) {
@@ -101,6 +101,11 @@ WavDecoder::WavDecoder() : input_(), buffer_() {}
 
 WavDecoder::~WavDecoder() {}
 
+auto WavDecoder::Reset() -> void {
+  input_.reset();
+  buffer_.Empty();
+}
+
 auto WavDecoder::OpenStream(std::shared_ptr<IStream> input, uint32_t offset)
     -> cpp::result<OutputFormat, Error> {
   input_ = input;
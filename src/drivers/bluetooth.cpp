@@ -50,7 +50,7 @@ auto gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t* param) -> void {
     tinyfsm::FsmList<bluetooth::BluetoothState>::dispatch(
         bluetooth::events::internal::Gap{.type = event, .param = copy});
   } else {
-    sBgWorker->Dispatch<void>([=]() {
+    sBgWorker->Post([=]() {
       auto lock = bluetooth::BluetoothState::lock();
       tinyfsm::FsmList<bluetooth::BluetoothState>::dispatch(
           bluetooth::events::internal::Gap{.type = event, .param = copy});
@@ -66,7 +66,7 @@ auto avrcp_cb(esp_avrc_ct_cb_event_t event, esp_avrc_ct_cb_param_t* param)
     tinyfsm::FsmList<bluetooth::BluetoothState>::dispatch(
         bluetooth::events::internal::Avrc{.type = event, .param = copy});
   } else {
-    sBgWorker->Dispatch<void>([=]() {
+    sBgWorker->Post([=]() {
       auto lock = bluetooth::BluetoothState::lock();
       tinyfsm::FsmList<bluetooth::BluetoothState>::dispatch(
           bluetooth::events::internal::Avrc{.type = event, .param = copy});
@@ -77,7 +77,7 @@ auto avrcp_cb(esp_avrc_ct_cb_event_t event, esp_avrc_ct_cb_param_t* param)
 auto avrcp_tg_cb(esp_avrc_tg_cb_event_t event, esp_avrc_tg_cb_param_t* param)
     -> void {
   esp_avrc_tg_cb_param_t copy = *param;
-  sBgWorker->Dispatch<void>([=]() {
+  sBgWorker->Post([=]() {
     auto lock = bluetooth::BluetoothState::lock();
     tinyfsm::FsmList<bluetooth::BluetoothState>::dispatch(
         bluetooth::events::internal::Avrctg{.type = event, .param = copy});
@@ -86,7 +86,7 @@ auto avrcp_tg_cb(esp_avrc_tg_cb_event_t event, esp_avrc_tg_cb_param_t* param)
 
 auto a2dp_cb(esp_a2d_cb_event_t event, esp_a2d_cb_param_t* param) -> void {
   esp_a2d_cb_param_t copy = *param;
-  sBgWorker->Dispatch<void>([=]() {
+  sBgWorker->Post([=]() {
     auto lock = bluetooth::BluetoothState::lock();
     tinyfsm::FsmList<bluetooth::BluetoothState>::dispatch(
         bluetooth::events::internal::A2dp{.type = event, .param = copy});
@@ -630,7 +630,7 @@ void Idle::react(events::internal::Gap ev) {
 TimerHandle_t sTimeoutTimer;
 
 static void timeoutCallback(TimerHandle_t) {
-  sBgWorker->Dispatch<void>([]() {
+  sBgWorker->Post([]() {
     auto lock = bluetooth::BluetoothState::lock();
     tinyfsm::FsmList<bluetooth::BluetoothState>::dispatch(
         events::ConnectTimedOut{});
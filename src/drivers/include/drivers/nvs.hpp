@@ -128,6 +128,9 @@ class NvsStorage {
   auto AmpLeftBias() -> int_fast8_t;
   auto AmpLeftBias(int_fast8_t) -> void;
 
+  auto ReplayGain() -> bool;
+  auto ReplayGain(bool) -> void;
+
   enum class InputModes : uint8_t {
     kButtonsOnly = 0,
     kButtonsWithWheel = 1,
@@ -141,6 +144,9 @@ class NvsStorage {
   auto DbAutoIndex() -> bool;
   auto DbAutoIndex(bool) -> void;
 
+  auto DbLoudnessAnalysis() -> bool;
+  auto DbLoudnessAnalysis(bool) -> void;
+
   explicit NvsStorage(nvs_handle_t);
   ~NvsStorage();
 
@@ -163,6 +169,7 @@ class NvsStorage {
   Setting<uint16_t> amp_max_vol_;
   Setting<uint16_t> amp_cur_vol_;
   Setting<int8_t> amp_left_bias_;
+  Setting<uint8_t> replay_gain_;
   Setting<uint8_t> input_mode_;
   Setting<uint8_t> output_mode_;
 
@@ -172,6 +179,7 @@ class NvsStorage {
   Setting<std::vector<bluetooth::MacAndName>> bt_names_;
 
   Setting<uint8_t> db_auto_index_;
+  Setting<uint8_t> db_loudness_analysis_;
 
   util::LruCache<10, bluetooth::mac_addr_t, uint8_t> bt_volumes_;
   bool bt_volumes_dirty_;
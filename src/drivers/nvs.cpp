@@ -41,6 +41,8 @@ static constexpr char kKeyDisplayRows[] = "disprows";
 static constexpr char kKeyHapticMotorType[] = "hapticmtype";
 static constexpr char kKeyLraCalibration[] = "lra_cali";
 static constexpr char kKeyDbAutoIndex[] = "dbautoindex";
+static constexpr char kKeyDbLoudnessAnalysis[] = "dbloudness";
+static constexpr char kKeyReplayGain[] = "replaygain";
 static constexpr char kKeyFastCharge[] = "fastchg";
 
 static auto nvs_get_string(nvs_handle_t nvs, const char* key)
@@ -272,12 +274,14 @@ NvsStorage::NvsStorage(nvs_handle_t handle)
       amp_max_vol_(kKeyAmpMaxVolume),
       amp_cur_vol_(kKeyAmpCurrentVolume),
       amp_left_bias_(kKeyAmpLeftBias),
+      replay_gain_(kKeyReplayGain),
       input_mode_(kKeyPrimaryInput),
       output_mode_(kKeyOutput),
       theme_{kKeyInterfaceTheme},
       bt_preferred_(kKeyBluetoothPreferred),
       bt_names_(kKeyBluetoothNames),
       db_auto_index_(kKeyDbAutoIndex),
+      db_loudness_analysis_(kKeyDbLoudnessAnalysis),
       bt_volumes_(),
       bt_volumes_dirty_(false) {}
 
@@ -298,12 +302,14 @@ auto NvsStorage::Read() -> void {
   amp_max_vol_.read(handle_);
   amp_cur_vol_.read(handle_);
   amp_left_bias_.read(handle_);
+  replay_gain_.read(handle_);
   input_mode_.read(handle_);
   output_mode_.read(handle_);
   theme_.read(handle_);
   bt_preferred_.read(handle_);
   bt_names_.read(handle_);
   db_auto_index_.read(handle_);
+  db_loudness_analysis_.read(handle_);
   readBtVolumes();
 }
 
@@ -319,12 +325,14 @@ auto NvsStorage::Write() -> bool {
   amp_max_vol_.write(handle_);
   amp_cur_vol_.write(handle_);
   amp_left_bias_.write(handle_);
+  replay_gain_.write(handle_);
   input_mode_.write(handle_);
   output_mode_.write(handle_);
   theme_.write(handle_);
   bt_preferred_.write(handle_);
   bt_names_.write(handle_);
   db_auto_index_.write(handle_);
+  db_loudness_analysis_.write(handle_);
   writeBtVolumes();
   return nvs_commit(handle_) == ESP_OK;
 }
@@ -545,6 +553,16 @@ auto NvsStorage::AmpLeftBias(int_fast8_t val) -> void {
   amp_left_bias_.set(val);
 }
 
+auto NvsStorage::ReplayGain() -> bool {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return replay_gain_.get().value_or(false);
+}
+
+auto NvsStorage::ReplayGain(bool en) -> void {
+  std::lock_guard<std::mutex> lock{mutex_};
+  replay_gain_.set(static_cast<uint8_t>(en));
+}
+
 auto NvsStorage::PrimaryInput() -> InputModes {
   std::lock_guard<std::mutex> lock{mutex_};
   switch (input_mode_.get().value_or(3)) {
@@ -576,6 +594,16 @@ auto NvsStorage::DbAutoIndex(bool en) -> void {
   db_auto_index_.set(static_cast<uint8_t>(en));
 }
 
+auto NvsStorage::DbLoudnessAnalysis() -> bool {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return db_loudness_analysis_.get().value_or(false);
+}
+
+auto NvsStorage::DbLoudnessAnalysis(bool en) -> void {
+  std::lock_guard<std::mutex> lock{mutex_};
+  db_loudness_analysis_.set(static_cast<uint8_t>(en));
+}
+
 class VolumesParseClient : public cppbor::ParseClient {
  public:
   VolumesParseClient(util::LruCache<10, bluetooth::mac_addr_t, uint8_t>& out)
@@ -6,9 +6,12 @@
 
 #include "collation.hpp"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <memory>
+#include <mutex>
 
 #include "esp_flash_spi_init.h"
 #include "esp_log.h"
@@ -80,19 +83,91 @@ auto GLibCollator::create() -> GLibCollator* {
 GLibCollator::GLibCollator(const std::string& name,
                            const esp_partition_mmap_handle_t handle,
                            std::unique_ptr<locale_data_t> locale)
-    : name_(name), handle_(handle), locale_data_(std::move(locale)) {}
+    : name_(name),
+      handle_(handle),
+      locale_data_(std::move(locale)),
+      cache_mutex_(),
+      cache_(),
+      cache_clock_(0) {}
 
 GLibCollator::~GLibCollator() {
   esp_partition_munmap(handle_);
 }
 
-auto GLibCollator::Transform(const std::string& in) -> std::string {
-  size_t size = glib_strxfrm(NULL, in.c_str(), 0, locale_data_.get());
-  char* dest = new char[size + 1]{0};
-  size = glib_strxfrm(dest, in.c_str(), size, locale_data_.get());
-  std::string out{dest, size};
-  delete[] dest;
-  return out;
+auto GLibCollator::Transform(std::string_view in, std::pmr::string& out)
+    -> void {
+  size_t hash = std::hash<std::string_view>{}(in);
+  if (lookup(hash, in, out)) {
+    return;
+  }
+
+  // Transform without holding the lock, so that tasks collating different
+  // strings don't have to wait for each other. strxfrm needs a terminated
+  // string, which `in` may not be. Most tags are short enough to terminate on
+  // the stack.
+  char buf[kMaxStackInput];
+  std::pmr::string long_in{out.get_allocator()};
+  const char* terminated;
+  if (in.size() < sizeof(buf)) {
+    std::memcpy(buf, in.data(), in.size());
+    buf[in.size()] = '\0';
+    terminated = buf;
+  } else {
+    long_in.assign(in);
+    terminated = long_in.c_str();
+  }
+  transformUncached(terminated, out);
+
+  std::lock_guard<std::mutex> lock{cache_mutex_};
+  cache_clock_++;
+
+  CacheEntry* oldest = &cache_[0];
+  for (auto& entry : cache_) {
+    if (entry.last_used > 0 && entry.hash == hash && entry.in == in) {
+      // Another task transformed the same string whilst we were.
+      entry.last_used = cache_clock_;
+      return;
+    }
+    if (entry.last_used < oldest->last_used) {
+      oldest = &entry;
+    }
+  }
+
+  // Evict the least recently used entry to make room. Assigning to its strings
+  // reuses their existing storage.
+  oldest->hash = hash;
+  oldest->last_used = cache_clock_;
+  oldest->in.assign(in);
+  oldest->out.assign(out);
+}
+
+auto GLibCollator::lookup(size_t hash,
+                          std::string_view in,
+                          std::pmr::string& out) -> bool {
+  std::lock_guard<std::mutex> lock{cache_mutex_};
+  for (auto& entry : cache_) {
+    if (entry.last_used > 0 && entry.hash == hash && entry.in == in) {
+      entry.last_used = ++cache_clock_;
+      out.assign(entry.out);
+      return true;
+    }
+  }
+  return false;
+}
+
+auto GLibCollator::transformUncached(const char* in, std::pmr::string& out)
+    -> void {
+  // Transformed strings are generally a few times longer than their input, so
+  // start with a buffer that's likely to be big enough. This means we only
+  // need a second pass for unusually long results.
+  size_t guess = std::max(out.capacity(), std::strlen(in) * 4 + 16);
+  out.resize(guess);
+  size_t size = glib_strxfrm(out.data(), in, out.size(), locale_data_.get());
+  if (size >= out.size()) {
+    out.resize(size + 1);
+    size = glib_strxfrm(out.data(), in, out.size(), locale_data_.get());
+  }
+  out.resize(size);
 }
 
 }  // namespace locale
@@ -6,14 +6,20 @@
 
 #pragma once
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
+#include <string_view>
 
 #include "esp_partition.h"
 
+#include "memory_resource.hpp"
 #include "strxfrm.h"
 
 namespace locale {
@@ -33,7 +39,15 @@ class ICollator {
    * to be human readable.
    */
   virtual auto Describe() -> std::optional<std::string> = 0;
-  virtual auto Transform(const std::string&) -> std::string = 0;
+
+  /*
+   * Transforms `in`, replacing the contents of `out` with the result. Any
+   * existing capacity in `out` is reused, so transforming into a long-lived
+   * buffer, or directly into the key that needs the result, avoids any
+   * intermediate allocations.
+   */
+  virtual auto Transform(std::string_view in, std::pmr::string& out)
+      -> void = 0;
 };
 
 /* Creates and returns the best available collator. */
@@ -46,7 +60,9 @@ auto CreateCollator() -> std::unique_ptr<ICollator>;
 class NoopCollator : public ICollator {
  public:
   auto Describe() -> std::optional<std::string> override { return {}; }
-  auto Transform(const std::string& in) -> std::string override { return in; }
+  auto Transform(std::string_view in, std::pmr::string& out) -> void override {
+    out.assign(in);
+  }
 };
 
 /*
@@ -60,16 +76,44 @@ class GLibCollator : public ICollator {
   ~GLibCollator();
 
   auto Describe() -> std::optional<std::string> override { return name_; }
-  auto Transform(const std::string& in) -> std::string override;
+  auto Transform(std::string_view in, std::pmr::string& out) -> void override;
 
  private:
   GLibCollator(const std::string& name,
                const esp_partition_mmap_handle_t,
                std::unique_ptr<locale_data_t>);
 
+  auto lookup(size_t hash, std::string_view in, std::pmr::string& out) -> bool;
+  auto transformUncached(const char* in, std::pmr::string& out) -> void;
+
   const std::string name_;
   const esp_partition_mmap_handle_t handle_;
   std::unique_ptr<locale_data_t> locale_data_;
+
+  /*
+   * Cache of recent transforms. When indexing, the same few strings (the
+   * current artist, album, genre, etc.) come up for every track and every
+   * index that includes them, so even a small cache avoids the vast majority
+   * of calls to strxfrm.
+   *
+   * Entries are found by a linear scan of their hashes, and evicted entries
+   * have their strings reused, so that neither hits nor misses need to
+   * allocate once the cache has warmed up. The lock is only held to look up
+   * and insert entries; strxfrm itself runs unlocked.
+   */
+  struct CacheEntry {
+    size_t hash = 0;
+    uint32_t last_used = 0;
+    std::pmr::string in{&memory::kSpiRamResource};
+    std::pmr::string out{&memory::kSpiRamResource};
+  };
+  static constexpr size_t kCacheSize = 32;
+  // Inputs shorter than this are copied onto the stack to be terminated.
+  static constexpr size_t kMaxStackInput = 128;
+
+  std::mutex cache_mutex_;
+  std::array<CacheEntry, kCacheSize> cache_;
+  uint32_t cache_clock_;
 };
 
 }  // namespace locale
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "arena.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory_resource>
+#include <utility>
+
+#include <esp_heap_caps.h>
+
+namespace memory {
+
+static std::atomic<size_t> sInUse{0};
+static std::atomic<size_t> sReserved{0};
+static std::atomic<size_t> sPeak{0};
+
+static auto addInUse(size_t bytes) -> void {
+  size_t now = sInUse.fetch_add(bytes) + bytes;
+  size_t peak = sPeak.load();
+  while (now > peak && !sPeak.compare_exchange_weak(peak, now)) {
+  }
+}
+
+Arena::Arena(Capabilities caps, size_t chunk_size)
+    : caps_(caps), chunk_size_(chunk_size), head_(nullptr), current_(nullptr) {}
+
+Arena::~Arena() {
+  rewind({nullptr, 0});
+  while (head_) {
+    Chunk* next = head_->next;
+    freeChunk(head_);
+    head_ = next;
+  }
+}
+
+auto Arena::mark() const -> Marker {
+  if (!current_) {
+    return {nullptr, 0};
+  }
+  return {current_, current_->used};
+}
+
+auto Arena::rewind(Marker marker) -> void {
+  Chunk* chunk = marker.chunk ? static_cast<Chunk*>(marker.chunk) : head_;
+  if (!chunk) {
+    return;
+  }
+  size_t used = marker.chunk ? marker.used : 0;
+
+  size_t released = chunk->used - used;
+  chunk->used = used;
+
+  // Every chunk after the current one is always empty, so only the chunks
+  // between the marker and the current chunk need releasing.
+  Chunk* prev = chunk;
+  while (prev->next) {
+    Chunk* c = prev->next;
+    released += c->used;
+    c->used = 0;
+    if (c->size > chunk_size_) {
+      prev->next = c->next;
+      freeChunk(c);
+    } else {
+      prev = c;
+    }
+  }
+
+  current_ = chunk;
+  sInUse -= released;
+}
+
+auto Arena::reset() -> void {
+  rewind({nullptr, 0});
+  if (!head_) {
+    return;
+  }
+  while (head_->next) {
+    Chunk* next = head_->next->next;
+    freeChunk(head_->next);
+    head_->next = next;
+  }
+}
+
+auto Arena::stats() -> Stats {
+  return {
+      .in_use = sInUse,
+      .reserved = sReserved,
+      .peak = sPeak,
+  };
+}
+
+auto Arena::newChunk(size_t min_size) -> Chunk* {
+  size_t size = std::max(chunk_size_, min_size);
+  void* mem = heap_caps_malloc(sizeof(Chunk) + size, std::to_underlying(caps_));
+  if (!mem) {
+    return nullptr;
+  }
+  sReserved += sizeof(Chunk) + size;
+  return new (mem) Chunk{
+      .next = nullptr,
+      .size = size,
+      .used = 0,
+  };
+}
+
+auto Arena::freeChunk(Chunk* chunk) -> void {
+  sReserved -= sizeof(Chunk) + chunk->size;
+  heap_caps_free(chunk);
+}
+
+void* Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+  // Enough space for the allocation, no matter how the chunk is aligned.
+  size_t worst_case = bytes + alignment - 1;
+  if (!current_) {
+    head_ = current_ = newChunk(worst_case);
+    if (!current_) {
+      return nullptr;
+    }
+  }
+
+  for (;;) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(current_->data());
+    uintptr_t aligned = (start + current_->used + alignment - 1) &
+                        ~static_cast<uintptr_t>(alignment - 1);
+    size_t end = aligned - start + bytes;
+    if (end <= current_->size) {
+      addInUse(end - current_->used);
+      current_->used = end;
+      return reinterpret_cast<void*>(aligned);
+    }
+
+    // Move on to the next chunk, making a new one if there isn't a big enough
+    // one left over from before.
+    Chunk* next = current_->next;
+    if (!next || next->size < worst_case) {
+      Chunk* fresh = newChunk(worst_case);
+      if (!fresh) {
+        return nullptr;
+      }
+      fresh->next = next;
+      current_->next = fresh;
+      next = fresh;
+    }
+    current_ = next;
+  }
+}
+
+void Arena::do_deallocate(void* p,
+                          std::size_t bytes,
+                          std::size_t alignment) {
+  // Memory is only reclaimed by rewinding.
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
+auto TaskArena() -> Arena& {
+  // Arenas are never destroyed, since the tasks that use them run for the
+  // lifetime of the device. A pointer is used so that the TLS itself is
+  // trivially destructible.
+  thread_local Arena* sArena = nullptr;
+  if (!sArena) {
+    sArena = new Arena{Capabilities::kSpiRam};
+  }
+  return *sArena;
+}
+
+}  // namespace memory
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+#include "memory_resource.hpp"
+
+namespace memory {
+
+/*
+ * A monotonic memory resource for short-lived allocations. Allocating is just
+ * a pointer bump within a chunk obtained from the heap, and deallocating does
+ * nothing; memory is instead reclaimed all at once, by rewinding the arena to
+ * an earlier point (usually with an ArenaScope).
+ *
+ * Chunks are kept around after being rewound past, so an arena that is used
+ * repeatedly for similar work stops touching the heap at all once it has grown
+ * to its working size. This keeps lots of small, short-lived allocations from
+ * fragmenting the heap.
+ *
+ * Arenas are not thread-safe. Use TaskArena() to get one for the current task.
+ */
+class Arena : public std::pmr::memory_resource {
+ public:
+  static constexpr size_t kDefaultChunkSize = 4 * 1024;
+
+  explicit Arena(Capabilities, size_t chunk_size = kDefaultChunkSize);
+  ~Arena();
+
+  /* A position within an arena, which the arena may later be rewound to. */
+  struct Marker {
+    void* chunk;
+    size_t used;
+  };
+
+  auto mark() const -> Marker;
+
+  /*
+   * Releases every allocation made since the given marker was taken. Chunks
+   * are kept for reuse, except for any that were made larger than usual to
+   * fit an unusually large allocation.
+   */
+  auto rewind(Marker) -> void;
+
+  /* Releases every allocation, and returns all but one chunk to the heap. */
+  auto reset() -> void;
+
+  struct Stats {
+    // Bytes currently allocated from arenas.
+    size_t in_use;
+    // Bytes of heap currently held by arenas, whether in use or not.
+    size_t reserved;
+    // The most bytes that have been allocated from arenas at once.
+    size_t peak;
+  };
+
+  /* Returns stats summed across every arena. */
+  static auto stats() -> Stats;
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+ private:
+  struct Chunk {
+    Chunk* next;
+    size_t size;
+    size_t used;
+
+    auto data() -> std::byte* { return reinterpret_cast<std::byte*>(this + 1); }
+  };
+
+  auto newChunk(size_t min_size) -> Chunk*;
+  auto freeChunk(Chunk*) -> void;
+
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void* p,
+                     std::size_t bytes,
+                     std::size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override;
+
+  const Capabilities caps_;
+  const size_t chunk_size_;
+
+  Chunk* head_;
+  Chunk* current_;
+};
+
+/*
+ * Returns an arena for the calling task, backed by SPIRAM. Allocations from it
+ * must only be used by the calling task, and should be scoped with an
+ * ArenaScope.
+ */
+auto TaskArena() -> Arena&;
+
+/*
+ * RAII helper for an arena. Everything allocated from the arena whilst the
+ * scope is alive is released when it's destroyed, so anything allocated from
+ * it must be destroyed first. Scopes may be nested.
+ */
+class ArenaScope {
+ public:
+  explicit ArenaScope(Arena& arena = TaskArena())
+      : arena_(arena), marker_(arena.mark()) {}
+  ~ArenaScope() { arena_.rewind(marker_); }
+
+  auto resource() -> std::pmr::memory_resource* { return &arena_; }
+
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+ private:
+  Arena& arena_;
+  const Arena::Marker marker_;
+};
+
+}  // namespace memory
@@ -6,11 +6,13 @@
 
 #pragma once
 
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <span>
 
 #include "esp32/himem.h"
+#include "esp_err.h"
 
 /*
  * Wrapper around an ESP-IDF himem allocation, which uses RAII to clean up after
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory_resource>
 #include <string>
 
@@ -21,12 +22,52 @@ enum class Capabilities : uint32_t {
   kSpiRam = MALLOC_CAP_SPIRAM,
 };
 
+/* The parts of the firmware that allocations can be attributed to. */
+enum class Subsystem {
+  kUntagged,
+  kDatabase,
+  kAudio,
+  kUi,
+  kLua,
+  kTts,
+
+  kCount,
+};
+
+constexpr size_t kNumSubsystems = static_cast<size_t>(Subsystem::kCount);
+
+struct Usage {
+  // Bytes currently allocated.
+  size_t live;
+  // The most bytes that have been allocated at once.
+  size_t peak;
+  // How many allocations have been made in total.
+  uint32_t allocs;
+};
+
+auto SubsystemName(Subsystem) -> const char*;
+auto GetUsage(Subsystem) -> Usage;
+
+/*
+ * Records allocations that don't go through a Resource, such as Lua's. These
+ * are cheap enough (a few relaxed atomic operations) to leave on all the time.
+ */
+auto RecordAlloc(Subsystem, size_t bytes) -> void;
+auto RecordFree(Subsystem, size_t bytes) -> void;
+
+/*
+ * A memory resource that allocates directly from the heap with the given
+ * capabilities. Allocations are attributed to the resource's subsystem.
+ */
 class Resource : public std::pmr::memory_resource {
  public:
-  explicit Resource(Capabilities caps) : caps_(caps) {}
+  constexpr explicit Resource(Capabilities caps,
+                              Subsystem subsystem = Subsystem::kUntagged)
+      : caps_(caps), subsystem_(subsystem) {}
 
  private:
   Capabilities caps_;
+  Subsystem subsystem_;
 
   void* do_allocate(std::size_t bytes, std::size_t alignment) override;
 
@@ -40,6 +81,13 @@ class Resource : public std::pmr::memory_resource {
 
 extern Resource kSpiRamResource;
 
+// SPIRAM resources for each subsystem.
+extern Resource kDatabaseResource;
+extern Resource kAudioResource;
+extern Resource kUiResource;
+extern Resource kLuaResource;
+extern Resource kTtsResource;
+
 template <typename T>
 auto SpiRamAllocator() {
   return std::pmr::polymorphic_allocator<T>{&kSpiRamResource};
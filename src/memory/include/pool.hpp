@@ -0,0 +1,74 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+
+#include "memory_resource.hpp"
+
+namespace memory {
+
+/*
+ * A thread-safe memory resource for small allocations that are made and freed
+ * often, such as short strings. Each allocation is rounded up to one of a few
+ * fixed size classes, and served from slabs that are dedicated to that size
+ * class. Freed blocks go back onto their class's free list, rather than back to
+ * the heap, so churn in small allocations never fragments the heap.
+ *
+ * Allocations too large for any size class are passed through to the heap.
+ */
+class Pool : public std::pmr::memory_resource {
+ public:
+  static constexpr std::array<size_t, 8> kSizeClasses = {16,  32,  48,  64,
+                                                         96, 128, 192, 256};
+  static constexpr size_t kSlabSize = 4 * 1024;
+
+  explicit Pool(Capabilities);
+
+  struct Stats {
+    // Bytes currently allocated from size classes, after rounding up.
+    size_t in_use;
+    // Bytes of heap held in slabs, whether in use or not.
+    size_t reserved;
+    // Bytes currently allocated that were too large for any size class.
+    size_t passthrough;
+  };
+
+  auto stats() -> Stats;
+
+  Pool(const Pool&) = delete;
+  Pool& operator=(const Pool&) = delete;
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static auto sizeClass(std::size_t bytes, std::size_t alignment) -> size_t;
+  auto refill(size_t size_class) -> bool;
+
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void* p,
+                     std::size_t bytes,
+                     std::size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override;
+
+  const Capabilities caps_;
+
+  std::mutex mutex_;
+  std::array<FreeBlock*, kSizeClasses.size()> free_;
+  Stats stats_;
+};
+
+/* A pool for small, frequently churned allocations in SPIRAM. */
+extern Pool kSpiRamPool;
+
+}  // namespace memory
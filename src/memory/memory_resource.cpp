@@ -6,6 +6,8 @@
 
 #include "memory_resource.hpp"
 
+#include <array>
+#include <atomic>
 #include <memory_resource>
 #include <string>
 #include <utility>
@@ -17,14 +19,77 @@ namespace memory {
 
 Resource kSpiRamResource{Capabilities::kSpiRam};
 
+Resource kDatabaseResource{Capabilities::kSpiRam, Subsystem::kDatabase};
+Resource kAudioResource{Capabilities::kSpiRam, Subsystem::kAudio};
+Resource kUiResource{Capabilities::kSpiRam, Subsystem::kUi};
+Resource kLuaResource{Capabilities::kSpiRam, Subsystem::kLua};
+Resource kTtsResource{Capabilities::kSpiRam, Subsystem::kTts};
+
+struct Counters {
+  std::atomic<size_t> live;
+  std::atomic<size_t> peak;
+  std::atomic<uint32_t> allocs;
+};
+
+static std::array<Counters, kNumSubsystems> sCounters;
+
+auto SubsystemName(Subsystem s) -> const char* {
+  switch (s) {
+    case Subsystem::kUntagged:
+      return "untagged";
+    case Subsystem::kDatabase:
+      return "database";
+    case Subsystem::kAudio:
+      return "audio";
+    case Subsystem::kUi:
+      return "ui";
+    case Subsystem::kLua:
+      return "lua";
+    case Subsystem::kTts:
+      return "tts";
+    case Subsystem::kCount:
+      break;
+  }
+  return "";
+}
+
+auto GetUsage(Subsystem s) -> Usage {
+  const auto& c = sCounters[static_cast<size_t>(s)];
+  return {
+      .live = c.live.load(std::memory_order_relaxed),
+      .peak = c.peak.load(std::memory_order_relaxed),
+      .allocs = c.allocs.load(std::memory_order_relaxed),
+  };
+}
+
+auto RecordAlloc(Subsystem s, size_t bytes) -> void {
+  auto& c = sCounters[static_cast<size_t>(s)];
+  c.allocs.fetch_add(1, std::memory_order_relaxed);
+  size_t live = c.live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  size_t peak = c.peak.load(std::memory_order_relaxed);
+  while (live > peak &&
+         !c.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+auto RecordFree(Subsystem s, size_t bytes) -> void {
+  sCounters[static_cast<size_t>(s)].live.fetch_sub(bytes,
+                                                   std::memory_order_relaxed);
+}
+
 void* Resource::do_allocate(std::size_t bytes, std::size_t alignment) {
-  return heap_caps_malloc(bytes, std::to_underlying(caps_));
+  void* p = heap_caps_malloc(bytes, std::to_underlying(caps_));
+  if (p) {
+    RecordAlloc(subsystem_, bytes);
+  }
+  return p;
 }
 
 void Resource::do_deallocate(void* p,
                              std::size_t bytes,
                              std::size_t alignment) {
   heap_caps_free(p);
+  RecordFree(subsystem_, bytes);
 }
 
 bool Resource::do_is_equal(
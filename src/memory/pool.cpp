@@ -0,0 +1,105 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "pool.hpp"
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <utility>
+
+#include <esp_heap_caps.h>
+
+namespace memory {
+
+Pool kSpiRamPool{Capabilities::kSpiRam};
+
+// Returned by sizeClass for allocations that don't fit in any size class.
+static constexpr size_t kNoSizeClass = Pool::kSizeClasses.size();
+
+Pool::Pool(Capabilities caps) : caps_(caps), free_(), stats_() {}
+
+auto Pool::stats() -> Stats {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return stats_;
+}
+
+auto Pool::sizeClass(std::size_t bytes, std::size_t alignment) -> size_t {
+  // Blocks within a slab are only guaranteed to be aligned to the size of a
+  // pointer.
+  if (alignment > alignof(FreeBlock)) {
+    return kNoSizeClass;
+  }
+  for (size_t i = 0; i < kSizeClasses.size(); i++) {
+    if (bytes <= kSizeClasses[i]) {
+      return i;
+    }
+  }
+  return kNoSizeClass;
+}
+
+auto Pool::refill(size_t size_class) -> bool {
+  // Slabs are never returned to the heap; once a size class has grown to its
+  // working size, it stays that size.
+  void* slab = heap_caps_malloc(kSlabSize, std::to_underlying(caps_));
+  if (!slab) {
+    return false;
+  }
+  stats_.reserved += kSlabSize;
+
+  size_t block_size = kSizeClasses[size_class];
+  std::byte* bytes = static_cast<std::byte*>(slab);
+  for (size_t offset = 0; offset + block_size <= kSlabSize;
+       offset += block_size) {
+    auto* block = reinterpret_cast<FreeBlock*>(bytes + offset);
+    block->next = free_[size_class];
+    free_[size_class] = block;
+  }
+  return true;
+}
+
+void* Pool::do_allocate(std::size_t bytes, std::size_t alignment) {
+  size_t size_class = sizeClass(bytes, alignment);
+  if (size_class == kNoSizeClass) {
+    void* p = heap_caps_malloc(bytes, std::to_underlying(caps_));
+    if (p) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      stats_.passthrough += bytes;
+    }
+    return p;
+  }
+
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!free_[size_class] && !refill(size_class)) {
+    return nullptr;
+  }
+  FreeBlock* block = free_[size_class];
+  free_[size_class] = block->next;
+  stats_.in_use += kSizeClasses[size_class];
+  return block;
+}
+
+void Pool::do_deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+  size_t size_class = sizeClass(bytes, alignment);
+  if (size_class == kNoSizeClass) {
+    heap_caps_free(p);
+    std::lock_guard<std::mutex> lock{mutex_};
+    stats_.passthrough -= bytes;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto* block = static_cast<FreeBlock*>(p);
+  block->next = free_[size_class];
+  free_[size_class] = block;
+  stats_.in_use -= kSizeClasses[size_class];
+}
+
+bool Pool::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
+}  // namespace memory
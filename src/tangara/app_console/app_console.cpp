@@ -9,6 +9,7 @@
 #include <dirent.h>
 
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -31,11 +32,14 @@
 #include "ff.h"
 #include "freertos/projdefs.h"
 
+#include "arena.hpp"
 #include "drivers/bluetooth.hpp"
 #include "drivers/bluetooth_types.hpp"
 #include "drivers/haptics.hpp"
 #include "drivers/samd.hpp"
 #include "memory_resource.hpp"
+#include "perf.hpp"
+#include "pool.hpp"
 
 #include "audio/audio_events.hpp"
 #include "audio/audio_fsm.hpp"
@@ -44,6 +48,7 @@
 #include "database/track.hpp"
 #include "events/event_queue.hpp"
 #include "lua/lua_registry.hpp"
+#include "lua/property.hpp"
 #include "system_fsm/service_locator.hpp"
 #include "system_fsm/system_events.hpp"
 #include "ui/ui_events.hpp"
@@ -315,6 +320,91 @@ void RegisterTasks() {
   esp_console_cmd_register(&cmd);
 }
 
+int CmdPerf(int argc, char** argv) {
+  static const std::pmr::string usage = "usage: perf [reset]";
+  bool reset = argc == 2 && std::string{argv[1]} == "reset";
+  if (argc > 2 || (argc == 2 && !reset)) {
+    std::cout << usage << std::endl;
+    return 1;
+  }
+
+  using tasks::perf::Metric;
+  std::cout << "metric\t\tcount\tp50 us\tp99 us\tmax us" << std::endl;
+  std::array<tasks::perf::Summary, tasks::perf::kNumMetrics> summaries;
+  for (size_t i = 0; i < tasks::perf::kNumMetrics; i++) {
+    auto metric = static_cast<Metric>(i);
+    summaries[i] = tasks::perf::Summarise(metric);
+    const auto& s = summaries[i];
+    std::cout << std::left << std::setw(16) << tasks::perf::Name(metric)
+              << s.count << "\t" << tasks::perf::Percentile(s, 50) << "\t"
+              << tasks::perf::Percentile(s, 99) << "\t" << s.max << std::endl;
+  }
+
+  // Per-second maximums make it possible to line up a glitch with the stage
+  // (or task) that was slow at the time.
+  std::cout << std::endl
+            << "max us per second, last " << tasks::perf::kNumWindows
+            << "s, oldest first:" << std::endl;
+  for (size_t i = 0; i < tasks::perf::kNumMetrics; i++) {
+    std::cout << std::left << std::setw(16)
+              << tasks::perf::Name(static_cast<Metric>(i));
+    for (uint32_t val : summaries[i].recent_max) {
+      std::cout << " " << val;
+    }
+    std::cout << std::endl;
+  }
+
+  std::cout << std::endl
+            << "task cpu %, last " << tasks::perf::kNumWindows
+            << "s, oldest first:" << std::endl;
+#if (configUSE_TRACE_FACILITY == 0 || configGENERATE_RUN_TIME_STATS == 0)
+  std::cout << "configUSE_TRACE_FACILITY and configGENERATE_RUN_TIME_STATS "
+               "must be enabled"
+            << std::endl;
+#endif
+  std::cout << "name\t\tavg\tpeak\trecent" << std::endl;
+  for (const auto& load : tasks::perf::TaskLoads()) {
+    std::cout << std::left << std::setw(16) << load.name
+              << static_cast<int>(load.average) << "\t"
+              << static_cast<int>(load.peak) << "\t";
+    for (uint8_t val : load.recent) {
+      std::cout << " " << static_cast<int>(val);
+    }
+    std::cout << std::endl;
+  }
+
+  if (reset) {
+    tasks::perf::Reset();
+    std::cout << std::endl << "histograms reset" << std::endl;
+  }
+  return 0;
+}
+
+void RegisterPerf() {
+  esp_console_cmd_t cmd{
+      .command = "perf",
+      .help = "prints latency histograms, audio pipeline timings, and task "
+              "cpu usage. 'perf reset' also clears the histograms.",
+      .hint = "[reset]",
+      .func = &CmdPerf,
+      .argtable = NULL};
+  esp_console_cmd_register(&cmd);
+}
+
+static auto printHeapStats(const char* name, uint32_t caps) -> void {
+  size_t free = heap_caps_get_free_size(caps);
+  size_t largest = heap_caps_get_largest_free_block(caps);
+  std::cout << "heap stats (" << name << "):" << std::endl;
+  std::cout << (free / 1024) << " KiB free" << std::endl;
+  std::cout << (heap_caps_get_minimum_free_size(caps) / 1024)
+            << " KiB free at lowest" << std::endl;
+  std::cout << (largest / 1024) << " KiB largest free block" << std::endl;
+  // How much of the free space can't be used for a single allocation.
+  if (free > 0) {
+    std::cout << (100 - largest * 100 / free) << "% fragmented" << std::endl;
+  }
+}
+
 int CmdHeaps(int argc, char** argv) {
   static const std::pmr::string usage = "usage: heaps";
   if (argc != 1) {
@@ -327,30 +417,62 @@ int CmdHeaps(int argc, char** argv) {
   std::cout << (esp_get_minimum_free_heap_size() / 1024)
             << " KiB free at lowest" << std::endl;
 
-  std::cout << "heap stats (internal):" << std::endl;
-  std::cout << (heap_caps_get_free_size(MALLOC_CAP_DMA) / 1024) << " KiB free"
-            << std::endl;
-  std::cout << (heap_caps_get_minimum_free_size(MALLOC_CAP_DMA) / 1024)
-            << " KiB free at lowest" << std::endl;
+  printHeapStats("internal", MALLOC_CAP_DMA);
+  printHeapStats("external", MALLOC_CAP_SPIRAM);
 
-  std::cout << "heap stats (external):" << std::endl;
-  std::cout << (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024)
-            << " KiB free" << std::endl;
-  std::cout << (heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM) / 1024)
-            << " KiB free at lowest" << std::endl;
+  auto arenas = memory::Arena::stats();
+  std::cout << "arenas:" << std::endl;
+  std::cout << (arenas.in_use / 1024) << " KiB in use, "
+            << (arenas.reserved / 1024) << " KiB reserved, "
+            << (arenas.peak / 1024) << " KiB at peak" << std::endl;
+
+  auto pool = memory::kSpiRamPool.stats();
+  std::cout << "small allocation pool:" << std::endl;
+  std::cout << (pool.in_use / 1024) << " KiB in use, "
+            << (pool.reserved / 1024) << " KiB reserved, "
+            << (pool.passthrough / 1024) << " KiB passed through" << std::endl;
 
   return 0;
 }
 
 void RegisterHeaps() {
   esp_console_cmd_t cmd{.command = "heaps",
-                        .help = "prints free heap space",
+                        .help = "prints free heap space, fragmentation, and "
+                                "arena and pool usage",
                         .hint = NULL,
                         .func = &CmdHeaps,
                         .argtable = NULL};
   esp_console_cmd_register(&cmd);
 }
 
+int CmdMem(int argc, char** argv) {
+  static const std::pmr::string usage = "usage: mem";
+  if (argc != 1) {
+    std::cout << usage << std::endl;
+    return 1;
+  }
+
+  std::cout << "subsystem\tlive KiB\tpeak KiB\tallocs" << std::endl;
+  for (size_t i = 0; i < memory::kNumSubsystems; i++) {
+    auto subsystem = static_cast<memory::Subsystem>(i);
+    auto u = memory::GetUsage(subsystem);
+    std::cout << std::left << std::setw(16) << memory::SubsystemName(subsystem)
+              << (u.live / 1024) << "\t\t" << (u.peak / 1024) << "\t\t"
+              << u.allocs << std::endl;
+  }
+
+  return 0;
+}
+
+void RegisterMem() {
+  esp_console_cmd_t cmd{.command = "mem",
+                        .help = "prints heap usage by subsystem",
+                        .hint = NULL,
+                        .func = &CmdMem,
+                        .argtable = NULL};
+  esp_console_cmd_register(&cmd);
+}
+
 int CmdStacks(int argc, char** argv) {
   static const std::pmr::string usage = "usage: stacks";
   if (argc != 1) {
@@ -370,6 +492,28 @@ void RegisterStacks() {
   esp_console_cmd_register(&cmd);
 }
 
+int CmdBindings(int argc, char** argv) {
+  static const std::pmr::string usage = "usage: bindings";
+  if (argc != 1) {
+    std::cout << usage << std::endl;
+    return 1;
+  }
+  auto stats = lua::Property::stats();
+  std::cout << stats.updates << " property updates" << std::endl;
+  std::cout << stats.coalesced << " coalesced before their bindings ran"
+            << std::endl;
+  return 0;
+}
+
+void RegisterBindings() {
+  esp_console_cmd_t cmd{.command = "bindings",
+                        .help = "prints stats about lua property bindings",
+                        .hint = NULL,
+                        .func = &CmdBindings,
+                        .argtable = NULL};
+  esp_console_cmd_register(&cmd);
+}
+
 #if CONFIG_HEAP_TRACING
 static heap_trace_record_t* sTraceRecords = nullptr;
 static bool sIsTracking = false;
@@ -700,9 +844,12 @@ auto AppConsole::RegisterExtraComponents() -> void {
   */
   RegisterDbInit();
   RegisterTasks();
+  RegisterPerf();
 
   RegisterHeaps();
+  RegisterMem();
   RegisterStacks();
+  RegisterBindings();
 
 #if CONFIG_HEAP_TRACING
   RegisterAllocs();
@@ -33,6 +33,7 @@
 #include "database/track.hpp"
 #include "drivers/i2s_dac.hpp"
 #include "events/event_queue.hpp"
+#include "perf.hpp"
 #include "sample.hpp"
 #include "tasks.hpp"
 #include "types.hpp"
@@ -66,7 +67,10 @@ auto Decoder::open(std::shared_ptr<TaggedStream> stream) -> void {
 }
 
 Decoder::Decoder(std::shared_ptr<SampleProcessor> processor)
-    : processor_(processor), next_stream_(xQueueCreate(1, sizeof(void*))) {
+    : processor_(processor),
+      next_stream_(xQueueCreate(1, sizeof(void*))),
+      codecs_(),
+      codec_(nullptr) {
   ESP_LOGI(kTag, "allocating codec buffer, %u KiB", kCodecBufferLength / 1024);
   codec_buffer_ = {
       reinterpret_cast<sample::Sample*>(heap_caps_calloc(
@@ -125,17 +129,26 @@ void Decoder::Main() {
 }
 
 auto Decoder::prepareDecode(std::shared_ptr<TaggedStream> stream) -> void {
+  // Start with whatever the tag parser could work out from the file's headers.
+  // The codec may give us a more accurate duration once it's opened the stream.
+  const auto& props = stream->tags()->audio();
+  std::optional<uint32_t> duration;
+  if (props.duration_ms) {
+    duration = *props.duration_ms / 1000;
+  }
+
   auto stub_track = std::make_shared<TrackInfo>(TrackInfo{
       .tags = stream->tags(),
       .uri = stream->Filepath(),
-      .duration = {},
+      .duration = duration,
       .start_offset = {},
-      .bitrate_kbps = {},
+      .bitrate_kbps = props.bitrate_kbps,
+      .replay_gain = stream->ReplayGain(),
       .encoding = stream->type(),
       .format = {},
   });
 
-  codec_.reset(codecs::CreateCodecForType(stream->type()).value_or(nullptr));
+  codec_ = codecs_.Acquire(stream->type()).value_or(nullptr);
   if (!codec_) {
     ESP_LOGE(kTag, "no codec found for stream");
     events::Audio().Dispatch(
@@ -147,6 +160,8 @@ auto Decoder::prepareDecode(std::shared_ptr<TaggedStream> stream) -> void {
   if (open_res.has_error()) {
     ESP_LOGE(kTag, "codec failed to start: %s",
              codecs::ICodec::ErrorString(open_res.error()).c_str());
+    codecs_.Release(codec_);
+    codec_ = nullptr;
     events::Audio().Dispatch(
         internal::DecodingFailedToStart{.track = stub_track});
     return;
@@ -158,9 +173,10 @@ auto Decoder::prepareDecode(std::shared_ptr<TaggedStream> stream) -> void {
   track_ = std::make_shared<TrackInfo>(TrackInfo{
       .tags = stream->tags(),
       .uri = stream->Filepath(),
-      .duration = {},
+      .duration = duration,
       .start_offset = stream->Offset(),
-      .bitrate_kbps = {},
+      .bitrate_kbps = props.bitrate_kbps,
+      .replay_gain = stream->ReplayGain(),
       .encoding = stream->type(),
       .format =
           {
@@ -193,7 +209,9 @@ auto Decoder::continueDecode() -> bool {
     return false;
   }
 
+  uint32_t decode_start = tasks::perf::Now();
   auto res = codec_->DecodeTo(codec_buffer_);
+  tasks::perf::RecordSince(tasks::perf::Metric::kDecode, decode_start);
   if (res.has_error()) {
     return false;
   }
@@ -205,7 +223,8 @@ auto Decoder::continueDecode() -> bool {
 
   if (res->is_stream_finished) {
     // The codec has finished, so make sure we don't call it again.
-    codec_.reset();
+    codecs_.Release(codec_);
+    codec_ = nullptr;
   }
 
   // We're done iff the codec has finished and we sent everything.
@@ -226,7 +245,8 @@ auto Decoder::finishDecode(bool cancel) -> void {
   // Clean up after ourselves.
   leftover_samples_ = {};
   stream_.reset();
-  codec_.reset();
+  codecs_.Release(codec_);
+  codec_ = nullptr;
   track_.reset();
 }
 
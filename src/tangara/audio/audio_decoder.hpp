@@ -51,8 +51,13 @@ class Decoder {
   };
   QueueHandle_t next_stream_;
 
+  // Codecs are reused across streams to avoid churning the heap on every
+  // track change. `codec_` is borrowed from this pool, and is null whenever
+  // we aren't actively decoding.
+  codecs::CodecPool codecs_;
+
   std::shared_ptr<codecs::IStream> stream_;
-  std::unique_ptr<codecs::ICodec> codec_;
+  codecs::ICodec* codec_;
   std::shared_ptr<TrackInfo> track_;
 
   std::span<sample::Sample> codec_buffer_;
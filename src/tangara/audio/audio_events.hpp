@@ -50,6 +50,12 @@ struct TrackInfo {
   /* The approximate bitrate of this track in its original encoded form. */
   std::optional<uint32_t> bitrate_kbps;
 
+  /*
+   * Gain to apply to this track for loudness normalisation, in hundredths of
+   * a dB. Missing if there's no loudness information for this track.
+   */
+  std::optional<int16_t> replay_gain;
+
   /* The encoded format of the this track. */
   codecs::StreamType encoding;
 
@@ -142,6 +148,11 @@ struct SetVolumeLimit : tinyfsm::Event {
   int limit_db;
 };
 
+/* Enables or disables loudness normalisation using replay gain. */
+struct SetReplayGain : tinyfsm::Event {
+  bool enabled;
+};
+
 struct OutputModeChanged : tinyfsm::Event {
   std::optional<drivers::NvsStorage::Output> set_to;
 };
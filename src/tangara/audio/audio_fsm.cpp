@@ -10,7 +10,9 @@
 #include <future>
 #include <memory>
 #include <sstream>
+#include <string>
 #include <variant>
+#include <vector>
 
 #include "audio/audio_source.hpp"
 #include "audio/sine_source.hpp"
@@ -66,6 +68,10 @@ std::shared_ptr<BluetoothAudioOutput> AudioState::sBtOutput;
 // keep some PSRAM in our pockets for a rainy day.
 constexpr size_t kTrackDrainLatencySamples = 48000 * 2 * 2;
 
+// How many of the upcoming tracks in the queue to prefetch, so that skipping
+// to them starts quickly.
+static constexpr size_t kPrefetchTracks = 2;
+
 // For system sounds, we intentionally choose codecs that are very fast to
 // decode. This lets us get away with a much smaller drain buffer.
 constexpr size_t kSystemDrainLatencySamples = 48000;
@@ -107,8 +113,10 @@ auto AudioState::emitPlaybackUpdate(bool paused) -> void {
       .paused = paused,
   };
 
-  events::System().Dispatch(event);
-  events::Ui().Dispatch(event);
+  // These are sent often, and each one supersedes the last, so there's no
+  // point making a busy task work through a backlog of stale updates.
+  events::System().DispatchCoalesced(event);
+  events::Ui().DispatchCoalesced(event);
 }
 
 void AudioState::react(const QueueUpdate& ev) {
@@ -123,6 +131,9 @@ void AudioState::react(const QueueUpdate& ev) {
   switch (ev.reason) {
     case QueueUpdate::kExplicitUpdate:
       if (!ev.current_changed) {
+        // What's coming up next may have changed, even if the current track
+        // hasn't.
+        prefetchUpcoming();
         return;
       }
       break;
@@ -180,10 +191,41 @@ void AudioState::react(const SetTrack& ev) {
       if (new_track == queue.current()) {
         queue.finish();
       }
+      return;
     }
+
+    prefetchUpcoming();
   });
 }
 
+auto AudioState::prefetchUpcoming() -> void {
+  // Prefetching is only an optimisation, so it shouldn't get in the way of
+  // anything more urgent.
+  sServices->bg_worker().Post(
+      []() {
+        std::vector<std::string> paths;
+        {
+          auto db = sServices->database().lock();
+          if (!db) {
+            return;
+          }
+          for (const auto& track :
+               sServices->track_queue().upcoming(kPrefetchTracks)) {
+            if (std::holds_alternative<database::TrackId>(track)) {
+              auto path = db->getTrackPath(std::get<database::TrackId>(track));
+              if (path) {
+                paths.push_back(*path);
+              }
+            } else if (std::holds_alternative<std::string>(track)) {
+              paths.push_back(std::get<std::string>(track));
+            }
+          }
+        }
+        sStreamFactory->prefetch(paths);
+      },
+      tasks::WorkPriority::kLow);
+}
+
 void AudioState::react(const PlaySineWave& ev) {
   auto tags = std::make_shared<database::TrackTags>();
 
@@ -374,6 +416,11 @@ void AudioState::react(const SetVolumeBalance& ev) {
   });
 }
 
+void AudioState::react(const SetReplayGain& ev) {
+  sServices->nvs().ReplayGain(ev.enabled);
+  sSampleProcessor->SetReplayGain(ev.enabled);
+}
+
 void AudioState::react(const OutputModeChanged& ev) {
   ESP_LOGI(kTag, "output mode changed");
   auto new_mode = sServices->nvs().OutputMode();
@@ -506,6 +553,7 @@ void Uninitialised::react(const system_fsm::BootComplete& ev) {
 
   sSampleProcessor.reset(new SampleProcessor(sDrainBuffers->first));
   sSampleProcessor->SetOutput(sOutput);
+  sSampleProcessor->SetReplayGain(nvs.ReplayGain());
 
   sDecoder.reset(Decoder::Start(sSampleProcessor));
 
@@ -553,6 +601,7 @@ void Standby::react(const system_fsm::KeyLockChanged& ev) {
 void Standby::react(const system_fsm::SdStateChanged& ev) {
   auto state = sServices->sd();
   if (state != drivers::SdState::kMounted) {
+    sStreamFactory->dropPrefetched();
     return;
   }
   sServices->bg_worker().Dispatch<void>([]() {
@@ -624,6 +673,7 @@ void Playback::exit() {
 
 void Playback::react(const system_fsm::SdStateChanged& ev) {
   if (sServices->sd() != drivers::SdState::kMounted) {
+    sStreamFactory->dropPrefetched();
     transit<Standby>();
   }
 }
@@ -61,6 +61,7 @@ class AudioState : public tinyfsm::Fsm<AudioState> {
   void react(const SetVolume&);
   void react(const SetVolumeLimit&);
   void react(const SetVolumeBalance&);
+  void react(const SetReplayGain&);
 
   void react(const OutputModeChanged&);
 
@@ -78,6 +79,8 @@ class AudioState : public tinyfsm::Fsm<AudioState> {
   auto updateSavedPosition(std::string uri, uint32_t position) -> void;
   auto incrementPlayCount(std::string uri) -> void;
 
+  static auto prefetchUpcoming() -> void;
+
   static std::shared_ptr<system_fsm::ServiceLocator> sServices;
 
   static std::shared_ptr<FatfsStreamFactory> sStreamFactory;
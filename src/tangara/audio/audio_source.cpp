@@ -13,12 +13,14 @@ namespace audio {
 TaggedStream::TaggedStream(std::shared_ptr<database::TrackTags> t,
                            std::unique_ptr<codecs::IStream> w,
                            std::string filepath,
-                           uint32_t offset)
+                           uint32_t offset,
+                           std::optional<int16_t> replay_gain)
     : codecs::IStream(w->type()),
       tags_(t),
       wrapped_(std::move(w)),
       filepath_(filepath),
-      offset_(offset) {}
+      offset_(offset),
+      replay_gain_(replay_gain) {}
 
 auto TaggedStream::tags() -> std::shared_ptr<database::TrackTags> {
   return tags_;
@@ -52,6 +54,10 @@ auto TaggedStream::Filepath() -> std::string {
   return filepath_;
 }
 
+auto TaggedStream::ReplayGain() -> std::optional<int16_t> {
+  return replay_gain_;
+}
+
 auto TaggedStream::SetPreambleFinished() -> void {
   wrapped_->SetPreambleFinished();
 }
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include "codec.hpp"
 #include "database/track.hpp"
 #include "types.hpp"
@@ -18,7 +19,8 @@ class TaggedStream : public codecs::IStream {
   TaggedStream(std::shared_ptr<database::TrackTags>,
                std::unique_ptr<codecs::IStream> wrapped,
                std::string path,
-               uint32_t offset = 0);
+               uint32_t offset = 0,
+               std::optional<int16_t> replay_gain = {});
 
   auto tags() -> std::shared_ptr<database::TrackTags>;
 
@@ -36,6 +38,12 @@ class TaggedStream : public codecs::IStream {
 
   auto Filepath() -> std::string;
 
+  /*
+   * Gain to apply to this stream for loudness normalisation, in hundredths of
+   * a dB.
+   */
+  auto ReplayGain() -> std::optional<int16_t>;
+
   auto SetPreambleFinished() -> void override;
 
  private:
@@ -43,6 +51,7 @@ class TaggedStream : public codecs::IStream {
   std::unique_ptr<codecs::IStream> wrapped_;
   std::string filepath_;
   int32_t offset_;
+  std::optional<int16_t> replay_gain_;
 };
 
 class IAudioSource {
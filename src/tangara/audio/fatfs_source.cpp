@@ -7,8 +7,10 @@
 #include "audio/fatfs_source.hpp"
 #include <sys/_stdint.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 
 #include "esp_log.h"
@@ -26,15 +28,35 @@ namespace audio {
 [[maybe_unused]] static constexpr char kTag[] = "fatfs_src";
 
 FatfsSource::FatfsSource(codecs::StreamType t, std::unique_ptr<FIL> file)
-    : IStream(t), file_(std::move(file)) {}
+    : IStream(t), file_(std::move(file)), head_(), pos_(f_tell(file_.get())) {}
+
+FatfsSource::FatfsSource(codecs::StreamType t,
+                         std::unique_ptr<FIL> file,
+                         std::pmr::vector<std::byte> head)
+    : IStream(t), file_(std::move(file)), head_(std::move(head)), pos_(0) {}
 
 FatfsSource::~FatfsSource() {
   f_close(file_.get());
 }
 
 auto FatfsSource::Read(std::span<std::byte> dest) -> ssize_t {
+  size_t from_head = 0;
+  if (pos_ < head_.size()) {
+    from_head = std::min<size_t>(dest.size(), head_.size() - pos_);
+    std::memcpy(dest.data(), head_.data() + pos_, from_head);
+    pos_ += from_head;
+    dest = dest.subspan(from_head);
+    if (dest.empty()) {
+      return from_head;
+    }
+  }
+
+  // Reads from the head don't move the file, so catch it up if needed.
+  if (f_tell(file_.get()) != pos_) {
+    f_lseek(file_.get(), pos_);
+  }
   if (f_eof(file_.get())) {
-    return 0;
+    return from_head;
   }
   UINT bytes_read = 0;
   FRESULT res = f_read(file_.get(), dest.data(), dest.size(), &bytes_read);
@@ -42,7 +64,8 @@ auto FatfsSource::Read(std::span<std::byte> dest) -> ssize_t {
     events::System().Dispatch(system_fsm::StorageError{.error = res});
     return -1;
   }
-  return bytes_read;
+  pos_ += bytes_read;
+  return from_head + bytes_read;
 }
 
 auto FatfsSource::CanSeek() -> bool {
@@ -52,19 +75,22 @@ auto FatfsSource::CanSeek() -> bool {
 auto FatfsSource::SeekTo(int64_t destination, SeekFrom from) -> void {
   switch (from) {
     case SeekFrom::kStartOfStream:
-      f_lseek(file_.get(), destination);
+      pos_ = destination;
       break;
     case SeekFrom::kEndOfStream:
-      f_lseek(file_.get(), f_size(file_.get()) + destination);
+      pos_ = f_size(file_.get()) + destination;
       break;
     case SeekFrom::kCurrentPosition:
-      f_lseek(file_.get(), f_tell(file_.get()) + destination);
+      pos_ += destination;
       break;
   }
+  if (pos_ >= head_.size()) {
+    f_lseek(file_.get(), pos_);
+  }
 }
 
 auto FatfsSource::CurrentPosition() -> int64_t {
-  return f_tell(file_.get());
+  return pos_;
 }
 
 auto FatfsSource::Size() -> std::optional<int64_t> {
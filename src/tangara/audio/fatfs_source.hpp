@@ -9,6 +9,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <memory_resource>
+#include <vector>
 
 #include "codec.hpp"
 #include "ff.h"
@@ -24,6 +26,15 @@ namespace audio {
 class FatfsSource : public codecs::IStream {
  public:
   FatfsSource(codecs::StreamType, std::unique_ptr<FIL> file);
+
+  /*
+   * Creates a source for a file whose first bytes have already been read into
+   * `head`. Reads within the head are served from memory; the file's position
+   * must be just after them.
+   */
+  FatfsSource(codecs::StreamType,
+              std::unique_ptr<FIL> file,
+              std::pmr::vector<std::byte> head);
   ~FatfsSource();
 
   auto Read(std::span<std::byte> dest) -> ssize_t override;
@@ -41,6 +52,8 @@ class FatfsSource : public codecs::IStream {
 
  private:
   std::unique_ptr<FIL> file_;
+  std::pmr::vector<std::byte> head_;
+  FSIZE_t pos_;
 };
 
 }  // namespace audio
@@ -6,8 +6,11 @@
 
 #include "audio/fatfs_stream_factory.hpp"
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <string>
 
 #include "esp_log.h"
@@ -17,11 +20,13 @@
 
 #include "audio/audio_source.hpp"
 #include "audio/fatfs_source.hpp"
+#include "audio/himem_cache.hpp"
 #include "codec.hpp"
 #include "database/database.hpp"
 #include "database/tag_parser.hpp"
 #include "database/track.hpp"
 #include "drivers/spi.hpp"
+#include "memory_resource.hpp"
 #include "tasks.hpp"
 #include "types.hpp"
 
@@ -29,9 +34,17 @@
 
 namespace audio {
 
+// How many prefetched tracks to keep at once.
+static constexpr size_t kMaxPrefetched = 2;
+
+// How much of the start of each prefetched track to read into memory. This is
+// enough to cover the headers of every format we support, plus a second or so
+// of audio at typical bitrates.
+static constexpr size_t kPrefetchBytes = 64 * 1024;
+
 FatfsStreamFactory::FatfsStreamFactory(database::Handle&& handle,
                                        database::ITagParser& parser)
-    : db_(handle), tag_parser_(parser) {}
+    : db_(handle), tag_parser_(parser), cache_(), generation_(0) {}
 
 auto FatfsStreamFactory::create(database::TrackId id, uint32_t offset)
     -> std::shared_ptr<TaggedStream> {
@@ -39,20 +52,35 @@ auto FatfsStreamFactory::create(database::TrackId id, uint32_t offset)
   if (!db) {
     return {};
   }
-  auto path = db->getTrackPath(id);
-  if (!path) {
+  auto track = db->getTrack(id);
+  if (!track) {
     return {};
   }
-  return create(*path, offset);
+  // The database's gain may have come from analysing the track, so prefer it
+  // over whatever is in the track's tags.
+  const auto& data = track->data();
+  return createStream({data.filepath.data(), data.filepath.size()}, offset,
+                      data.replay_gain);
 }
 
 auto FatfsStreamFactory::create(std::string path, uint32_t offset)
     -> std::shared_ptr<TaggedStream> {
+  return createStream(path, offset, {});
+}
+
+auto FatfsStreamFactory::createStream(std::string path,
+                                      uint32_t offset,
+                                      std::optional<int16_t> replay_gain)
+    -> std::shared_ptr<TaggedStream> {
   auto tags = tag_parser_.ReadAndParseTags(path);
   if (!tags) {
     return {};
   }
 
+  if (!replay_gain) {
+    replay_gain = tags->preferredGain();
+  }
+
   if (!tags->title()) {
     tags->title(path);
   }
@@ -63,16 +91,133 @@ auto FatfsStreamFactory::create(std::string path, uint32_t offset)
     return {};
   }
 
+  std::unique_ptr<codecs::IStream> source;
+  if (auto cached = cache_.open(path)) {
+    source = std::make_unique<HimemSource>(stream_type.value(), cache_,
+                                           std::move(cached));
+  } else {
+    source = takePrefetched(path);
+  }
+  if (!source) {
+    std::unique_ptr<FIL> file = std::make_unique<FIL>();
+    FRESULT res = f_open(file.get(), path.c_str(), FA_READ);
+    if (res != FR_OK) {
+      ESP_LOGE(kTag, "failed to open file! res: %i", res);
+      return {};
+    }
+    source = std::make_unique<FatfsSource>(stream_type.value(), std::move(file));
+  }
+
+  return std::make_shared<TaggedStream>(tags, std::move(source), path, offset,
+                                        replay_gain);
+}
+
+auto FatfsStreamFactory::prefetch(std::span<const std::string> paths)
+    -> void {
+  for (size_t i = 0; i < paths.size(); i++) {
+    prefetchOne(paths[i], paths.first(i));
+  }
+}
+
+auto FatfsStreamFactory::prefetchOne(const std::string& path,
+                                     std::span<const std::string> sooner)
+    -> void {
+  if (cache_.open(path)) {
+    return;
+  }
+  uint32_t generation;
+  {
+    std::lock_guard<std::mutex> lock{prefetch_mutex_};
+    for (const auto& p : prefetched_) {
+      if (p.path == path) {
+        return;
+      }
+    }
+    generation = generation_;
+  }
+
+  // Parsing the tags also leaves them in the tag parser's cache, ready for
+  // when the stream is created.
+  auto tags = tag_parser_.ReadAndParseTags(path);
+  if (!tags) {
+    return;
+  }
+  auto stream_type = ContainerToStreamType(tags->encoding());
+  if (!stream_type.has_value()) {
+    return;
+  }
+
   std::unique_ptr<FIL> file = std::make_unique<FIL>();
-  FRESULT res = f_open(file.get(), path.c_str(), FA_READ);
-  if (res != FR_OK) {
-    ESP_LOGE(kTag, "failed to open file! res: %i", res);
-    return {};
+  if (f_open(file.get(), path.c_str(), FA_READ) != FR_OK) {
+    return;
+  }
+
+  // Prefer caching the whole track, so that playing it doesn't need the card
+  // at all.
+  if (f_size(file.get()) <= cache_.capacity()) {
+    {
+      std::lock_guard<std::mutex> lock{prefetch_mutex_};
+      if (generation != generation_) {
+        f_close(file.get());
+        return;
+      }
+    }
+    // If the card is unmounted during the fill, then dropPrefetched() clearing
+    // the cache makes the fill discard what it read.
+    bool cached = cache_.fill(path, *file, sooner);
+    if (cached || f_lseek(file.get(), 0) != FR_OK) {
+      f_close(file.get());
+      return;
+    }
+  }
+
+  std::pmr::vector<std::byte> head{&memory::kAudioResource};
+  head.resize(std::min<FSIZE_t>(kPrefetchBytes, f_size(file.get())));
+  UINT bytes_read = 0;
+  if (f_read(file.get(), head.data(), head.size(), &bytes_read) != FR_OK ||
+      bytes_read != head.size()) {
+    f_close(file.get());
+    return;
+  }
+
+  auto source = std::make_unique<FatfsSource>(*stream_type, std::move(file),
+                                              std::move(head));
+
+  std::lock_guard<std::mutex> lock{prefetch_mutex_};
+  // The card may have been unmounted whilst we were reading from it, in which
+  // case this file is no longer usable.
+  if (generation != generation_) {
+    return;
+  }
+  prefetched_.push_front({
+      .path = path,
+      .source = std::move(source),
+  });
+  if (prefetched_.size() > kMaxPrefetched) {
+    prefetched_.pop_back();
   }
+}
 
-  return std::make_shared<TaggedStream>(
-      tags, std::make_unique<FatfsSource>(stream_type.value(), std::move(file)),
-      path, offset);
+auto FatfsStreamFactory::dropPrefetched() -> void {
+  {
+    std::lock_guard<std::mutex> lock{prefetch_mutex_};
+    generation_++;
+    prefetched_.clear();
+  }
+  cache_.clear();
+}
+
+auto FatfsStreamFactory::takePrefetched(const std::string& path)
+    -> std::unique_ptr<FatfsSource> {
+  std::lock_guard<std::mutex> lock{prefetch_mutex_};
+  for (auto it = prefetched_.begin(); it != prefetched_.end(); it++) {
+    if (it->path == path) {
+      auto source = std::move(it->source);
+      prefetched_.erase(it);
+      return source;
+    }
+  }
+  return {};
 }
 
 auto FatfsStreamFactory::ContainerToStreamType(database::Container enc)
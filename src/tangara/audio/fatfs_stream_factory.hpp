@@ -8,14 +8,19 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <future>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
 
 #include "ff.h"
 #include "freertos/portmacro.h"
 
 #include "audio/audio_source.hpp"
+#include "audio/fatfs_source.hpp"
+#include "audio/himem_cache.hpp"
 #include "codec.hpp"
 #include "database/database.hpp"
 #include "database/future_fetcher.hpp"
@@ -38,15 +43,57 @@ class FatfsStreamFactory {
   auto create(std::string, uint32_t offset = 0)
       -> std::shared_ptr<TaggedStream>;
 
+  /*
+   * Does as much of the work of creating a stream for each of the given
+   * tracks as possible ahead of time: their tags are parsed into the tag
+   * cache, and each whole file is read into the himem cache if it fits.
+   * Otherwise, the file is opened with the first part of it read into memory,
+   * and only the most recently prefetched few of these are kept. A later call
+   * to `create` for the same track then starts without touching the SD card.
+   *
+   * Tracks should be given in the order they'll be played. Caching a track
+   * never evicts one that will play before it.
+   */
+  auto prefetch(std::span<const std::string> paths) -> void;
+
+  /*
+   * Closes all prefetched files, and evicts all cached tracks. Must be called
+   * if the SD card is unmounted.
+   */
+  auto dropPrefetched() -> void;
+
   FatfsStreamFactory(const FatfsStreamFactory&) = delete;
   FatfsStreamFactory& operator=(const FatfsStreamFactory&) = delete;
 
  private:
+  auto createStream(std::string path,
+                    uint32_t offset,
+                    std::optional<int16_t> replay_gain)
+      -> std::shared_ptr<TaggedStream>;
+
   auto ContainerToStreamType(database::Container)
       -> std::optional<codecs::StreamType>;
 
+  auto prefetchOne(const std::string& path, std::span<const std::string> sooner)
+      -> void;
+  auto takePrefetched(const std::string& path) -> std::unique_ptr<FatfsSource>;
+
   database::Handle db_;
   database::ITagParser& tag_parser_;
+
+  HimemCache cache_;
+
+  struct Prefetched {
+    std::string path;
+    std::unique_ptr<FatfsSource> source;
+  };
+
+  std::mutex prefetch_mutex_;
+  // Most recently prefetched first.
+  std::deque<Prefetched> prefetched_;
+  // Incremented by each call to dropPrefetched, so that prefetches that were
+  // already underway know to throw away their results.
+  uint32_t generation_;
 };
 
 }  // namespace audio
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "audio/himem_cache.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+#include "esp_log.h"
+#include "ff.h"
+
+#include "codec.hpp"
+#include "himem.hpp"
+#include "memory_resource.hpp"
+
+namespace audio {
+
+[[maybe_unused]] static constexpr char kTag[] = "himem_cache";
+
+HimemCache::Entry::Entry(HimemCache& cache, std::string p, FSIZE_t s)
+    : path(p), size(s), cache_(cache), blocks_() {}
+
+HimemCache::Entry::~Entry() {
+  cache_.release(blocks_);
+}
+
+HimemCache::HimemCache()
+    : blocks_(),
+      fill_window_(),
+      read_window_(),
+      free_(),
+      entries_(),
+      num_clears_(0) {
+  if (!fill_window_.region.is_valid || !read_window_.region.is_valid) {
+    ESP_LOGW(kTag, "no himem windows available; cache disabled");
+    return;
+  }
+  while (blocks_.size() < kMaxBlocks) {
+    auto block = std::make_unique<HimemAlloc<kBlockSize>>();
+    if (!block->is_valid) {
+      break;
+    }
+    blocks_.push_back(std::move(block));
+  }
+  for (size_t i = blocks_.size(); i > 0; i--) {
+    free_.push_back(i - 1);
+  }
+  ESP_LOGI(kTag, "caching up to %u KiB of upcoming tracks",
+           capacity() / 1024);
+}
+
+auto HimemCache::capacity() const -> size_t {
+  return blocks_.size() * kBlockSize;
+}
+
+auto HimemCache::open(const std::string& path)
+    -> std::shared_ptr<const Entry> {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return findLocked(path);
+}
+
+auto HimemCache::fill(const std::string& path,
+                      FIL& file,
+                      std::span<const std::string> keep) -> bool {
+  FSIZE_t size = f_size(&file);
+  size_t num_blocks = (size + kBlockSize - 1) / kBlockSize;
+  if (num_blocks == 0 || num_blocks > blocks_.size()) {
+    return false;
+  }
+
+  // Entries must always be dropped without holding the lock, since destroying
+  // the last reference to one returns its blocks.
+  auto entry = std::make_shared<Entry>(*this, path, size);
+  std::list<std::shared_ptr<const Entry>> evicted;
+  uint32_t clears;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (findLocked(path)) {
+      return true;
+    }
+    clears = num_clears_;
+    // Pick which tracks to evict before evicting any of them, so that we
+    // don't throw away tracks for nothing if there's no room to be made.
+    std::vector<decltype(entries_)::iterator> victims;
+    size_t freeable = free_.size();
+    for (auto it = entries_.end();
+         freeable < num_blocks && it != entries_.begin();) {
+      it--;
+      if (std::find(keep.begin(), keep.end(), (*it)->path) != keep.end()) {
+        continue;
+      }
+      freeable += (*it)->blocks_.size();
+      victims.push_back(it);
+    }
+    if (freeable < num_blocks) {
+      return false;
+    }
+    for (auto it : victims) {
+      evicted.splice(evicted.begin(), entries_, it);
+    }
+  }
+  evicted.clear();
+
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    // Evicted tracks that are still being read haven't given their blocks
+    // back yet.
+    if (free_.size() < num_blocks) {
+      return false;
+    }
+    entry->blocks_.assign(free_.end() - num_blocks, free_.end());
+    free_.resize(free_.size() - num_blocks);
+  }
+
+  // Read from the card without holding the lock, so that any tracks that are
+  // currently playing from the cache aren't held up.
+  std::pmr::vector<std::byte> buf(kBlockSize, &memory::kAudioResource);
+  for (size_t i = 0; i < num_blocks; i++) {
+    UINT to_read = std::min<FSIZE_t>(kBlockSize, size - i * kBlockSize);
+    UINT bytes_read = 0;
+    if (f_read(&file, buf.data(), to_read, &bytes_read) != FR_OK ||
+        bytes_read != to_read) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock{mutex_};
+    std::memcpy(mapLocked(fill_window_, entry->blocks_[i]).data(), buf.data(),
+                to_read);
+  }
+
+  std::lock_guard<std::mutex> lock{mutex_};
+  // If the cache was cleared whilst we were reading, then the file may be from
+  // a card that's since been removed.
+  if (clears != num_clears_) {
+    return false;
+  }
+  entries_.push_front(std::move(entry));
+  return true;
+}
+
+auto HimemCache::read(const Entry& entry,
+                      FSIZE_t offset,
+                      std::span<std::byte> dest) -> size_t {
+  std::lock_guard<std::mutex> lock{mutex_};
+  size_t bytes_read = 0;
+  while (!dest.empty() && offset < entry.size) {
+    size_t block = offset / kBlockSize;
+    size_t within = offset % kBlockSize;
+    size_t len = std::min<FSIZE_t>(
+        {dest.size(), kBlockSize - within, entry.size - offset});
+    auto window = mapLocked(read_window_, entry.blocks_[block]);
+    std::memcpy(dest.data(), window.data() + within, len);
+    dest = dest.subspan(len);
+    offset += len;
+    bytes_read += len;
+  }
+  return bytes_read;
+}
+
+auto HimemCache::clear() -> void {
+  std::list<std::shared_ptr<const Entry>> dropped;
+  std::lock_guard<std::mutex> lock{mutex_};
+  num_clears_++;
+  dropped.swap(entries_);
+}
+
+auto HimemCache::findLocked(const std::string& path)
+    -> std::shared_ptr<const Entry> {
+  for (auto it = entries_.begin(); it != entries_.end(); it++) {
+    if ((*it)->path == path) {
+      entries_.splice(entries_.begin(), entries_, it);
+      return entries_.front();
+    }
+  }
+  return {};
+}
+
+auto HimemCache::mapLocked(Window& window, uint16_t block)
+    -> std::span<std::byte> {
+  if (window.mapped != block) {
+    // A block may only be mapped into one window at a time. The other window
+    // may still have it if it was the last block of a track that was just
+    // cached, or if the block was freed and then reused.
+    Window& other = &window == &fill_window_ ? read_window_ : fill_window_;
+    if (other.mapped == block) {
+      other.region.Unmap();
+      other.mapped.reset();
+    }
+    window.region.Unmap();
+    window.region.Map(*blocks_[block]);
+    window.mapped = block;
+  }
+  return window.region.Get();
+}
+
+auto HimemCache::release(std::vector<uint16_t>& blocks) -> void {
+  std::lock_guard<std::mutex> lock{mutex_};
+  free_.insert(free_.end(), blocks.begin(), blocks.end());
+  blocks.clear();
+}
+
+HimemSource::HimemSource(codecs::StreamType t,
+                         HimemCache& cache,
+                         std::shared_ptr<const HimemCache::Entry> entry)
+    : IStream(t), cache_(cache), entry_(entry), pos_(0) {}
+
+auto HimemSource::Read(std::span<std::byte> dest) -> ssize_t {
+  size_t bytes_read = cache_.read(*entry_, pos_, dest);
+  pos_ += bytes_read;
+  return bytes_read;
+}
+
+auto HimemSource::CanSeek() -> bool {
+  return true;
+}
+
+auto HimemSource::SeekTo(int64_t destination, SeekFrom from) -> void {
+  switch (from) {
+    case SeekFrom::kStartOfStream:
+      pos_ = destination;
+      break;
+    case SeekFrom::kEndOfStream:
+      pos_ = entry_->size + destination;
+      break;
+    case SeekFrom::kCurrentPosition:
+      pos_ += destination;
+      break;
+  }
+}
+
+auto HimemSource::CurrentPosition() -> int64_t {
+  return pos_;
+}
+
+auto HimemSource::Size() -> std::optional<int64_t> {
+  return entry_->size;
+}
+
+}  // namespace audio
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "esp32/himem.h"
+#include "ff.h"
+
+#include "codec.hpp"
+#include "himem.hpp"
+
+namespace audio {
+
+/*
+ * Holds the entire contents of a few upcoming tracks in himem; the part of
+ * PSRAM that is beyond what the ESP32 can address directly, and that is
+ * otherwise unused. Tracks are stored as lists of fixed-size blocks, which are
+ * bank-switched into small windows of the address space as they're accessed.
+ * Filling the cache and reading from it each have their own window, so that
+ * playback doesn't need to remap on every read whilst a track is being
+ * cached.
+ *
+ * Once a track is cached, playing it never touches the SD card, so playback
+ * of cached tracks can continue whilst the card is idle, and transitions into
+ * them never wait on storage.
+ *
+ * If himem isn't available (e.g. bank switching is disabled, or the PSRAM is
+ * too small), the cache has no capacity and fill() always fails.
+ */
+class HimemCache {
+ public:
+  static constexpr size_t kBlockSize = ESP_HIMEM_BLKSZ;
+  // Upper bound on the cache's size, of 4 MiB. This is all of the himem on a
+  // device with 8 MiB of PSRAM.
+  static constexpr size_t kMaxBlocks = 128;
+
+  /* A complete track within the cache. */
+  class Entry {
+   public:
+    Entry(HimemCache&, std::string path, FSIZE_t size);
+    ~Entry();
+
+    const std::string path;
+    const FSIZE_t size;
+
+   private:
+    friend class HimemCache;
+    HimemCache& cache_;
+    std::vector<uint16_t> blocks_;
+  };
+
+  HimemCache();
+
+  /* The size of the largest file that can be cached, in bytes. */
+  auto capacity() const -> size_t;
+
+  /*
+   * Returns the cached contents of the given file, or null if it isn't cached.
+   * Entries remain readable for as long as they're held, even if they're later
+   * evicted.
+   */
+  auto open(const std::string& path) -> std::shared_ptr<const Entry>;
+
+  /*
+   * Reads the entirety of the given file into the cache, evicting the least
+   * recently used tracks to make room. Tracks in `keep` are never evicted; if
+   * there isn't room without them, then the file isn't cached. The file is
+   * read from its current position, which must be the start of the file.
+   * Returns whether the file is now cached.
+   */
+  auto fill(const std::string& path,
+            FIL& file,
+            std::span<const std::string> keep = {}) -> bool;
+
+  /*
+   * Copies bytes from a cached track into `dest`, starting from `offset`.
+   * Returns the number of bytes copied, which is only less than the size of
+   * `dest` at the end of the track.
+   */
+  auto read(const Entry&, FSIZE_t offset, std::span<std::byte> dest) -> size_t;
+
+  /*
+   * Evicts every track that isn't currently being read. Any fills that are in
+   * progress are also discarded once they finish.
+   */
+  auto clear() -> void;
+
+  HimemCache(const HimemCache&) = delete;
+  HimemCache& operator=(const HimemCache&) = delete;
+
+ private:
+  struct Window {
+    MappableRegion<kBlockSize> region;
+    // The block currently mapped into the region, if any.
+    std::optional<uint16_t> mapped;
+  };
+
+  auto findLocked(const std::string& path) -> std::shared_ptr<const Entry>;
+  auto mapLocked(Window&, uint16_t block) -> std::span<std::byte>;
+  auto release(std::vector<uint16_t>& blocks) -> void;
+
+  std::vector<std::unique_ptr<HimemAlloc<kBlockSize>>> blocks_;
+  Window fill_window_;
+  Window read_window_;
+
+  std::mutex mutex_;
+  std::vector<uint16_t> free_;
+  // Complete tracks, most recently used first.
+  std::list<std::shared_ptr<const Entry>> entries_;
+  // Incremented by each clear(), so that fills can tell if they raced one.
+  uint32_t num_clears_;
+};
+
+/* A stream that reads from a track held within a HimemCache. */
+class HimemSource : public codecs::IStream {
+ public:
+  HimemSource(codecs::StreamType,
+              HimemCache&,
+              std::shared_ptr<const HimemCache::Entry>);
+
+  auto Read(std::span<std::byte> dest) -> ssize_t override;
+
+  auto CanSeek() -> bool override;
+
+  auto SeekTo(int64_t destination, SeekFrom from) -> void override;
+
+  auto CurrentPosition() -> int64_t override;
+
+  auto Size() -> std::optional<int64_t> override;
+
+  HimemSource(const HimemSource&) = delete;
+  HimemSource& operator=(const HimemSource&) = delete;
+
+ private:
+  HimemCache& cache_;
+  std::shared_ptr<const HimemCache::Entry> entry_;
+  FSIZE_t pos_;
+};
+
+}  // namespace audio
@@ -0,0 +1,322 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "audio/loudness.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "audio/audio_source.hpp"
+#include "audio/fatfs_stream_factory.hpp"
+#include "codec.hpp"
+#include "database/database.hpp"
+#include "database/track.hpp"
+#include "memory_resource.hpp"
+#include "sample.hpp"
+#include "tasks.hpp"
+
+[[maybe_unused]] static const char* kTag = "loudness";
+
+namespace audio {
+
+/* Blocks quieter than this are ignored entirely. */
+static constexpr float kAbsoluteGateLufs = -70.0f;
+/* Blocks this much quieter than the ungated average are ignored. */
+static constexpr float kRelativeGateLu = -10.0f;
+
+/* The target loudness of ReplayGain 2.0. */
+static constexpr float kReferenceLufs = -18.0f;
+
+/*
+ * Block loudnesses are bucketed into a histogram with this resolution, from
+ * the absolute gate up to kHistogramMaxLufs. This is precise enough that the
+ * error from using bucket centres is well below anything audible.
+ */
+static constexpr float kHistogramStepLu = 0.1f;
+static constexpr float kHistogramMaxLufs = 5.0f;
+static constexpr size_t kHistogramBins =
+    (kHistogramMaxLufs - kAbsoluteGateLufs) / kHistogramStepLu;
+
+/* Size of the buffer that tracks are decoded into for analysis. */
+static constexpr size_t kDecodeBufferSamples = 4096;
+
+static auto energyToLufs(float energy) -> float {
+  return -0.691f + 10.0f * std::log10(energy);
+}
+
+static auto lufsToEnergy(float lufs) -> float {
+  return std::pow(10.0f, (lufs + 0.691f) / 10.0f);
+}
+
+static auto binLufs(size_t bin) -> float {
+  return kAbsoluteGateLufs + (bin + 0.5f) * kHistogramStepLu;
+}
+
+LoudnessMeter::LoudnessMeter(uint32_t sample_rate, uint8_t num_channels)
+    : num_channels_(num_channels),
+      frames_per_sub_block_(sample_rate / 10),
+      states_(new FilterState[num_channels * 2]()),
+      channel_(0),
+      frames_in_sub_block_(0),
+      sub_block_energy_(0),
+      sub_blocks_(),
+      sub_blocks_seen_(0),
+      histogram_(reinterpret_cast<uint32_t*>(
+          heap_caps_calloc(kHistogramBins,
+                           sizeof(uint32_t),
+                           MALLOC_CAP_SPIRAM))) {
+  // K-weighting filter coefficients, derived for the stream's sample rate as
+  // per the analog prototypes given in BS.1770.
+  double rate = sample_rate;
+
+  double f0 = 1681.974450955533;
+  double gain_db = 3.999843853973347;
+  double q = 0.7071752369554196;
+  double k = std::tan(M_PI * f0 / rate);
+  double vh = std::pow(10.0, gain_db / 20.0);
+  double vb = std::pow(vh, 0.4996667741545416);
+  double a0 = 1.0 + k / q + k * k;
+  shelf_ = {
+      .b0 = static_cast<float>((vh + vb * k / q + k * k) / a0),
+      .b1 = static_cast<float>(2.0 * (k * k - vh) / a0),
+      .b2 = static_cast<float>((vh - vb * k / q + k * k) / a0),
+      .a1 = static_cast<float>(2.0 * (k * k - 1.0) / a0),
+      .a2 = static_cast<float>((1.0 - k / q + k * k) / a0),
+  };
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = std::tan(M_PI * f0 / rate);
+  a0 = 1.0 + k / q + k * k;
+  highpass_ = {
+      .b0 = 1.0f,
+      .b1 = -2.0f,
+      .b2 = 1.0f,
+      .a1 = static_cast<float>(2.0 * (k * k - 1.0) / a0),
+      .a2 = static_cast<float>((1.0 - k / q + k * k) / a0),
+  };
+}
+
+LoudnessMeter::~LoudnessMeter() {
+  heap_caps_free(histogram_);
+}
+
+auto LoudnessMeter::filter(const Biquad& f, FilterState& s, float in)
+    -> float {
+  // Transposed direct form II.
+  float out = f.b0 * in + s.z1;
+  s.z1 = f.b1 * in - f.a1 * out + s.z2;
+  s.z2 = f.b2 * in - f.a2 * out;
+  return out;
+}
+
+auto LoudnessMeter::add(std::span<const sample::Sample> samples) -> void {
+  if (!histogram_ || frames_per_sub_block_ == 0) {
+    return;
+  }
+  for (const auto& s : samples) {
+    FilterState* state = &states_[channel_ * 2];
+    float weighted = filter(highpass_, state[1],
+                            filter(shelf_, state[0], sample::ToFloat(s)));
+    sub_block_energy_ += weighted * weighted;
+
+    if (++channel_ < num_channels_) {
+      continue;
+    }
+    channel_ = 0;
+    if (++frames_in_sub_block_ == frames_per_sub_block_) {
+      finishSubBlock();
+    }
+  }
+}
+
+auto LoudnessMeter::finishSubBlock() -> void {
+  float energy = sub_block_energy_ / frames_per_sub_block_;
+  // Mono streams are played back through both channels, so weight them as if
+  // they were dual mono.
+  if (num_channels_ == 1) {
+    energy *= 2;
+  }
+  sub_blocks_[sub_blocks_seen_ % sub_blocks_.size()] = energy;
+  sub_blocks_seen_++;
+
+  sub_block_energy_ = 0;
+  frames_in_sub_block_ = 0;
+
+  if (sub_blocks_seen_ < sub_blocks_.size()) {
+    return;
+  }
+
+  float block_energy = 0;
+  for (const auto& e : sub_blocks_) {
+    block_energy += e;
+  }
+  block_energy /= sub_blocks_.size();
+
+  float lufs = energyToLufs(block_energy);
+  if (!(lufs >= kAbsoluteGateLufs)) {
+    return;
+  }
+  size_t bin = (lufs - kAbsoluteGateLufs) / kHistogramStepLu;
+  histogram_[std::min(bin, kHistogramBins - 1)]++;
+}
+
+auto LoudnessMeter::integratedLoudness() const -> std::optional<float> {
+  if (!histogram_) {
+    return {};
+  }
+
+  // First pass: the average of every block above the absolute gate gives us
+  // the relative gate.
+  uint64_t num_blocks = 0;
+  double total_energy = 0;
+  for (size_t i = 0; i < kHistogramBins; i++) {
+    num_blocks += histogram_[i];
+    total_energy += histogram_[i] * lufsToEnergy(binLufs(i));
+  }
+  if (num_blocks == 0) {
+    return {};
+  }
+  float relative_gate =
+      energyToLufs(total_energy / num_blocks) + kRelativeGateLu;
+
+  // Second pass: the average of every block above both gates.
+  num_blocks = 0;
+  total_energy = 0;
+  for (size_t i = 0; i < kHistogramBins; i++) {
+    if (binLufs(i) < relative_gate) {
+      continue;
+    }
+    num_blocks += histogram_[i];
+    total_energy += histogram_[i] * lufsToEnergy(binLufs(i));
+  }
+  if (num_blocks == 0) {
+    return {};
+  }
+  return energyToLufs(total_energy / num_blocks);
+}
+
+auto LoudnessMeter::replayGain() const -> std::optional<int16_t> {
+  auto lufs = integratedLoudness();
+  if (!lufs) {
+    return {};
+  }
+  long gain = std::lround((kReferenceLufs - *lufs) * 100);
+  return static_cast<int16_t>(std::clamp<long>(gain, INT16_MIN, INT16_MAX));
+}
+
+LoudnessScanner::LoudnessScanner(database::Handle db,
+                                 database::ITagParser& parser,
+                                 tasks::WorkerPool& worker)
+    : db_(db),
+      streams_(database::Handle{db}, parser),
+      worker_(worker),
+      is_running_(false),
+      stop_requested_(false) {}
+
+auto LoudnessScanner::start() -> void {
+  stop_requested_ = false;
+  if (is_running_.exchange(true)) {
+    return;
+  }
+  ESP_LOGI(kTag, "starting loudness analysis");
+  worker_.Post([this]() { scanNext(0); }, tasks::WorkPriority::kLow);
+}
+
+auto LoudnessScanner::stop() -> void {
+  stop_requested_ = true;
+}
+
+auto LoudnessScanner::isRunning() -> bool {
+  return is_running_;
+}
+
+auto LoudnessScanner::scanNext(database::TrackId after) -> void {
+  auto db = db_.lock();
+  if (!db || stop_requested_ || db->isUpdating()) {
+    is_running_ = false;
+    return;
+  }
+
+  auto track = db->nextTrackNeedingAnalysis(after);
+  if (!track) {
+    ESP_LOGI(kTag, "loudness analysis finished");
+    is_running_ = false;
+    return;
+  }
+
+  auto gain = analyse(*track);
+  if (stop_requested_) {
+    // Don't record anything for this track, since we didn't finish it.
+    is_running_ = false;
+    return;
+  }
+
+  // Analysis can take a while, so re-fetch the track's data in case it has
+  // changed in the meantime.
+  auto latest = db->nextTrackNeedingAnalysis(after);
+  if (latest && latest->id == track->id) {
+    if (gain) {
+      ESP_LOGI(kTag, "#%lx gain is %.2fdB", track->id, *gain / 100.0f);
+    } else {
+      ESP_LOGW(kTag, "#%lx could not be analysed", track->id);
+    }
+    latest->replay_gain = gain;
+    latest->is_loudness_analysed = true;
+    db->setTrackData(latest->id, *latest);
+  }
+
+  // Analyse the next track as a separate job, so that we don't starve any
+  // other work waiting on the background workers.
+  database::TrackId id = track->id;
+  worker_.Post([=, this]() { scanNext(id); }, tasks::WorkPriority::kLow);
+}
+
+auto LoudnessScanner::analyse(const database::TrackData& data)
+    -> std::optional<int16_t> {
+  auto stream =
+      streams_.create(std::string{data.filepath.data(), data.filepath.size()});
+  if (!stream) {
+    return {};
+  }
+
+  auto codec = codecs_.Acquire(stream->type());
+  if (!codec) {
+    return {};
+  }
+
+  std::optional<int16_t> res;
+  auto format = (*codec)->OpenStream(stream, 0);
+  if (format.has_value()) {
+    LoudnessMeter meter{format->sample_rate_hz, format->num_channels};
+    std::pmr::vector<sample::Sample> buffer(kDecodeBufferSamples,
+                                            &memory::kAudioResource);
+    while (!stop_requested_) {
+      auto decoded = (*codec)->DecodeTo(buffer);
+      if (decoded.has_error()) {
+        break;
+      }
+      meter.add(std::span{buffer}.first(decoded->samples_written));
+      if (decoded->is_stream_finished) {
+        res = meter.replayGain();
+        break;
+      }
+    }
+  }
+
+  codecs_.Release(*codec);
+  return res;
+}
+
+}  // namespace audio
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+
+#include "audio/fatfs_stream_factory.hpp"
+#include "codec.hpp"
+#include "database/database.hpp"
+#include "database/tag_parser.hpp"
+#include "database/track.hpp"
+#include "sample.hpp"
+#include "tasks.hpp"
+
+namespace audio {
+
+/*
+ * Measures the integrated loudness of a stream of PCM samples, following
+ * ITU-R BS.1770 / EBU R128: K-weighting, 400ms blocks with 75% overlap, and
+ * absolute plus relative gating.
+ *
+ * Gating is done with a histogram of block loudnesses rather than by keeping
+ * every block, so memory use is constant regardless of the stream's length.
+ */
+class LoudnessMeter {
+ public:
+  LoudnessMeter(uint32_t sample_rate, uint8_t num_channels);
+  ~LoudnessMeter();
+
+  /* Adds a span of interleaved samples to the measurement. */
+  auto add(std::span<const sample::Sample>) -> void;
+
+  /*
+   * Returns the integrated loudness in LUFS of all samples added so far, or
+   * nothing if there hasn't been enough (non-silent) audio to measure.
+   */
+  auto integratedLoudness() const -> std::optional<float>;
+
+  /*
+   * Returns the replay gain for the samples added so far, in hundredths of a
+   * dB relative to -18 LUFS.
+   */
+  auto replayGain() const -> std::optional<int16_t>;
+
+  LoudnessMeter(const LoudnessMeter&) = delete;
+  LoudnessMeter& operator=(const LoudnessMeter&) = delete;
+
+ private:
+  struct Biquad {
+    float b0, b1, b2, a1, a2;
+  };
+  struct FilterState {
+    float z1, z2;
+  };
+
+  auto filter(const Biquad&, FilterState&, float) -> float;
+  auto finishSubBlock() -> void;
+
+  uint8_t num_channels_;
+  uint32_t frames_per_sub_block_;
+
+  Biquad shelf_;
+  Biquad highpass_;
+  // Two filter states (shelf, then highpass) for each channel.
+  std::unique_ptr<FilterState[]> states_;
+
+  uint8_t channel_;
+  uint32_t frames_in_sub_block_;
+  float sub_block_energy_;
+
+  // Each gating block is made of four 100ms sub-blocks.
+  std::array<float, 4> sub_blocks_;
+  uint32_t sub_blocks_seen_;
+
+  uint32_t* histogram_;
+};
+
+/*
+ * Background job that fills in loudness information for tracks in the
+ * database that don't have any replay gain tags, by decoding each track and
+ * measuring it with a LoudnessMeter.
+ *
+ * Analysis is done one track per job on the background worker pool, so that
+ * it interleaves fairly with other background work. It should only be
+ * started when nothing else is using the codecs or the sd card heavily, e.g.
+ * when playback is stopped.
+ */
+class LoudnessScanner {
+ public:
+  LoudnessScanner(database::Handle, database::ITagParser&, tasks::WorkerPool&);
+
+  /* Starts scanning, if a scan isn't already in progress. */
+  auto start() -> void;
+
+  /*
+   * Asks any in-progress scan to stop as soon as possible. Any partially
+   * analysed track is discarded, and will be analysed again next time.
+   */
+  auto stop() -> void;
+
+  auto isRunning() -> bool;
+
+  LoudnessScanner(const LoudnessScanner&) = delete;
+  LoudnessScanner& operator=(const LoudnessScanner&) = delete;
+
+ private:
+  auto scanNext(database::TrackId after) -> void;
+  auto analyse(const database::TrackData&) -> std::optional<int16_t>;
+
+  database::Handle db_;
+  FatfsStreamFactory streams_;
+  codecs::CodecPool codecs_;
+  tasks::WorkerPool& worker_;
+
+  std::atomic<bool> is_running_;
+  std::atomic<bool> stop_requested_;
+};
+
+}  // namespace audio
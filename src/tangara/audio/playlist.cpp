@@ -6,7 +6,9 @@
 #include "playlist.hpp"
 #include <stdint.h>
 
+#include <algorithm>
 #include <string>
+#include <string_view>
 
 #include "cppbor.h"
 #include "cppbor_parse.h"
@@ -15,20 +17,68 @@
 
 #include "audio/playlist.hpp"
 #include "database/database.hpp"
+#include "memory_resource.hpp"
 
 namespace audio {
 
 [[maybe_unused]] static constexpr char kTag[] = "playlist";
 
+// How many items around the current position a Playlist keeps the exact
+// offsets of.
+static constexpr size_t kWindowSize = 64;
+
+/*
+ * Strips any trailing carriage return from a line of a playlist, and returns
+ * whether the line is an item (rather than blank, or a comment).
+ */
+static auto isItem(std::string& line) -> bool {
+  if (line.ends_with('\r')) {
+    line.pop_back();
+  }
+  return !line.empty() && !line.starts_with("#");
+}
+
+// Every queue file starts with this magic and version number. Queue files
+// without it are from older firmware, and are discarded.
+static constexpr uint8_t kQueueMagic[] = {'T', 'Q', 'U', 'E', 2, 0, 0, 0};
+// The magic is followed by the generation of the database that the queue's
+// track ids belong to, as a little-endian uint32.
+static constexpr size_t kQueueHeaderSize = sizeof(kQueueMagic) + 4;
+
+// Each record is a little-endian uint32.
+static constexpr size_t kQueueRecordSize = 4;
+
+// Records with this bit set are indexes into the paths file, rather than track
+// ids.
+static constexpr uint32_t kPathRecordFlag = 1u << 31;
+
+static auto encodeRecord(uint32_t val, uint8_t* out) -> void {
+  out[0] = val & 0xFF;
+  out[1] = (val >> 8) & 0xFF;
+  out[2] = (val >> 16) & 0xFF;
+  out[3] = (val >> 24) & 0xFF;
+}
+
+static auto decodeRecord(const uint8_t* in) -> uint32_t {
+  return static_cast<uint32_t>(in[0]) | static_cast<uint32_t>(in[1]) << 8 |
+         static_cast<uint32_t>(in[2]) << 16 | static_cast<uint32_t>(in[3]) << 24;
+}
+
 Playlist::Playlist(const std::string& playlistFilepath)
     : filepath_(playlistFilepath),
       mutex_(),
       total_size_(0),
       pos_(-1),
+      file_(&memory::kAudioResource),
       file_open_(false),
       file_error_(false),
-      offset_cache_(&memory::kSpiRamResource),
-      sample_size_(50) {}
+      indexed_(false),
+      generation_(0),
+      offset_cache_(&memory::kAudioResource),
+      sample_size_(50),
+      window_start_(0),
+      window_(&memory::kAudioResource),
+      window_end_(0) {}
 
 auto Playlist::open() -> bool {
   std::unique_lock<std::mutex> lock(mutex_);
@@ -37,29 +87,92 @@ auto Playlist::open() -> bool {
     return true;
   }
 
-  FRESULT res =
-      f_open(&file_, filepath_.c_str(), FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
-  if (res != FR_OK) {
-    ESP_LOGE(kTag, "failed to open file! res: %i", res);
+  if (!file_.open(filepath_)) {
+    ESP_LOGE(kTag, "failed to open file!");
     return false;
   }
   file_open_ = true;
   file_error_ = false;
+  pos_ = -1;
+  window_.clear();
+
+  indexed_ = deserialiseCache();
+  if (!indexed_) {
+    // Rather than making our caller wait for the whole file to be scanned,
+    // just find the first item so that playback can start straight away.
+    total_size_ = 0;
+    offset_cache_.clear();
+  }
 
-  if (!deserialiseCache()) {
-    // Count the playlist size and build our offset cache.
-    countItems();
-    // Advance to the first item.
-    skipToWithoutCache(0);
+  skipToLocked(0);
+  if (!indexed_ && pos_ == 0) {
+    total_size_ = 1;
   }
 
   return !file_error_;
 }
 
-Playlist::~Playlist() {
-  if (file_open_) {
-    f_close(&file_);
+Playlist::~Playlist() {}
+
+auto Playlist::buildIndex() -> bool {
+  uint32_t generation;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!file_open_ || indexed_) {
+      return indexed_;
+    }
+    generation = generation_;
+  }
+
+  // Scan through a separate handle to the file, so that we only need to hold
+  // the lock whilst recording our progress.
+  database::BufferedFile file{&memory::kAudioResource};
+  if (!file.open(filepath_)) {
+    return false;
+  }
+
+  std::string line;
+  size_t count = 0;
+  for (;;) {
+    FSIZE_t offset = file.tell();
+    int res = file.readLine(line);
+    if (res < 0) {
+      ESP_LOGW(kTag, "error indexing playlist at offset %llu", offset);
+      return false;
+    }
+    if (res == 0) {
+      break;
+    }
+    if (!isItem(line)) {
+      continue;
+    }
+    if (count % sample_size_ == 0) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (generation != generation_) {
+        return false;
+      }
+      offset_cache_.push_back(offset);
+      total_size_ = std::max(total_size_, count);
+    }
+    count++;
   }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (generation != generation_) {
+      return false;
+    }
+    total_size_ = count;
+    indexed_ = true;
+  }
+
+  serialiseCache();
+  return true;
+}
+
+auto Playlist::isIndexed() const -> bool {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return indexed_;
 }
 
 auto Playlist::filepath() const -> std::string {
@@ -81,6 +194,26 @@ auto Playlist::value() const -> std::string {
   return current_value_;
 }
 
+auto Playlist::valueAt(size_t position) -> std::optional<std::string> {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (pos_ >= 0 && position == static_cast<size_t>(pos_)) {
+    return current_value_;
+  }
+
+  // Reuse the normal seeking logic, then put the current item back.
+  ssize_t pos = pos_;
+  std::string current = std::move(current_value_);
+  skipToLocked(position);
+
+  std::optional<std::string> res;
+  if (pos_ >= 0 && position == static_cast<size_t>(pos_)) {
+    res = std::move(current_value_);
+  }
+  pos_ = pos;
+  current_value_ = std::move(current);
+  return res;
+}
+
 auto Playlist::atEnd() const -> bool {
   std::unique_lock<std::mutex> lock(mutex_);
   return pos_ + 1 >= total_size_;
@@ -89,14 +222,13 @@ auto Playlist::atEnd() const -> bool {
 auto Playlist::next() -> void {
   std::unique_lock<std::mutex> lock(mutex_);
   if (pos_ + 1 < total_size_ && !file_error_) {
-    advanceBy(1);
+    skipToLocked(pos_ + 1);
   }
 }
 
 auto Playlist::prev() -> void {
   std::unique_lock<std::mutex> lock(mutex_);
-  if (!file_error_) {
-    // Naive approach to see how that goes for now
+  if (pos_ > 0 && !file_error_) {
     skipToLocked(pos_ - 1);
   }
 }
@@ -127,7 +259,7 @@ auto Playlist::serialiseCache() -> bool {
 
   cppbor::Array data;
   // First item = file size of queue file (for checking this file matches)
-  data.add(f_size(&file_));
+  data.add(file_.size());
   // Next item = number of tracks in this queue
   data.add(total_size_);
 
@@ -179,7 +311,7 @@ auto Playlist::deserialiseCache() -> bool {
   auto entries = data->asArray();
 
   // Double check the expected file size matches.
-  if (entries->get(0)->asUint()->unsignedValue() != f_size(&file_)) {
+  if (entries->get(0)->asUint()->unsignedValue() != file_.size()) {
     return false;
   }
 
@@ -198,8 +330,11 @@ auto Playlist::deserialiseCache() -> bool {
 }
 
 auto Playlist::close() -> void {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Stop any index that's being built for the file.
+  generation_++;
   if (file_open_) {
-    f_close(&file_);
+    file_.close();
     file_open_ = false;
     file_error_ = false;
   }
@@ -210,145 +345,328 @@ auto Playlist::skipToLocked(size_t position) -> void {
     return;
   }
 
-  // Check our cache and go to nearest entry
-  auto remainder = position % sample_size_;
-  auto quotient = (position - remainder) / sample_size_;
-  if (offset_cache_.size() <= quotient) {
-    skipToWithoutCache(position);
-    return;
+  size_t window_end_pos = window_start_ + window_.size();
+  if (!window_.empty()) {
+    if (position >= window_start_ && position < window_end_pos) {
+      readAt(position, window_[position - window_start_]);
+      return;
+    }
+    if (position + 1 == window_start_) {
+      auto offset = scanBackFrom(window_.front());
+      if (offset) {
+        if (window_.size() == kWindowSize) {
+          window_end_ = window_.back();
+          window_.pop_back();
+        }
+        window_.insert(window_.begin(), *offset);
+        window_start_--;
+        pos_ = position;
+        std::swap(current_value_, line_);
+        return;
+      }
+    }
   }
 
-  // Go to byte offset
-  auto entry = offset_cache_.at(quotient);
-  auto res = f_lseek(&file_, entry);
-  if (res != FR_OK) {
-    ESP_LOGW(kTag, "error seeking %u", res);
-    file_error_ = true;
-    return;
+  // Otherwise, read forward from the closest item before the position that
+  // we know the offset of.
+  size_t from_position = 0;
+  FSIZE_t from_offset = 0;
+  if (!offset_cache_.empty()) {
+    size_t i = std::min<size_t>(position / sample_size_,
+                                offset_cache_.size() - 1);
+    from_position = i * sample_size_;
+    from_offset = offset_cache_[i];
   }
-
-  // Count ahead entries.
-  advanceBy(remainder + 1);
+  if (!window_.empty() && window_end_pos <= position &&
+      window_end_pos >= from_position) {
+    from_position = window_end_pos;
+    from_offset = window_end_;
+  }
+  scanTo(from_position, from_offset, position);
 }
 
-auto Playlist::skipToWithoutCache(size_t position) -> void {
-  if (position >= pos_) {
-    advanceBy(position - pos_);
-  } else {
-    pos_ = -1;
-    FRESULT res = f_rewind(&file_);
-    if (res != FR_OK) {
-      ESP_LOGW(kTag, "error rewinding %u", res);
-      file_error_ = true;
-      return;
-    }
-    advanceBy(position + 1);
+/*
+ * Reads forward through the file from the item at `from_position`, which
+ * starts at or after `from_offset`, until reaching `position` or the end of
+ * the file. Every item read along the way is added to the window.
+ */
+auto Playlist::scanTo(size_t from_position,
+                      FSIZE_t from_offset,
+                      size_t position) -> void {
+  if (window_.empty() || from_position != window_start_ + window_.size()) {
+    window_.clear();
+    window_start_ = from_position;
   }
-}
 
-auto Playlist::countItems() -> void {
-  TCHAR buff[512];
+  if (!file_.seek(from_offset)) {
+    ESP_LOGW(kTag, "error seeking to %llu", from_offset);
+    file_error_ = true;
+    return;
+  }
 
-  for (;;) {
-    auto offset = f_tell(&file_);
-    auto next_item = nextItem(buff);
-    if (!next_item) {
+  for (size_t p = from_position; p <= position; p++) {
+    auto offset = nextItem();
+    if (!offset) {
       break;
     }
-    if (total_size_ % sample_size_ == 0) {
-      offset_cache_.push_back(offset);
+    if (window_.size() == kWindowSize) {
+      window_.erase(window_.begin());
+      window_start_++;
     }
-    total_size_++;
+    window_.push_back(*offset);
+    window_end_ = file_.tell();
+    pos_ = p;
+    std::swap(current_value_, line_);
   }
-
-  f_rewind(&file_);
 }
 
-auto Playlist::advanceBy(ssize_t amt) -> bool {
-  TCHAR buff[512];
-  std::optional<std::string_view> item;
-
-  while (amt > 0) {
-    item = nextItem(buff);
-    if (!item) {
-      break;
-    }
-    pos_++;
-    amt--;
+auto Playlist::readAt(size_t position, FSIZE_t offset) -> void {
+  if (!file_.seek(offset)) {
+    ESP_LOGW(kTag, "error seeking to %llu", offset);
+    file_error_ = true;
+    return;
   }
-
-  if (item) {
-    current_value_ = *item;
+  if (nextItem()) {
+    pos_ = position;
+    std::swap(current_value_, line_);
   }
-
-  return amt == 0;
 }
 
-auto Playlist::nextItem(std::span<TCHAR> buf)
-    -> std::optional<std::string_view> {
-  while (file_open_ && !file_error_ && !f_eof(&file_)) {
-    // FIXME: f_gets is quite slow (it does several very small reads instead of
-    // grabbing a whole sector at a time), and it doesn't work well for very
-    // long lines. We should do something smarter here.
-    TCHAR* str = f_gets(buf.data(), buf.size(), &file_);
-    if (str == NULL) {
-      ESP_LOGW(kTag, "Error consuming playlist file at offset %llu",
-               f_tell(&file_));
+/*
+ * Searches backwards for the item before the one that starts at `offset`.
+ * Returns the offset of the item found, with its value in line_.
+ */
+auto Playlist::scanBackFrom(FSIZE_t offset) -> std::optional<FSIZE_t> {
+  // `offset` is the start of a line, so the line before it ends with the
+  // newline at `offset - 1`.
+  FSIZE_t end = offset;
+  while (end > 0) {
+    FSIZE_t start = 0;
+    if (auto newline = file_.rfind('\n', end - 1)) {
+      start = *newline + 1;
+    }
+    if (!file_.seek(start) || file_.readLine(line_) < 0) {
+      ESP_LOGW(kTag, "Error consuming playlist file at offset %llu", start);
       file_error_ = true;
       return {};
     }
+    if (isItem(line_)) {
+      return start;
+    }
+    end = start;
+  }
+  return {};
+}
 
-    std::string_view line{str};
-    if (line.starts_with("#")) {
-      continue;
+/*
+ * Reads the next item from the playlist into line_, returning the offset that
+ * it starts at. Returns nothing if there are no more items, or if reading
+ * failed.
+ */
+auto Playlist::nextItem() -> std::optional<FSIZE_t> {
+  while (file_open_ && !file_error_ && !file_.eof()) {
+    FSIZE_t offset = file_.tell();
+    if (file_.readLine(line_) < 0) {
+      ESP_LOGW(kTag, "Error consuming playlist file at offset %llu",
+               file_.tell());
+      file_error_ = true;
+      return {};
     }
-    if (line.ends_with('\n')) {
-      line = line.substr(0, line.size() - 1);
+    if (isItem(line_)) {
+      return offset;
     }
-    return line;
   }
 
   // Got to EOF without reading a valid line.
   return {};
 }
 
-MutablePlaylist::MutablePlaylist(const std::string& playlistFilepath)
-    : Playlist(playlistFilepath) {}
+MutablePlaylist::MutablePlaylist(const std::string& filepath)
+    : filepath_(filepath),
+      paths_filepath_(filepath + ".paths"),
+      mutex_(),
+      total_size_(0),
+      pos_(0),
+      current_(),
+      file_open_(false),
+      file_error_(false),
+      generation_(0),
+      paths_(&memory::kAudioResource),
+      path_indexes_(&memory::kAudioResource) {}
+
+MutablePlaylist::~MutablePlaylist() {
+  close();
+}
 
-auto MutablePlaylist::open() -> bool {
+auto MutablePlaylist::open(uint32_t generation) -> bool {
   std::unique_lock<std::mutex> lock(mutex_);
 
   if (file_open_) {
     return true;
   }
-  
+  generation_ = generation;
+
   FRESULT res =
       f_open(&file_, filepath_.c_str(), FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
   if (res != FR_OK) {
     ESP_LOGE(kTag, "failed to open file! res: %i", res);
     return false;
   }
+  res = f_open(&paths_file_, paths_filepath_.c_str(),
+               FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+  if (res != FR_OK) {
+    ESP_LOGE(kTag, "failed to open paths file! res: %i", res);
+    f_close(&file_);
+    return false;
+  }
   file_open_ = true;
   file_error_ = false;
 
-  auto queue_filesize = f_size(&file_);
-
-  if (!deserialiseCache()) {
-    // If there's no cache (or deserialising failed) and the queue is
-    // sufficiently large, abort and clear the queue
-    if (queue_filesize > 50000) {
-      clearLocked();
-    } else {
-      // Otherwise, read in the existing entries
-      countItems();
-      // Advance to the first item.
-      skipToWithoutCache(0);
-    }
+  uint8_t header[kQueueHeaderSize];
+  UINT bytes_read = 0;
+  res = f_read(&file_, header, sizeof(header), &bytes_read);
+  if (res != FR_OK || bytes_read != sizeof(header) ||
+      !std::equal(kQueueMagic, kQueueMagic + sizeof(kQueueMagic), header)) {
+    // Either this is a brand new queue, or it was written by an older version
+    // of the firmware. Either way, there's nothing here we can use.
+    ESP_LOGI(kTag, "starting a new queue file");
+    return clearLocked();
+  }
+  if (decodeRecord(header + sizeof(kQueueMagic)) != generation_) {
+    // The database has been rebuilt since this queue was written, so its
+    // track ids could now refer to entirely different tracks.
+    ESP_LOGW(kTag, "queue is from an older database; discarding it");
+    return clearLocked();
+  }
+
+  if (!loadPaths()) {
+    return clearLocked();
   }
 
+  // Any trailing partial record is from an interrupted write, and will be
+  // overwritten by the next append.
+  total_size_ = (f_size(&file_) - kQueueHeaderSize) / kQueueRecordSize;
+  pos_ = 0;
+  current_.reset();
+  skipToLocked(0);
+
   return !file_error_;
 }
 
+auto MutablePlaylist::close() -> void {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (file_open_) {
+    f_close(&file_);
+    f_close(&paths_file_);
+    file_open_ = false;
+    file_error_ = false;
+  }
+}
+
+auto MutablePlaylist::filepath() const -> std::string {
+  return filepath_;
+}
+
+auto MutablePlaylist::currentPosition() const -> size_t {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return pos_;
+}
+
+auto MutablePlaylist::size() const -> size_t {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return total_size_;
+}
+
+auto MutablePlaylist::value() const -> std::optional<Item> {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!current_) {
+    return {};
+  }
+  return toItem(*current_);
+}
+
+auto MutablePlaylist::valueAt(size_t position) -> std::optional<Item> {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!file_open_ || file_error_ || position >= total_size_) {
+    return {};
+  }
+  auto record = readRecord(position);
+  if (!record) {
+    return {};
+  }
+  return toItem(*record);
+}
+
+auto MutablePlaylist::toItem(uint32_t record) const -> std::optional<Item> {
+  if (record & kPathRecordFlag) {
+    size_t index = record & ~kPathRecordFlag;
+    if (index >= paths_.size()) {
+      return {};
+    }
+    return Item{std::string{paths_[index]}};
+  }
+  return Item{database::TrackId{record}};
+}
+
+auto MutablePlaylist::atEnd() const -> bool {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return pos_ + 1 >= total_size_;
+}
+
+auto MutablePlaylist::next() -> void {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (pos_ + 1 < total_size_) {
+    skipToLocked(pos_ + 1);
+  }
+}
+
+auto MutablePlaylist::prev() -> void {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (pos_ > 0) {
+    skipToLocked(pos_ - 1);
+  }
+}
+
+auto MutablePlaylist::skipTo(size_t position) -> void {
+  std::unique_lock<std::mutex> lock(mutex_);
+  skipToLocked(position);
+}
+
+auto MutablePlaylist::skipToLocked(size_t position) -> void {
+  if (!file_open_ || file_error_ || total_size_ == 0) {
+    return;
+  }
+  position = std::min(position, total_size_ - 1);
+  auto record = readRecord(position);
+  if (!record) {
+    return;
+  }
+  pos_ = position;
+  current_ = record;
+}
+
+auto MutablePlaylist::readRecord(size_t position) -> std::optional<uint32_t> {
+  FSIZE_t offset = kQueueHeaderSize + static_cast<FSIZE_t>(position) *
+                                          kQueueRecordSize;
+  auto res = f_lseek(&file_, offset);
+  if (res != FR_OK) {
+    ESP_LOGW(kTag, "error seeking %u", res);
+    file_error_ = true;
+    return {};
+  }
+
+  uint8_t buf[kQueueRecordSize];
+  UINT bytes_read = 0;
+  res = f_read(&file_, buf, sizeof(buf), &bytes_read);
+  if (res != FR_OK || bytes_read != sizeof(buf)) {
+    ESP_LOGW(kTag, "error reading queue record %u", position);
+    file_error_ = true;
+    return {};
+  }
+
+  return decodeRecord(buf);
+}
+
 auto MutablePlaylist::clear() -> bool {
   std::unique_lock<std::mutex> lock(mutex_);
   return clearLocked();
@@ -360,37 +678,65 @@ auto MutablePlaylist::clearLocked() -> bool {
     file_error_ = false;
     file_open_ = false;
     f_close(&file_);
+    f_close(&paths_file_);
   }
 
   FRESULT res;
   if (file_open_) {
-    res = f_rewind(&file_);
-    if (res != FR_OK) {
-      ESP_LOGE(kTag, "error rewinding %u", res);
-      file_error_ = true;
-      return false;
-    }
-    res = f_truncate(&file_);
-    if (res != FR_OK) {
-      ESP_LOGE(kTag, "error truncating %u", res);
-      file_error_ = true;
-      return false;
+    for (FIL* file : {&file_, &paths_file_}) {
+      res = f_rewind(file);
+      if (res != FR_OK) {
+        ESP_LOGE(kTag, "error rewinding %u", res);
+        file_error_ = true;
+        return false;
+      }
+      res = f_truncate(file);
+      if (res != FR_OK) {
+        ESP_LOGE(kTag, "error truncating %u", res);
+        file_error_ = true;
+        return false;
+      }
     }
   } else {
     res = f_open(&file_, filepath_.c_str(),
                  FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
     if (res != FR_OK) {
       ESP_LOGE(kTag, "error opening file %u", res);
-      file_error_ = true;
+      return false;
+    }
+    res = f_open(&paths_file_, paths_filepath_.c_str(),
+                 FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+    if (res != FR_OK) {
+      ESP_LOGE(kTag, "error opening paths file %u", res);
+      f_close(&file_);
       return false;
     }
     file_open_ = true;
   }
 
   total_size_ = 0;
-  current_value_.clear();
-  offset_cache_.clear();
-  pos_ = -1;
+  pos_ = 0;
+  current_.reset();
+  paths_.clear();
+  path_indexes_.clear();
+
+  uint8_t header[kQueueHeaderSize];
+  std::copy(kQueueMagic, kQueueMagic + sizeof(kQueueMagic), header);
+  encodeRecord(generation_, header + sizeof(kQueueMagic));
+
+  UINT bytes_written = 0;
+  res = f_write(&file_, header, kQueueHeaderSize, &bytes_written);
+  if (res != FR_OK || bytes_written != kQueueHeaderSize) {
+    ESP_LOGE(kTag, "error writing queue header %u", res);
+    file_error_ = true;
+    return false;
+  }
+  res = f_sync(&file_);
+  if (res != FR_OK) {
+    ESP_LOGE(kTag, "error syncing queue file %u", res);
+    file_error_ = true;
+    return false;
+  }
   return true;
 }
 
@@ -400,45 +746,185 @@ auto MutablePlaylist::append(Item i) -> void {
     return;
   }
 
-  auto offset = f_tell(&file_);
-  bool first_entry = current_value_.empty();
+  uint32_t record;
+  if (std::holds_alternative<database::TrackId>(i)) {
+    record = std::get<database::TrackId>(i);
+    if (record & kPathRecordFlag) {
+      ESP_LOGE(kTag, "track id %lu is too large to queue", record);
+      return;
+    }
+  } else {
+    auto& path = std::get<std::string>(i);
+    if (path.empty()) {
+      return;
+    }
+    auto index = internPath(path);
+    if (!index) {
+      return;
+    }
+    record = *index | kPathRecordFlag;
+  }
+
+  if (!writeRecords({&record, 1})) {
+    return;
+  }
+  auto res = f_sync(&file_);
+  if (res != FR_OK) {
+    ESP_LOGE(kTag, "Failed to sync playlist file after append");
+    file_error_ = true;
+    return;
+  }
+}
+
+auto MutablePlaylist::appendMany(std::span<const database::TrackId> ids)
+    -> void {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!file_open_ || file_error_ || ids.empty()) {
+    return;
+  }
+  auto is_too_large = [](database::TrackId id) {
+    return (id & kPathRecordFlag) != 0;
+  };
+  if (std::none_of(ids.begin(), ids.end(), is_too_large)) {
+    writeRecords(ids);
+    return;
+  }
 
-  // Seek to end and append
-  auto end = f_size(&file_);
+  // Ids with the top bit set would be read back as paths, so leave them out.
+  std::pmr::vector<uint32_t> valid{&memory::kAudioResource};
+  valid.reserve(ids.size());
+  for (database::TrackId id : ids) {
+    if (is_too_large(id)) {
+      ESP_LOGE(kTag, "track id %lu is too large to queue", id);
+      continue;
+    }
+    valid.push_back(id);
+  }
+  if (!valid.empty()) {
+    writeRecords(valid);
+  }
+}
+
+auto MutablePlaylist::writeRecords(std::span<const uint32_t> records) -> bool {
+  // Append after the last complete record, rather than at the end of the file,
+  // so that we overwrite any partial record left by an interrupted write.
+  FSIZE_t end = kQueueHeaderSize + static_cast<FSIZE_t>(total_size_) *
+                                       kQueueRecordSize;
   auto res = f_lseek(&file_, end);
   if (res != FR_OK) {
     ESP_LOGE(kTag, "Seek to end of file failed? Error %d", res);
     file_error_ = true;
-    return;
+    return false;
   }
 
-  // TODO: Resolve paths for track id, etc
-  std::string path;
-  if (std::holds_alternative<std::string>(i)) {
-    path = std::get<std::string>(i);
-    f_printf(&file_, "%s\n", path.c_str());
-    if (total_size_ % sample_size_ == 0) {
-      offset_cache_.push_back(end);
-    }
-    if (first_entry) {
-      current_value_ = path;
-    }
-    total_size_++;
+  std::pmr::vector<uint8_t> buf{records.size() * kQueueRecordSize,
+                                &memory::kAudioResource};
+  for (size_t i = 0; i < records.size(); i++) {
+    encodeRecord(records[i], &buf[i * kQueueRecordSize]);
+  }
+
+  UINT bytes_written = 0;
+  res = f_write(&file_, buf.data(), buf.size(), &bytes_written);
+  if (res != FR_OK || bytes_written != buf.size()) {
+    ESP_LOGE(kTag, "Failed to append to playlist file");
+    file_error_ = true;
+    return false;
+  }
+
+  if (total_size_ == 0) {
+    current_ = records[0];
+    pos_ = 0;
   }
+  total_size_ += records.size();
+  return true;
+}
 
-  // Restore position
-  res = f_lseek(&file_, offset);
+auto MutablePlaylist::sync() -> bool {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!file_open_ || file_error_) {
+    return false;
+  }
+  auto res = f_sync(&file_);
   if (res != FR_OK) {
-    ESP_LOGE(kTag, "Failed to restore file position after append?");
+    ESP_LOGE(kTag, "Failed to sync playlist file");
     file_error_ = true;
-    return;
+    return false;
+  }
+  return true;
+}
+
+auto MutablePlaylist::loadPaths() -> bool {
+  paths_.clear();
+  path_indexes_.clear();
+
+  std::pmr::string contents{&memory::kAudioResource};
+  contents.resize(f_size(&paths_file_));
+  UINT bytes_read = 0;
+  auto res = f_read(&paths_file_, contents.data(), contents.size(), &bytes_read);
+  if (res != FR_OK || bytes_read != contents.size()) {
+    ESP_LOGE(kTag, "failed to read paths file! res: %i", res);
+    return false;
+  }
+
+  std::string_view remaining{contents};
+  size_t consumed = 0;
+  for (;;) {
+    size_t newline = remaining.find('\n');
+    if (newline == std::string_view::npos) {
+      break;
+    }
+    paths_.emplace_back(remaining.substr(0, newline));
+    path_indexes_.emplace(paths_.back(), paths_.size() - 1);
+    remaining = remaining.substr(newline + 1);
+    consumed += newline + 1;
+  }
+
+  // A trailing line without a newline is from an interrupted write. No record
+  // can refer to it, but it must be dropped so that the next path we intern
+  // starts on a line of its own.
+  if (consumed != contents.size()) {
+    if (f_lseek(&paths_file_, consumed) != FR_OK ||
+        f_truncate(&paths_file_) != FR_OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+auto MutablePlaylist::internPath(const std::string& path)
+    -> std::optional<uint32_t> {
+  // Paths are stored one per line, so a path containing a newline would be
+  // read back as two, and shift every path after it.
+  if (path.find('\n') != std::string::npos) {
+    ESP_LOGE(kTag, "can't queue a path containing a newline");
+    return {};
+  }
+
+  auto existing = path_indexes_.find(path);
+  if (existing != path_indexes_.end()) {
+    return existing->second;
+  }
+
+  auto res = f_lseek(&paths_file_, f_size(&paths_file_));
+  if (res == FR_OK) {
+    UINT bytes_written = 0;
+    res = f_write(&paths_file_, path.data(), path.size(), &bytes_written);
+    if (res == FR_OK && bytes_written == path.size()) {
+      res = f_write(&paths_file_, "\n", 1, &bytes_written);
+    }
+  }
+  if (res == FR_OK) {
+    res = f_sync(&paths_file_);
   }
-  res = f_sync(&file_);
   if (res != FR_OK) {
-    ESP_LOGE(kTag, "Failed to sync playlist file after append");
+    ESP_LOGE(kTag, "Failed to append to paths file");
     file_error_ = true;
-    return;
+    return {};
   }
+
+  paths_.emplace_back(path);
+  path_indexes_.emplace(paths_.back(), paths_.size() - 1);
+  return paths_.size() - 1;
 }
 
 }  // namespace audio
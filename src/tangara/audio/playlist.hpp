@@ -7,11 +7,20 @@
 
 #pragma once
 
+#include <deque>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <variant>
+#include <vector>
 
 #include "ff.h"
 
+#include "database/buffered_file.hpp"
 #include "database/database.hpp"
 #include "database/track.hpp"
 
@@ -20,12 +29,15 @@ namespace audio {
 /*
  * Owns and manages a playlist file.
  * Each line in the playlist file is the absolute filepath of the track to play.
- * In order to avoid mapping to byte offsets, each line must contain only a
- * filepath (ie, no comments are supported). This limitation may be removed
- * later if benchmarks show that the file can be quickly scanned from 'bookmark'
- * offsets. This is a subset of the m3u format and ideally will be
+ * Blank lines, and lines starting with '#' (such as m3u's #EXTINF metadata),
+ * are skipped. This is a subset of the m3u format and ideally will be
  * import/exportable to and from this format, to better support playlists from
  * beets import and other music management software.
+ *
+ * To seek quickly within large playlists, we keep two indexes of where items
+ * start within the file: a sparse index of every sample_size_'th item across
+ * the whole file, which is saved to a '.cache' file alongside the playlist, and
+ * a dense window of every item around the current position.
  */
 class Playlist {
  public:
@@ -33,12 +45,31 @@ class Playlist {
   virtual ~Playlist();
   using Item =
       std::variant<database::TrackId, database::TrackIterator, std::string>;
+
+  /*
+   * Opens the playlist file. If its '.cache' is missing or out of date, then
+   * only the first item is read, and `buildIndex` must be run before the rest
+   * of the playlist is counted.
+   */
   virtual auto open() -> bool;
 
+  /*
+   * Scans the whole playlist file, building its sparse index and counting its
+   * items, then writes out a new '.cache'. This can take a while for large
+   * playlists, so it should be run in the background; the playlist remains
+   * usable whilst it runs, with its size growing as the scan progresses.
+   * Returns false if the scan failed, or was stopped by the playlist being
+   * closed.
+   */
+  auto buildIndex() -> bool;
+  auto isIndexed() const -> bool;
+
   auto filepath() const -> std::string;
   auto currentPosition() const -> size_t;
   auto size() const -> size_t;
   auto value() const -> std::string;
+  /* Returns the item at the given position, without moving to it. */
+  auto valueAt(size_t position) -> std::optional<std::string>;
   auto atEnd() const -> bool;
 
   auto next() -> void;
@@ -49,18 +80,24 @@ class Playlist {
   auto deserialiseCache() -> bool;
   auto close() -> void;
 
- protected:
+ private:
   const std::string filepath_;
 
   mutable std::mutex mutex_;
   size_t total_size_;
   ssize_t pos_;
 
-  FIL file_;
+  database::BufferedFile file_;
   bool file_open_;
   bool file_error_;
+  bool indexed_;
+  // Incremented whenever the file is closed, to stop any in-progress
+  // buildIndex.
+  uint32_t generation_;
 
   std::string current_value_;
+  // Scratch space for reading lines into, kept around to reuse its capacity.
+  std::string line_;
 
   /* List of offsets determined by sample size */
   std::pmr::vector<FSIZE_t> offset_cache_;
@@ -72,24 +109,111 @@ class Playlist {
    */
   const uint32_t sample_size_;
 
- protected:
+  /*
+   * The offset of every item from position window_start_ onwards, up to a
+   * limited number of items. This is filled in as we read through the file,
+   * so that moving back and forth near the current position doesn't need to
+   * rescan from the sparse index.
+   */
+  size_t window_start_;
+  std::pmr::vector<FSIZE_t> window_;
+  // Where to continue reading from to find the item after the window.
+  FSIZE_t window_end_;
+
   auto skipToLocked(size_t position) -> void;
-  auto countItems() -> void;
-  auto advanceBy(ssize_t amt) -> bool;
-  auto nextItem(std::span<TCHAR>) -> std::optional<std::string_view>;
-  auto skipToWithoutCache(size_t position) -> void;
+  auto scanTo(size_t from_position,
+              FSIZE_t from_offset,
+              size_t position) -> void;
+  auto readAt(size_t position, FSIZE_t offset) -> void;
+  auto scanBackFrom(FSIZE_t offset) -> std::optional<FSIZE_t>;
+  auto nextItem() -> std::optional<FSIZE_t>;
 };
 
-class MutablePlaylist : public Playlist {
+/*
+ * Owns and manages the file backing the playback queue.
+ *
+ * Unlike a Playlist, the queue is stored as a flat array of fixed-width
+ * records after a short header. Each record is either a track id, or (if its
+ * top bit is set) an index into a table of filepaths that is kept in a
+ * separate '.paths' file alongside the queue. Paths are interned, so queueing
+ * the same file many times only stores it once.
+ *
+ * Since every record is the same size, seeking to any position is a single
+ * f_lseek, no matter how large the queue is. This keeps shuffling over very
+ * large queues fast, and means we never need to scan or cache offsets.
+ *
+ * Track ids are only valid for the database they came from, so the header also
+ * records the database's generation. Queues from any other generation are
+ * discarded when they're opened.
+ */
+class MutablePlaylist {
  public:
-  MutablePlaylist(const std::string& playlistFilepath);
-  auto open() -> bool override;
+  MutablePlaylist(const std::string& filepath);
+  ~MutablePlaylist();
+
+  using Item = std::variant<database::TrackId, std::string>;
+
+  /*
+   * Opens the queue file, discarding its contents if they were written for a
+   * different generation of the database.
+   */
+  auto open(uint32_t db_generation) -> bool;
+  auto close() -> void;
+
+  auto filepath() const -> std::string;
+  auto currentPosition() const -> size_t;
+  auto size() const -> size_t;
+  auto value() const -> std::optional<Item>;
+  /* Returns the item at the given position, without moving to it. */
+  auto valueAt(size_t position) -> std::optional<Item>;
+  auto atEnd() const -> bool;
+
+  auto next() -> void;
+  auto prev() -> void;
+  auto skipTo(size_t position) -> void;
 
   auto clear() -> bool;
   auto append(Item i) -> void;
 
+  /*
+   * Appends many tracks at once, with a single write. The file isn't synced;
+   * call `sync` once after the final batch.
+   */
+  auto appendMany(std::span<const database::TrackId> ids) -> void;
+  auto sync() -> bool;
+
+  MutablePlaylist(const MutablePlaylist&) = delete;
+  MutablePlaylist& operator=(const MutablePlaylist&) = delete;
+
  private:
   auto clearLocked() -> bool;
+  auto skipToLocked(size_t position) -> void;
+  auto readRecord(size_t position) -> std::optional<uint32_t>;
+  auto toItem(uint32_t record) const -> std::optional<Item>;
+  auto writeRecords(std::span<const uint32_t> records) -> bool;
+  auto loadPaths() -> bool;
+  auto internPath(const std::string& path) -> std::optional<uint32_t>;
+
+  const std::string filepath_;
+  const std::string paths_filepath_;
+
+  mutable std::mutex mutex_;
+  size_t total_size_;
+  size_t pos_;
+  std::optional<uint32_t> current_;
+
+  FIL file_;
+  FIL paths_file_;
+  bool file_open_;
+  bool file_error_;
+  // The generation of the database that our track ids belong to.
+  uint32_t generation_;
+
+  // Every path in the paths file, in order. This is a deque so that the
+  // strings never move, and path_indexes_ can refer to them.
+  std::pmr::deque<std::pmr::string> paths_;
+  // Index of each path within paths_, so that interning is a single lookup.
+  std::pmr::unordered_map<std::string_view, uint32_t> path_indexes_;
 };
 
 }  // namespace audio
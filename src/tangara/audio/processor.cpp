@@ -27,6 +27,7 @@
 #include "drivers/i2s_dac.hpp"
 #include "drivers/pcm_buffer.hpp"
 #include "events/event_queue.hpp"
+#include "perf.hpp"
 #include "sample.hpp"
 #include "tasks.hpp"
 
@@ -37,6 +38,21 @@ static const size_t kSourceBufferLength = kSampleBufferLength * 2;
 
 namespace audio {
 
+/*
+ * Number of fractional bits used for the fixed point replay gain multiplier.
+ * With the gain limited to +12dB, this leaves plenty of headroom for
+ * multiplying 16 bit samples within an int32_t.
+ */
+static constexpr int kGainFracBits = 12;
+static constexpr int32_t kUnityGain = 1 << kGainFracBits;
+
+/*
+ * Limits on the amount of gain we're willing to apply, in hundredths of a dB.
+ * Large boosts are mostly just going to clip.
+ */
+static constexpr int16_t kMinReplayGain = -4800;
+static constexpr int16_t kMaxReplayGain = 1200;
+
 /*
  * The output format to convert all sources to. This is currently fixed because
  * the Bluetooth output doesn't support runtime configuration of its input
@@ -54,6 +70,8 @@ SampleProcessor::SampleProcessor(drivers::PcmBuffer& sink)
                                           sizeof(sample::Sample),
                                           MALLOC_CAP_DMA)),
       sink_(sink),
+      replay_gain_enabled_(false),
+      stream_gain_(kUnityGain),
       unprocessed_samples_(0) {
   tasks::StartPersistent<tasks::Type::kAudioConverter>([&]() { Main(); });
 }
@@ -74,12 +92,17 @@ auto SampleProcessor::SetOutput(std::shared_ptr<IAudioOutput> output) -> void {
   output_ = output;
 }
 
+auto SampleProcessor::SetReplayGain(bool enabled) -> void {
+  replay_gain_enabled_ = enabled;
+}
+
 auto SampleProcessor::beginStream(std::shared_ptr<TrackInfo> track) -> void {
   Args args{
       .track = new std::shared_ptr<TrackInfo>(track),
       .samples_available = 0,
       .is_end_of_stream = false,
       .clear_buffers = false,
+      .sent_at = tasks::perf::Now(),
   };
   xQueueSend(commands_, &args, portMAX_DELAY);
 }
@@ -104,6 +127,7 @@ auto SampleProcessor::continueStream(std::span<sample::Sample> input)
       .samples_available = samples_sent,
       .is_end_of_stream = false,
       .clear_buffers = false,
+      .sent_at = tasks::perf::Now(),
   };
   xQueueSend(commands_, &args, portMAX_DELAY);
 
@@ -116,6 +140,7 @@ auto SampleProcessor::endStream(bool cancelled) -> void {
       .samples_available = 0,
       .is_end_of_stream = true,
       .clear_buffers = cancelled,
+      .sent_at = tasks::perf::Now(),
   };
   xQueueSend(commands_, &args, portMAX_DELAY);
 }
@@ -129,6 +154,8 @@ auto SampleProcessor::Main() -> void {
 
     Args args;
     if (xQueueReceive(commands_, &args, wait)) {
+      tasks::perf::RecordSince(tasks::perf::Metric::kAudioCommands,
+                               args.sent_at);
       if (args.is_end_of_stream && args.clear_buffers) {
         // The new command is telling us to clear our buffers! This includes
         // discarding any commands that have backed up without being processed.
@@ -207,6 +234,16 @@ auto SampleProcessor::handleBeginStream(std::shared_ptr<TrackInfo> track)
   // channels, we could remove this.
   double_samples_ = track->format.num_channels != kTargetFormat.num_channels;
 
+  // Work out the stream's gain now, so that applying it is just a multiply.
+  if (track->replay_gain) {
+    int16_t gain = std::clamp(*track->replay_gain, kMinReplayGain,
+                              kMaxReplayGain);
+    stream_gain_ = std::lround(std::pow(10.0f, gain / 2000.0f) * kUnityGain);
+    ESP_LOGI(kTag, "stream replay gain %.2fdB", gain / 100.0f);
+  } else {
+    stream_gain_ = kUnityGain;
+  }
+
   events::Audio().Dispatch(internal::StreamStarted{
       .track = track,
       .sink_format = kTargetFormat,
@@ -240,6 +277,7 @@ auto SampleProcessor::processSamples(bool finalise) -> bool {
 
     // Next, push input samples through the resampler. In the best case, this
     // is a simple copy operation.
+    uint32_t convert_start = tasks::perf::Now();
     if (!input_buffer_.isEmpty()) {
       out_of_work = false;
       auto resample_input = input_buffer_.readAcquire();
@@ -253,6 +291,7 @@ auto SampleProcessor::processSamples(bool finalise) -> bool {
         read = wrote = std::min(resample_input.size(), resample_output.size());
         std::copy_n(resample_input.begin(), read, resample_output.begin());
       }
+      applyGain(resample_output.first(wrote));
 
       input_buffer_.readCommit(read);
       resampled_buffer_.writeCommit(wrote);
@@ -284,6 +323,10 @@ auto SampleProcessor::processSamples(bool finalise) -> bool {
       output_buffer_.writeCommit(wrote);
     }
 
+    if (!out_of_work) {
+      tasks::perf::RecordSince(tasks::perf::Metric::kConvert, convert_start);
+    }
+
     // Finally, flush whatever ended up in the output buffer.
     if (flushOutputBuffer()) {
       if (out_of_work) {
@@ -296,6 +339,18 @@ auto SampleProcessor::processSamples(bool finalise) -> bool {
   }
 }
 
+IRAM_ATTR
+auto SampleProcessor::applyGain(std::span<sample::Sample> samples) -> void {
+  if (!replay_gain_enabled_ || stream_gain_ == kUnityGain) {
+    return;
+  }
+  constexpr int32_t kRounding = 1 << (kGainFracBits - 1);
+  for (auto& s : samples) {
+    int32_t scaled = (s * stream_gain_ + kRounding) >> kGainFracBits;
+    s = std::clamp<int32_t>(scaled, INT16_MIN, INT16_MAX);
+  }
+}
+
 auto SampleProcessor::handleEndStream(bool clear_bufs) -> void {
   if (clear_bufs) {
     sink_.clear();
@@ -332,7 +387,11 @@ auto SampleProcessor::hasPendingWork() -> bool {
 IRAM_ATTR
 auto SampleProcessor::flushOutputBuffer() -> bool {
   auto samples = output_buffer_.readAcquire();
+  uint32_t send_start = tasks::perf::Now();
   size_t sent = sink_.send(samples);
+  if (!samples.empty()) {
+    tasks::perf::RecordSince(tasks::perf::Metric::kSinkFill, send_start);
+  }
   output_buffer_.readCommit(sent);
   return output_buffer_.isEmpty();
 }
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <list>
@@ -64,6 +65,12 @@ class SampleProcessor {
 
   auto SetOutput(std::shared_ptr<IAudioOutput>) -> void;
 
+  /*
+   * Sets whether or not streams should have their loudness normalised, using
+   * the replay gain from their TrackInfo. Takes effect immediately.
+   */
+  auto SetReplayGain(bool enabled) -> void;
+
   /*
    * Signals to the sample processor that a new discrete stream of audio is now
    * being sent. This will typically represent a new track being played.
@@ -98,6 +105,7 @@ class SampleProcessor {
   auto handleEndStream(bool cancel) -> void;
 
   auto processSamples(bool finalise) -> bool;
+  auto applyGain(std::span<sample::Sample>) -> void;
 
   auto hasPendingWork() -> bool;
   auto flushOutputBuffer() -> bool;
@@ -107,6 +115,8 @@ class SampleProcessor {
     size_t samples_available;
     bool is_end_of_stream;
     bool clear_buffers;
+    // When this command was sent, for profiling.
+    uint32_t sent_at;
   };
   QueueHandle_t commands_;
   std::list<Args> pending_commands_;
@@ -123,6 +133,10 @@ class SampleProcessor {
   std::unique_ptr<Resampler> resampler_;
   bool double_samples_;
 
+  std::atomic<bool> replay_gain_enabled_;
+  // Linear gain for the current stream, in fixed point.
+  int32_t stream_gain_;
+
   std::shared_ptr<IAudioOutput> output_;
   size_t unprocessed_samples_;
 };
@@ -37,6 +37,7 @@ ReadaheadSource::ReadaheadSource(tasks::WorkerPool& worker,
       tell_(wrapped_->CurrentPosition()) {}
 
 ReadaheadSource::~ReadaheadSource() {
+  refill_token_.cancel();
   is_refilling_.wait(true);
   vStreamBufferDeleteWithCaps(buffer_);
 }
@@ -87,6 +88,7 @@ auto ReadaheadSource::SeekTo(int64_t destination, SeekFrom from) -> void {
   // Seeking blows away all of our prefetched data. To do this safely, we
   // first need to wait for the refill task to finish.
   ESP_LOGI(kTag, "dropping readahead due to seek");
+  refill_token_.cancel();
   is_refilling_.wait(true);
   // It's now safe to clear out the buffer.
   xStreamBufferReset(buffer_);
@@ -112,12 +114,15 @@ auto ReadaheadSource::SetPreambleFinished() -> void {
 
 auto ReadaheadSource::BeginReadahead() -> void {
   is_refilling_ = true;
-  std::function<void(void)> refill = [this]() {
+  refill_token_ = tasks::CancellationToken::Create();
+  auto refill = [this, token = refill_token_]() {
     // Try to keep larger than most reasonable FAT sector sizes for more
     // efficient disk reads.
     constexpr size_t kMaxSingleRead = 1024 * 16;
     std::byte working_buf[kMaxSingleRead];
-    for (;;) {
+    // Stop early if we're cancelled by a seek, since everything we've read
+    // is about to be thrown away.
+    while (!token.cancelled()) {
       size_t bytes_to_read = std::min<size_t>(
           kMaxSingleRead, xStreamBufferSpacesAvailable(buffer_));
       if (bytes_to_read == 0) {
@@ -134,7 +139,10 @@ auto ReadaheadSource::BeginReadahead() -> void {
     is_refilling_ = false;
     is_refilling_.notify_all();
   };
-  worker_.Dispatch(refill);
+  // Refills are dispatched at high priority, so that they're never stuck
+  // waiting behind background work like indexing; an underrun is far more
+  // noticeable than a slower scan.
+  worker_.Post(std::move(refill), tasks::WorkPriority::kHigh);
 }
 
 }  // namespace audio
@@ -53,6 +53,7 @@ class ReadaheadSource : public codecs::IStream {
 
   bool readahead_enabled_;
   std::atomic<bool> is_refilling_;
+  tasks::CancellationToken refill_token_;
   StreamBufferHandle_t buffer_;
   int64_t tell_;
 };
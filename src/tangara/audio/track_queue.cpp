@@ -14,6 +14,7 @@
 #include <optional>
 #include <shared_mutex>
 #include <variant>
+#include <vector>
 
 #include "MillerShuffle.h"
 #include "esp_random.h"
@@ -26,7 +27,6 @@
 #include "database/track.hpp"
 #include "events/event_queue.hpp"
 #include "memory_resource.hpp"
-#include "random.hpp"
 #include "tasks.hpp"
 #include "track_queue.hpp"
 #include "ui/ui_fsm.hpp"
@@ -35,6 +35,9 @@ namespace audio {
 
 [[maybe_unused]] static constexpr char kTag[] = "tracks";
 
+// How many tracks from an iterator to look up and append to the queue at once.
+static constexpr size_t kAppendBatchSize = 64;
+
 using Reason = QueueUpdate::Reason;
 
 RandomIterator::RandomIterator()
@@ -99,7 +102,7 @@ TrackQueue::TrackQueue(tasks::WorkerPool& bg_worker, database::Handle db)
     : mutex_(),
       bg_worker_(bg_worker),
       db_(db),
-      playlist_(".queue.playlist"),
+      playlist_(".queue"),
       position_(0),
       shuffle_(),
       repeat_(false),
@@ -107,16 +110,68 @@ TrackQueue::TrackQueue(tasks::WorkerPool& bg_worker, database::Handle db)
 
 auto TrackQueue::current() const -> TrackItem {
   const std::shared_lock<std::shared_mutex> lock(mutex_);
-  std::string val;
   if (opened_playlist_ && position_ < opened_playlist_->size()) {
-    val = opened_playlist_->value();
+    std::string val = opened_playlist_->value();
+    if (val.empty()) {
+      return {};
+    }
+    return val;
+  }
+  auto val = playlist_.value();
+  if (!val) {
+    return {};
+  }
+  if (std::holds_alternative<database::TrackId>(*val)) {
+    return std::get<database::TrackId>(*val);
+  }
+  return std::get<std::string>(*val);
+}
+
+auto TrackQueue::upcoming(size_t n) -> std::vector<TrackItem> {
+  const std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<TrackItem> out;
+  size_t total = totalSize();
+
+  if (shuffle_) {
+    // Step a copy of the shuffler, so that we get exactly the same picks that
+    // next() will.
+    RandomIterator it = *shuffle_;
+    while (out.size() < n) {
+      it.next();
+      size_t pos = it.current();
+      if (pos >= total) {
+        break;
+      }
+      out.push_back(itemAt(pos));
+    }
   } else {
-    val = playlist_.value();
+    for (size_t pos = position_ + 1; pos < total && out.size() < n; pos++) {
+      out.push_back(itemAt(pos));
+    }
   }
-  if (val.empty()) {
+
+  return out;
+}
+
+auto TrackQueue::itemAt(size_t position) -> TrackItem {
+  if (opened_playlist_) {
+    if (position < opened_playlist_->size()) {
+      auto val = opened_playlist_->valueAt(position);
+      if (!val) {
+        return {};
+      }
+      return *val;
+    }
+    position -= opened_playlist_->size();
+  }
+  auto val = playlist_.valueAt(position);
+  if (!val) {
     return {};
   }
-  return val;
+  if (std::holds_alternative<database::TrackId>(*val)) {
+    return std::get<database::TrackId>(*val);
+  }
+  return std::get<std::string>(*val);
 }
 
 auto TrackQueue::playFromPosition(const std::string& filepath,
@@ -156,7 +211,11 @@ auto TrackQueue::open() -> bool {
   // FIX ME: If playlist opening fails, should probably fall back to a vector of
   // tracks or something so that we're not necessarily always needing mounted
   // storage
-  return playlist_.open();
+  auto db = db_.lock();
+  if (!db) {
+    return false;
+  }
+  return playlist_.open(db->generation());
 }
 
 auto TrackQueue::close() -> void {
@@ -168,27 +227,54 @@ auto TrackQueue::close() -> void {
 
 auto TrackQueue::openPlaylist(const std::string& playlist_file, bool notify)
     -> bool {
-  opened_playlist_.emplace(playlist_file);
-  auto res = opened_playlist_->open();
+  auto playlist = std::make_shared<Playlist>(playlist_file);
+  {
+    // A background index build for the previous playlist may be checking
+    // opened_playlist_ concurrently.
+    const std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (opened_playlist_) {
+      opened_playlist_->close();
+    }
+    opened_playlist_ = playlist;
+  }
+  auto res = playlist->open();
   if (!res) {
     return false;
   }
-  updateShuffler(true);
+  if (!playlist->isIndexed()) {
+    if (notify) {
+      // Playback can begin from the first item straight away; the rest of the
+      // playlist is counted in the background.
+      bg_worker_.Post([=, this]() {
+        if (!playlist->buildIndex()) {
+          return;
+        }
+        {
+          const std::unique_lock<std::shared_mutex> lock(mutex_);
+          if (opened_playlist_ != playlist) {
+            return;
+          }
+          updateShuffler(false);
+        }
+        notifyChanged(false, Reason::kExplicitUpdate);
+      });
+    } else {
+      // We're restoring a saved queue, whose position may be anywhere within
+      // the playlist. Count the whole thing first so that the position maps
+      // to the right item.
+      playlist->buildIndex();
+    }
+  }
+  {
+    const std::unique_lock<std::shared_mutex> lock(mutex_);
+    updateShuffler(true);
+  }
   if (notify) {
     notifyChanged(true, Reason::kExplicitUpdate);
   }
   return true;
 }
 
-auto TrackQueue::getFilepath(database::TrackId id)
-    -> std::optional<std::string> {
-  auto db = db_.lock();
-  if (!db) {
-    return {};
-  }
-  return db->getTrackPath(id);
-}
-
 auto TrackQueue::append(Item i) -> void {
   bool was_queue_empty;
   bool current_changed;
@@ -201,10 +287,7 @@ auto TrackQueue::append(Item i) -> void {
   if (std::holds_alternative<database::TrackId>(i)) {
     {
       const std::unique_lock<std::shared_mutex> lock(mutex_);
-      auto filename = getFilepath(std::get<database::TrackId>(i)).value_or("");
-      if (!filename.empty()) {
-        playlist_.append(filename);
-      }
+      playlist_.append(std::get<database::TrackId>(i));
       updateShuffler(was_queue_empty);
     }
     notifyChanged(current_changed, Reason::kExplicitUpdate);
@@ -225,34 +308,38 @@ auto TrackQueue::append(Item i) -> void {
     bg_worker_.Dispatch<void>([=, this]() {
       database::TrackIterator it = std::get<database::TrackIterator>(i);
 
-      size_t next_update_at = 10;
+      std::vector<database::TrackId> ids;
+      ids.reserve(kAppendBatchSize);
       while (true) {
-        auto next = *it;
-        if (!next) {
+        ids.clear();
+        while (ids.size() < kAppendBatchSize) {
+          auto next = *it;
+          if (!next) {
+            break;
+          }
+          ids.push_back(*next);
+          it++;
+        }
+        if (ids.empty()) {
           break;
         }
-        // Keep this critical section small so that we're not blocking methods
-        // like current().
+
+        // Collect the whole batch before taking the lock, so that we're not
+        // blocking methods like current() whilst we read from the database.
         {
           const std::unique_lock<std::shared_mutex> lock(mutex_);
-          auto filename = getFilepath(*next).value_or("");
-          if (!filename.empty()) {
-            playlist_.append(filename);
-          }
+          playlist_.appendMany(ids);
         }
-        it++;
 
         // Appending very large iterators can take a while. Send out periodic
         // queue updates during them so that the user has an idea what's going
         // on.
-        if (!--next_update_at) {
-          next_update_at = util::sRandom->RangeInclusive(10, 20);
-          notifyChanged(false, Reason::kBulkLoadingUpdate);
-        }
+        notifyChanged(false, Reason::kBulkLoadingUpdate);
       }
 
       {
         const std::unique_lock<std::shared_mutex> lock(mutex_);
+        playlist_.sync();
         updateShuffler(was_queue_empty);
       }
       notifyChanged(current_changed, Reason::kExplicitUpdate);
@@ -347,7 +434,10 @@ auto TrackQueue::clear() -> void {
     const std::unique_lock<std::shared_mutex> lock(mutex_);
     position_ = 0;
     playlist_.clear();
-    opened_playlist_.reset();
+    if (opened_playlist_) {
+      opened_playlist_->close();
+      opened_playlist_.reset();
+    }
     if (shuffle_) {
       shuffle_->resize(0);
     }
@@ -430,8 +520,6 @@ auto TrackQueue::serialise() -> std::string {
                                  });
   }
 
-  playlist_.serialiseCache();
-
   return encoded.toString();
 }
 
@@ -72,6 +72,12 @@ class TrackQueue {
       std::variant<std::string, database::TrackId, std::monostate>;
   auto current() const -> TrackItem;
 
+  /*
+   * Returns up to the next `n` tracks that will be played after the current
+   * one, taking shuffling into account.
+   */
+  auto upcoming(size_t n) -> std::vector<TrackItem>;
+
   auto currentPosition() const -> size_t;
   auto currentPosition(size_t position) -> bool;
   auto totalSize() const -> size_t;
@@ -123,7 +129,7 @@ class TrackQueue {
  private:
   auto next(QueueUpdate::Reason r) -> void;
   auto goTo(size_t position) -> void;
-  auto getFilepath(database::TrackId id) -> std::optional<std::string>;
+  auto itemAt(size_t position) -> TrackItem;
 
   mutable std::shared_mutex mutex_;
 
@@ -131,7 +137,7 @@ class TrackQueue {
   database::Handle db_;
 
   MutablePlaylist playlist_;
-  std::optional<Playlist> opened_playlist_;
+  std::shared_ptr<Playlist> opened_playlist_;
 
   size_t position_;
 
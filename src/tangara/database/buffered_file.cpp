@@ -0,0 +1,165 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "database/buffered_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+#include "ff.h"
+
+#include "memory_resource.hpp"
+
+namespace database {
+
+[[maybe_unused]] static const char* kTag = "bufile";
+
+BufferedFile::BufferedFile(std::pmr::memory_resource* resource)
+    : file_(),
+      is_open_(false),
+      size_(0),
+      pos_(0),
+      alloc_(resource),
+      buffer_(nullptr),
+      buffer_start_(0),
+      buffer_len_(0) {}
+
+BufferedFile::~BufferedFile() {
+  if (is_open_) {
+    f_close(&file_);
+  }
+  if (buffer_) {
+    alloc_.deallocate(buffer_, kBufferSize);
+  }
+}
+
+auto BufferedFile::open(const std::string& path) -> bool {
+  if (is_open_ || f_open(&file_, path.c_str(), FA_READ) != FR_OK) {
+    return false;
+  }
+  is_open_ = true;
+  size_ = f_size(&file_);
+  pos_ = 0;
+  buffer_len_ = 0;
+  if (!buffer_) {
+    buffer_ = alloc_.allocate(kBufferSize);
+  }
+  return true;
+}
+
+auto BufferedFile::close() -> void {
+  if (is_open_) {
+    f_close(&file_);
+    is_open_ = false;
+  }
+}
+
+auto BufferedFile::read(void* dest, size_t len) -> int {
+  if (!is_open_) {
+    return -1;
+  }
+  std::byte* out = static_cast<std::byte*>(dest);
+  size_t total = 0;
+  while (total < len && pos_ < size_) {
+    if (pos_ < buffer_start_ || pos_ >= buffer_start_ + buffer_len_) {
+      if (!fill(pos_, len - total)) {
+        return total > 0 ? static_cast<int>(total) : -1;
+      }
+    }
+    size_t offset = pos_ - buffer_start_;
+    size_t chunk = std::min(len - total, buffer_len_ - offset);
+    std::memcpy(out + total, buffer_ + offset, chunk);
+    total += chunk;
+    pos_ += chunk;
+  }
+  return total;
+}
+
+auto BufferedFile::readLine(std::string& out) -> int {
+  out.clear();
+  if (!is_open_) {
+    return -1;
+  }
+  size_t total = 0;
+  while (pos_ < size_) {
+    if (pos_ < buffer_start_ || pos_ >= buffer_start_ + buffer_len_) {
+      if (!fill(pos_)) {
+        return -1;
+      }
+    }
+    size_t offset = pos_ - buffer_start_;
+    size_t avail = buffer_len_ - offset;
+    const char* start = reinterpret_cast<const char*>(buffer_ + offset);
+    const char* newline =
+        static_cast<const char*>(std::memchr(start, '\n', avail));
+    size_t len = newline ? newline - start : avail;
+    out.append(start, len);
+
+    size_t consumed = newline ? len + 1 : len;
+    total += consumed;
+    pos_ += consumed;
+    if (newline) {
+      break;
+    }
+  }
+  return total;
+}
+
+auto BufferedFile::rfind(char c, FSIZE_t before) -> std::optional<FSIZE_t> {
+  if (!is_open_) {
+    return {};
+  }
+  before = std::min(before, size_);
+  while (before > 0) {
+    FSIZE_t pos = before - 1;
+    if (pos < buffer_start_ || pos >= buffer_start_ + buffer_len_) {
+      if (!fill(pos)) {
+        return {};
+      }
+    }
+    for (size_t i = pos - buffer_start_ + 1; i > 0; i--) {
+      if (buffer_[i - 1] == static_cast<std::byte>(c)) {
+        return buffer_start_ + i - 1;
+      }
+    }
+    before = buffer_start_;
+  }
+  return {};
+}
+
+auto BufferedFile::seek(FSIZE_t pos) -> bool {
+  if (!is_open_ || pos > size_) {
+    return false;
+  }
+  // Seeks are free; the SD card is only touched when we read from somewhere
+  // that isn't already buffered.
+  pos_ = pos;
+  return true;
+}
+
+auto BufferedFile::fill(FSIZE_t pos, std::optional<size_t> len) -> bool {
+  FSIZE_t start = pos - (pos % kBufferSize);
+  // If the read finishes at the end of the file, then the bytes before it are
+  // unlikely to be wanted. Skip them, rather than reading a whole block to get
+  // at a short tail.
+  if (len && pos + *len >= size_) {
+    start = pos;
+  }
+  UINT to_read = std::min<FSIZE_t>(kBufferSize, size_ - start);
+  UINT bytes_read;
+  if (f_lseek(&file_, start) != FR_OK ||
+      f_read(&file_, buffer_, to_read, &bytes_read) != FR_OK) {
+    ESP_LOGW(kTag, "read failed at %llu", static_cast<uint64_t>(start));
+    buffer_len_ = 0;
+    return false;
+  }
+  buffer_start_ = start;
+  buffer_len_ = bytes_read;
+  return pos < buffer_start_ + buffer_len_;
+}
+
+}  // namespace database
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <string>
+
+#include "ff.h"
+
+#include "memory_resource.hpp"
+
+namespace database {
+
+/*
+ * Read-only handle to a file on the SD card, for parsers that make many small
+ * reads and seeks (e.g. walking ID3v2 frames or FLAC metadata blocks, or
+ * reading a playlist line by line).
+ *
+ * Reads are served from a single large buffer that is refilled on a miss. Fills
+ * are aligned to the buffer's size within the file, which keeps them aligned to
+ * cluster boundaries, so that each fill is one contiguous multi-sector read.
+ * Reads that run up to the end of the file (e.g. an ID3v1 tag, or the last Ogg
+ * page) only fill the bytes that were asked for.
+ */
+class BufferedFile {
+ public:
+  static constexpr size_t kBufferSize = 32 * 1024;
+
+  explicit BufferedFile(
+      std::pmr::memory_resource* = &memory::kDatabaseResource);
+  ~BufferedFile();
+
+  /* Opens the given file for reading. Returns false if this failed. */
+  auto open(const std::string& path) -> bool;
+  auto close() -> void;
+
+  /*
+   * Reads up to `len` bytes from the current position into `dest`, returning
+   * the number of bytes read. Returns 0 at the end of the file, or -1 if there
+   * was an error reading the file.
+   */
+  auto read(void* dest, size_t len) -> int;
+
+  /*
+   * Reads from the current position up to and including the next newline,
+   * placing the line (without its newline) into `out`. Lines may be any length.
+   * Returns the number of bytes consumed, 0 at the end of the file, or -1 if
+   * there was an error reading the file.
+   */
+  auto readLine(std::string& out) -> int;
+
+  /*
+   * Searches backwards from just before `before` for the given byte, returning
+   * its offset. Returns nothing if the byte wasn't found, or there was an error
+   * reading the file. Doesn't move the current position.
+   */
+  auto rfind(char c, FSIZE_t before) -> std::optional<FSIZE_t>;
+
+  /*
+   * Moves the current position. Seeking within the buffered region doesn't
+   * touch the SD card at all. Returns false if the position is out of range.
+   */
+  auto seek(FSIZE_t pos) -> bool;
+
+  auto tell() const -> FSIZE_t { return pos_; }
+  auto size() const -> FSIZE_t { return size_; }
+  auto eof() const -> bool { return pos_ >= size_; }
+
+  BufferedFile(const BufferedFile&) = delete;
+  BufferedFile& operator=(const BufferedFile&) = delete;
+
+ private:
+  /*
+   * Refills the buffer so that it contains `pos`. If given, `len` is how many
+   * bytes from `pos` onwards the caller wants.
+   */
+  auto fill(FSIZE_t pos, std::optional<size_t> len = {}) -> bool;
+
+  FIL file_;
+  bool is_open_;
+  FSIZE_t size_;
+  FSIZE_t pos_;
+
+  std::pmr::polymorphic_allocator<std::byte> alloc_;
+  std::byte* buffer_;
+  FSIZE_t buffer_start_;
+  size_t buffer_len_;
+};
+
+}  // namespace database
@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <cctype>
 #include <cstdint>
+#include <cstdlib>
 #include <functional>
 #include <iomanip>
 #include <iostream>
@@ -17,11 +18,13 @@
 #include <optional>
 #include <sstream>
 #include <string>
+#include <unordered_set>
 #include <variant>
 
 #include "cppbor.h"
 #include "cppbor_parse.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "esp_timer.h"
 #include "ff.h"
 #include "freertos/projdefs.h"
@@ -34,12 +37,14 @@
 #include "leveldb/status.h"
 #include "leveldb/write_batch.h"
 
+#include "arena.hpp"
 #include "collation.hpp"
 #include "database.hpp"
 #include "database/db_events.hpp"
 #include "database/env_esp.hpp"
 #include "database/index.hpp"
 #include "database/records.hpp"
+#include "database/search.hpp"
 #include "database/tag_parser.hpp"
 #include "database/track.hpp"
 #include "database/track_finder.hpp"
@@ -58,9 +63,21 @@ static const char kDbPath[] = "/.tangara-db";
 static const char kKeyDbVersion[] = "schema_version";
 static const char kKeyCustom[] = "U\0";
 static const char kKeyCollator[] = "collator";
+static const char kKeySearchIndex[] = "search_index";
+static const char kKeyGeneration[] = "generation";
+
+// Stored under kKeySearchIndex once every track has been added to the search
+// index. Databases from before the search index existed lack this key, and
+// are indexed in the background.
+static const char kSearchIndexVersion[] = "1";
 
 static constexpr size_t kMaxParallelism = 2;
 
+// The number of records to accumulate before writing them out, when building
+// or deleting a whole index in one go.
+static constexpr size_t kIndexTracksPerBatch = 16;
+static constexpr size_t kIndexKeysPerBatch = 256;
+
 static std::atomic<bool> sIsDbOpen(false);
 
 using std::placeholders::_1;
@@ -90,6 +107,13 @@ static auto CreateNewDatabase(leveldb::Options& options, locale::ICollator& col)
     delete db;
     return nullptr;
   }
+  // There are no tracks yet, so the search index is trivially complete.
+  status =
+      db->Put(leveldb::WriteOptions{}, kKeySearchIndex, kSearchIndexVersion);
+  if (!status.ok()) {
+    delete db;
+    return nullptr;
+  }
   return db;
 }
 
@@ -193,10 +217,29 @@ Database::Database(leveldb::DB* db,
           kMaxParallelism,
           std::bind(&Database::processCandidateCallback, this, _1, _2),
           std::bind(&Database::indexingCompleteCallback, this)),
+      bg_worker_(pool),
       tag_parser_(tag_parser),
       collator_(collator),
-      is_updating_(false) {
+      is_updating_(false),
+      is_update_pending_(false),
+      is_search_index_pending_(false),
+      generation_(0) {
+  dbLoadGeneration();
   dbCalculateNextTrackId();
+  dbLoadIndexes();
+
+  std::string search_version;
+  if (!db_->Get(leveldb::ReadOptions{}, kKeySearchIndex, &search_version)
+           .ok() ||
+      search_version != kSearchIndexVersion) {
+    is_search_index_pending_ = true;
+  }
+
+  // Finish off any index changes that were interrupted by a restart.
+  if (hasPendingIndexChanges()) {
+    bg_worker_.Post([this]() { applyIndexChanges(); },
+                    tasks::WorkPriority::kLow);
+  }
 }
 
 Database::~Database() {
@@ -213,6 +256,10 @@ auto Database::schemaVersion() -> std::string {
   return std::to_string(kCurrentDbVersion);
 }
 
+auto Database::generation() -> uint32_t {
+  return generation_;
+}
+
 auto Database::sizeOnDiskBytes() -> size_t {
   FF_DIR dir;
   FRESULT res = f_opendir(&dir, kDbPath);
@@ -271,6 +318,14 @@ auto Database::getTrack(TrackId id) -> std::shared_ptr<Track> {
   return std::make_shared<Track>(data, tags);
 }
 
+auto Database::getTrackData(TrackId id) -> std::shared_ptr<TrackData> {
+  std::shared_ptr<TrackData> data = dbGetTrackData(leveldb::ReadOptions(), id);
+  if (!data || data->is_tombstoned) {
+    return {};
+  }
+  return data;
+}
+
 auto Database::getTrackID(std::string path) -> std::optional<TrackId> {
   std::string raw_data;
   if (!db_->Get(leveldb::ReadOptions(), EncodePathKey(path), &raw_data).ok()) {
@@ -290,11 +345,73 @@ auto Database::setTrackData(TrackId id, const TrackData& data) -> void {
 }
 
 auto Database::getIndexes() -> std::vector<IndexInfo> {
-  // TODO(jacqueline): This probably needs to be async? When we have runtime
-  // configurable indexes, they will need to come from somewhere.
-  return {
-      kAllTracks, kAllAlbums, kAlbumsByArtist, kTracksByGenre, kPodcasts, kAudiobooks
-  };
+  std::lock_guard<std::mutex> lock{indexes_mutex_};
+  std::vector<IndexInfo> out;
+  for (const auto& entry : indexes_) {
+    if (entry.state == IndexState::kReady) {
+      out.push_back(entry.info);
+    }
+  }
+  return out;
+}
+
+auto Database::addIndex(MediaType type,
+                        std::string_view name,
+                        std::span<const Tag> components)
+    -> std::optional<IndexId> {
+  if (components.empty()) {
+    return {};
+  }
+
+  std::optional<IndexId> id;
+  {
+    std::lock_guard<std::mutex> lock{indexes_mutex_};
+    // Ids of removed indexes aren't reused until their records are gone, so
+    // that old records can never be mistaken for part of the new index.
+    for (IndexId candidate = 1; candidate < UINT8_MAX; candidate++) {
+      if (std::none_of(indexes_.begin(), indexes_.end(),
+                       [&](const auto& e) { return e.info.id == candidate; })) {
+        id = candidate;
+        break;
+      }
+    }
+    if (!id) {
+      ESP_LOGW(kTag, "no free index ids");
+      return {};
+    }
+
+    IndexInfo info{
+        .id = *id,
+        .type = type,
+        .name = {name.data(), name.size(), &memory::kDatabaseResource},
+        .components = {components.begin(), components.end()},
+    };
+    dbPutIndexInfo(info, IndexState::kBuilding);
+    indexes_.push_back({info, IndexState::kBuilding});
+    ESP_LOGI(kTag, "added index %u", *id);
+  }
+
+  bg_worker_.Post([this]() { applyIndexChanges(); },
+                  tasks::WorkPriority::kLow);
+  return id;
+}
+
+auto Database::removeIndex(IndexId id) -> bool {
+  {
+    std::lock_guard<std::mutex> lock{indexes_mutex_};
+    auto entry = std::find_if(indexes_.begin(), indexes_.end(),
+                              [&](const auto& e) { return e.info.id == id; });
+    if (entry == indexes_.end() || entry->state == IndexState::kRemoving) {
+      return false;
+    }
+    entry->state = IndexState::kRemoving;
+    dbPutIndexInfo(entry->info, entry->state);
+    ESP_LOGI(kTag, "removing index %u", id);
+  }
+
+  bg_worker_.Post([this]() { applyIndexChanges(); },
+                  tasks::WorkPriority::kLow);
+  return true;
 }
 
 Database::UpdateTracker::UpdateTracker()
@@ -344,9 +461,14 @@ auto Database::UpdateTracker::onTrackAdded() -> void {
 }
 
 auto Database::updateIndexes() -> void {
+  // Mark this update as wanted before checking whether anything else is
+  // underway. Whatever is underway checks this flag only after it's finished,
+  // so the request can't be missed in between.
+  is_update_pending_ = true;
   if (is_updating_.exchange(true)) {
     return;
   }
+  is_update_pending_ = false;
   update_tracker_ = std::make_unique<UpdateTracker>();
 
   leveldb::ReadOptions read_options;
@@ -381,11 +503,13 @@ auto Database::updateIndexes() -> void {
       if (res == FR_OK) {
         modified_at = {info.fdate, info.ftime};
       }
-      if (modified_at == track->modified_at) {
+      // Tracks indexed before we recorded their audio properties need their
+      // tags re-reading, even if they haven't been modified.
+      bool is_modified = modified_at != track->modified_at;
+      if (!is_modified && track->audio) {
         continue;
-      } else {
-        track->modified_at = modified_at;
       }
+      track->modified_at = modified_at;
 
       std::shared_ptr<TrackTags> tags = tag_parser_.ReadAndParseTags(
           {track->filepath.data(), track->filepath.size()});
@@ -395,12 +519,11 @@ auto Database::updateIndexes() -> void {
         // this record.
         ESP_LOGI(kTag, "entombing missing #%lx", track->id);
 
-        // Remove the indexes first, so that interrupted operations don't leave
-        // dangling index records.
-        dbRemoveIndexes(track);
-
-        // Do the rest of the tombstoning as one atomic write.
+        // Tombstone the track and remove its index records as one atomic
+        // write, so that interrupted operations don't leave dangling index
+        // records.
         leveldb::WriteBatch batch;
+        dbRemoveIndexes(track, batch);
         track->is_tombstoned = true;
         batch.Put(EncodeDataKey(track->id), EncodeDataValue(*track));
         batch.Delete(EncodePathKey(track->filepath));
@@ -412,6 +535,23 @@ auto Database::updateIndexes() -> void {
       // At this point, we know that the track still exists in its original
       // location. All that's left to do is update any metadata about it.
 
+      bool data_changed = is_modified;
+
+      // If the file has been modified, then any loudness info we have for it
+      // may be stale. Prefer the file's own gain tags, and otherwise allow it
+      // to be analysed again.
+      auto new_gain = tags->preferredGain();
+      if (is_modified &&
+          (new_gain != track->replay_gain || track->is_loudness_analysed)) {
+        track->replay_gain = new_gain;
+        track->is_loudness_analysed = false;
+      }
+
+      if (track->audio != tags->audio()) {
+        track->audio = tags->audio();
+        data_changed = true;
+      }
+
       auto new_type = calculateMediaType(*tags, track->filepath);
       uint64_t new_hash = tags->Hash();
       if (new_hash != track->tags_hash || new_type != track->type) {
@@ -421,12 +561,11 @@ auto Database::updateIndexes() -> void {
         ESP_LOGI(kTag, "updating hash (%llx -> %llx)", track->tags_hash,
                  new_hash);
 
-        // Again, we remove the old index records first so has to avoid
-        // dangling references.
-        dbRemoveIndexes(track);
-
-        // Atomically correct the hash + create the new index records.
+        // Atomically remove the old index records, correct the hash, and
+        // create the new index records. The removals must come first in the
+        // batch, since many of the new records will share keys with the old.
         leveldb::WriteBatch batch;
+        dbRemoveIndexes(track, batch);
         track->tags_hash = new_hash;
         dbIngestTagHashes(*tags, track->individual_tag_hashes, batch);
 
@@ -435,6 +574,9 @@ auto Database::updateIndexes() -> void {
         batch.Put(EncodeDataKey(track->id), EncodeDataValue(*track));
         batch.Put(EncodeHashKey(new_hash), EncodeHashValue(track->id));
         db_->Write(leveldb::WriteOptions(), &batch);
+      } else if (data_changed) {
+        db_->Put(leveldb::WriteOptions(), EncodeDataKey(track->id),
+                 EncodeDataValue(*track));
       }
     }
   }
@@ -503,6 +645,14 @@ auto Database::processCandidateCallback(FILINFO& info, std::string_view path)
   data->is_tombstoned = false;
   data->type = calculateMediaType(*tags, path);
 
+  // Gain tags in the file always take precedence. If there aren't any, then
+  // keep any gain that a previous analysis of this track came up with.
+  auto gain = tags->preferredGain();
+  if (gain) {
+    data->replay_gain = gain;
+  }
+  data->audio = tags->audio();
+
   // Apply all the actual database changes as one atomic batch. This makes
   // the whole 'new track' operation atomic, and also reduces the amount of
   // lock contention when adding many tracks at once.
@@ -519,13 +669,131 @@ auto Database::processCandidateCallback(FILINFO& info, std::string_view path)
 
 auto Database::indexingCompleteCallback() -> void {
   update_tracker_.reset();
+  // Any updates asked for during this one are covered by it.
+  is_update_pending_ = false;
   is_updating_ = false;
+
+  // Index changes made during the update were deferred until it finished.
+  if (hasPendingIndexChanges()) {
+    bg_worker_.Post([this]() { applyIndexChanges(); },
+                    tasks::WorkPriority::kLow);
+  }
 }
 
 auto Database::isUpdating() -> bool {
   return is_updating_;
 }
 
+auto Database::search(std::string_view query, size_t limit)
+    -> std::vector<TrackId> {
+  std::vector<TrackId> results;
+  auto tokens = SearchTokens(query);
+  if (tokens.empty() || limit == 0) {
+    return results;
+  }
+
+  // Every match must begin a word with each token, so each token's posting
+  // list is the set of tracks stored under that prefix. Tracks are found by
+  // walking all of the lists in lockstep, seeking each one forward to the
+  // largest id seen so far, so only a small part of each list is ever read.
+  struct PostingList {
+    std::string prefix;
+    std::unique_ptr<leveldb::Iterator> it;
+  };
+  std::vector<PostingList> lists;
+
+  // Tokens longer than the indexed prefixes are looked up by their prefix,
+  // and then checked against each matching track's tags.
+  bool needs_check = false;
+  for (const auto& token : tokens) {
+    auto indexed = SearchIndexPrefix(token);
+    needs_check |= indexed.size() != token.size();
+    std::string prefix = EncodeSearchPrefix(indexed);
+    if (std::none_of(lists.begin(), lists.end(),
+                     [&](const auto& l) { return l.prefix == prefix; })) {
+      lists.push_back({std::move(prefix), {}});
+    }
+  }
+
+  // Longer prefixes tend to have shorter lists, so let those lead.
+  std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) {
+    return a.prefix.size() > b.prefix.size();
+  });
+
+  leveldb::ReadOptions read_options;
+  read_options.snapshot = db_->GetSnapshot();
+  for (auto& list : lists) {
+    list.it.reset(db_->NewIterator(read_options));
+    list.it->Seek(list.prefix);
+  }
+
+  auto current = [](PostingList& list) -> std::optional<TrackId> {
+    if (!list.it->Valid() || !list.it->key().starts_with(list.prefix)) {
+      return {};
+    }
+    return ParseSearchKey(list.it->key(), list.prefix.size());
+  };
+
+  std::optional<TrackId> candidate = current(lists.front());
+  while (candidate && results.size() < limit) {
+    bool all_match = true;
+    for (auto& list : lists) {
+      auto id = current(list);
+      if (id && *id < *candidate) {
+        list.it->Seek(list.prefix + TrackIdToBytes(*candidate));
+        id = current(list);
+      }
+      if (!id || *id != *candidate) {
+        // Either this list is exhausted (in which case we're done), or the
+        // candidate isn't in it, so skip ahead to the next track that is.
+        candidate = id;
+        all_match = false;
+        break;
+      }
+    }
+    if (!all_match) {
+      continue;
+    }
+
+    if (needs_check) {
+      auto data = dbGetTrackData(read_options, *candidate);
+      auto tags = data ? dbRecoverTagsFromHashes(data->individual_tag_hashes)
+                       : nullptr;
+      if (tags && MatchesSearch(tokens, *data, *tags)) {
+        results.push_back(*candidate);
+      }
+    } else {
+      results.push_back(*candidate);
+    }
+
+    lists.front().it->Next();
+    candidate = current(lists.front());
+  }
+
+  lists.clear();
+  db_->ReleaseSnapshot(read_options.snapshot);
+  return results;
+}
+
+auto Database::nextTrackNeedingAnalysis(TrackId after)
+    -> std::shared_ptr<TrackData> {
+  leveldb::ReadOptions read_options;
+  read_options.fill_cache = false;
+
+  std::unique_ptr<leveldb::Iterator> it{db_->NewIterator(read_options)};
+  std::string prefix = EncodeDataPrefix();
+  for (it->Seek(EncodeDataKey(after + 1));
+       it->Valid() && it->key().starts_with(prefix); it->Next()) {
+    std::shared_ptr<TrackData> track = ParseDataValue(it->value());
+    if (!track || track->is_tombstoned || track->replay_gain ||
+        track->is_loudness_analysed) {
+      continue;
+    }
+    return track;
+  }
+  return {};
+}
+
 // FIXME: Make these media paths configurable.
 static constexpr char kMusicMediaPath[] = "/Music/";
 static constexpr char kPodcastMediaPath[] = "/Podcasts/";
@@ -571,6 +839,232 @@ auto Database::calculateMediaType(TrackTags& tags, std::string_view path)
   return MediaType::kUnknown;
 }
 
+auto Database::liveIndexes() -> std::vector<IndexInfo> {
+  std::lock_guard<std::mutex> lock{indexes_mutex_};
+  std::vector<IndexInfo> out;
+  for (const auto& entry : indexes_) {
+    if (entry.state != IndexState::kRemoving) {
+      out.push_back(entry.info);
+    }
+  }
+  return out;
+}
+
+auto Database::hasPendingIndexChanges() -> bool {
+  if (is_search_index_pending_) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock{indexes_mutex_};
+  return std::any_of(indexes_.begin(), indexes_.end(), [](const auto& e) {
+    return e.state != IndexState::kReady;
+  });
+}
+
+auto Database::applyIndexChanges() -> void {
+  // Index changes share the updating flag with full updates, so that the two
+  // never race. If an update is in progress, we'll be called again when it
+  // finishes.
+  if (is_updating_.exchange(true)) {
+    return;
+  }
+  events::Ui().Dispatch(event::UpdateStarted{});
+  events::System().Dispatch(event::UpdateStarted{});
+
+  if (is_search_index_pending_) {
+    ESP_LOGI(kTag, "building search index");
+    dbBuildSearchIndex();
+    is_search_index_pending_ = false;
+  }
+
+  for (;;) {
+    std::optional<IndexEntry> next;
+    {
+      std::lock_guard<std::mutex> lock{indexes_mutex_};
+      for (const auto& entry : indexes_) {
+        if (entry.state != IndexState::kReady) {
+          next = entry;
+          break;
+        }
+      }
+    }
+    if (!next) {
+      break;
+    }
+
+    uint64_t start_time = esp_timer_get_time();
+    IndexId id = next->info.id;
+    if (next->state == IndexState::kRemoving) {
+      dbDeleteIndex(id);
+
+      std::lock_guard<std::mutex> lock{indexes_mutex_};
+      std::erase_if(indexes_, [&](const auto& e) { return e.info.id == id; });
+    } else {
+      dbBuildIndex(next->info);
+
+      // The index may have been removed whilst we were building it, in which
+      // case it gets deleted on the next iteration instead.
+      std::lock_guard<std::mutex> lock{indexes_mutex_};
+      for (auto& entry : indexes_) {
+        if (entry.info.id == id && entry.state == IndexState::kBuilding) {
+          entry.state = IndexState::kReady;
+          dbPutIndexInfo(entry.info, entry.state);
+        }
+      }
+    }
+    ESP_LOGI(kTag, "index %u changes applied in %llu ms", id,
+             (esp_timer_get_time() - start_time) / 1000);
+  }
+
+  is_updating_ = false;
+  events::Ui().Dispatch(event::UpdateFinished{});
+  events::System().Dispatch(event::UpdateFinished{});
+
+  // Updates asked for whilst we were busy were deferred until now.
+  if (is_update_pending_) {
+    bg_worker_.Post([this]() { updateIndexes(); }, tasks::WorkPriority::kLow);
+  }
+}
+
+auto Database::dbLoadGeneration() -> void {
+  std::string raw;
+  if (db_->Get(leveldb::ReadOptions{}, kKeyGeneration, &raw).ok()) {
+    char* end;
+    unsigned long val = std::strtoul(raw.c_str(), &end, 10);
+    if (!raw.empty() && *end == '\0') {
+      generation_ = val;
+      return;
+    }
+  }
+
+  // Either this database is brand new, or it predates generations. Either way,
+  // nothing outside of it can be holding its track ids yet.
+  generation_ = esp_random();
+  db_->Put(leveldb::WriteOptions{}, kKeyGeneration,
+           std::to_string(generation_));
+}
+
+auto Database::dbLoadIndexes() -> void {
+  std::lock_guard<std::mutex> lock{indexes_mutex_};
+  indexes_.clear();
+
+  const std::string prefix = EncodeIndexInfoPrefix();
+  std::unique_ptr<leveldb::Iterator> it{
+      db_->NewIterator(leveldb::ReadOptions{})};
+  for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix);
+       it->Next()) {
+    auto parsed = ParseIndexInfoValue(it->value());
+    if (!parsed) {
+      ESP_LOGW(kTag, "skipping unparseable index definition");
+      continue;
+    }
+    indexes_.push_back({parsed->first, parsed->second});
+  }
+
+  // Databases created before indexes could be defined at runtime, as well as
+  // brand new databases, don't have any definitions yet. The default indexes
+  // were (or will be) built as tracks are added, so they're already complete.
+  if (indexes_.empty()) {
+    for (const auto& info : {kAllTracks, kAllAlbums, kAlbumsByArtist,
+                             kTracksByGenre, kPodcasts, kAudiobooks}) {
+      dbPutIndexInfo(info, IndexState::kReady);
+      indexes_.push_back({info, IndexState::kReady});
+    }
+  }
+}
+
+auto Database::dbPutIndexInfo(const IndexInfo& info, IndexState state)
+    -> void {
+  auto res = db_->Put(leveldb::WriteOptions{}, EncodeIndexInfoKey(info.id),
+                      EncodeIndexInfoValue(info, state));
+  if (!res.ok()) {
+    ESP_LOGW(kTag, "failed to store index %u", info.id);
+  }
+}
+
+auto Database::dbBuildIndex(const IndexInfo& info) -> void {
+  dbIndexExistingTracks(info.type, [&](const TrackData& track,
+                                       const TrackTags& tags,
+                                       leveldb::WriteBatch& batch) {
+    memory::ArenaScope arena;
+    IndexContext context{collator_, track, tags, arena.resource()};
+    for (const auto& entry : context.index(info)) {
+      batch.Put(EncodeIndexKey(entry.first),
+                {entry.second.data(), entry.second.size()});
+    }
+  });
+}
+
+auto Database::dbBuildSearchIndex() -> void {
+  dbIndexExistingTracks({}, [&](const TrackData& track, const TrackTags& tags,
+                                leveldb::WriteBatch& batch) {
+    for (const auto& prefix : SearchPrefixes(track, tags)) {
+      batch.Put(EncodeSearchKey(prefix, track.id), "");
+    }
+  });
+  db_->Put(leveldb::WriteOptions{}, kKeySearchIndex, kSearchIndexVersion);
+}
+
+auto Database::dbIndexExistingTracks(
+    std::optional<MediaType> type,
+    const std::function<void(const TrackData&,
+                             const TrackTags&,
+                             leveldb::WriteBatch&)>& fn) -> void {
+  // Only the stored track data and tag hashes are needed to generate a track's
+  // index records, so building an index never touches the tracks themselves.
+  leveldb::ReadOptions read_options;
+  read_options.fill_cache = false;
+
+  const std::string prefix = EncodeDataPrefix();
+  std::unique_ptr<leveldb::Iterator> it{db_->NewIterator(read_options)};
+
+  leveldb::WriteBatch batch;
+  size_t tracks_in_batch = 0;
+  for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix);
+       it->Next()) {
+    auto track = ParseDataValue(it->value());
+    if (!track || track->is_tombstoned || (type && track->type != *type)) {
+      continue;
+    }
+    auto tags = dbRecoverTagsFromHashes(track->individual_tag_hashes);
+    if (!tags) {
+      continue;
+    }
+
+    fn(*track, *tags, batch);
+
+    if (++tracks_in_batch >= kIndexTracksPerBatch) {
+      db_->Write(leveldb::WriteOptions{}, &batch);
+      batch.Clear();
+      tracks_in_batch = 0;
+    }
+  }
+  db_->Write(leveldb::WriteOptions{}, &batch);
+}
+
+auto Database::dbDeleteIndex(IndexId id) -> void {
+  leveldb::ReadOptions read_options;
+  read_options.fill_cache = false;
+
+  const std::string prefix = EncodeIndexIdPrefix(id);
+  std::unique_ptr<leveldb::Iterator> it{db_->NewIterator(read_options)};
+
+  leveldb::WriteBatch batch;
+  size_t keys_in_batch = 0;
+  for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix);
+       it->Next()) {
+    batch.Delete(it->key());
+    if (++keys_in_batch >= kIndexKeysPerBatch) {
+      db_->Write(leveldb::WriteOptions{}, &batch);
+      batch.Clear();
+      keys_in_batch = 0;
+    }
+  }
+  // The definition goes last, so that an interrupted removal is resumed on the
+  // next boot.
+  batch.Delete(EncodeIndexInfoKey(id));
+  db_->Write(leveldb::WriteOptions{}, &batch);
+}
+
 auto Database::dbCalculateNextTrackId() -> void {
   std::unique_ptr<leveldb::Iterator> it{
       db_->NewIterator(leveldb::ReadOptions())};
@@ -631,44 +1125,66 @@ auto Database::dbCreateIndexesForTrack(const Track& track,
 auto Database::dbCreateIndexesForTrack(const TrackData& data,
                                        const TrackTags& tags,
                                        leveldb::WriteBatch& batch) -> void {
-  for (const IndexInfo& index : getIndexes()) {
-    auto entries = Index(collator_, index, data, tags);
+  memory::ArenaScope arena;
+  IndexContext context{collator_, data, tags, arena.resource()};
+  for (const IndexInfo& index : liveIndexes()) {
+    auto entries = context.index(index);
     for (const auto& it : entries) {
       batch.Put(EncodeIndexKey(it.first), {it.second.data(), it.second.size()});
     }
   }
+  for (const auto& prefix : SearchPrefixes(data, tags)) {
+    batch.Put(EncodeSearchKey(prefix, data.id), "");
+  }
 }
 
-auto Database::dbRemoveIndexes(std::shared_ptr<TrackData> data) -> void {
+auto Database::dbRemoveIndexes(std::shared_ptr<TrackData> data,
+                               leveldb::WriteBatch& batch) -> void {
   auto tags = dbRecoverTagsFromHashes(data->individual_tag_hashes);
   if (!tags) {
     return;
   }
-  for (const IndexInfo& index : getIndexes()) {
-    auto entries = Index(collator_, index, *data, *tags);
-    for (auto it = entries.rbegin(); it != entries.rend(); it++) {
-      auto key = EncodeIndexKey(it->first);
-      auto status = db_->Delete(leveldb::WriteOptions{}, key);
-      if (!status.ok()) {
-        return;
-      }
 
-      std::unique_ptr<leveldb::Iterator> cursor{db_->NewIterator({})};
-      cursor->Seek(key);
-      cursor->Prev();
-
-      auto prev_key = ParseIndexKey(cursor->key());
-      if (prev_key && prev_key->header == it->first.header) {
-        break;
+  // All deletions go into the caller's batch, so the iterator below still sees
+  // this track's own records. We keep track of what we've deleted so far in
+  // order to see past them.
+  std::unique_ptr<leveldb::Iterator> cursor{db_->NewIterator({})};
+  std::unordered_set<std::string> deleted;
+
+  // Returns whether there are any records under the given header that aren't
+  // being deleted.
+  auto has_other_records = [&](const IndexKey::Header& header) {
+    const std::string prefix = EncodeIndexPrefix(header);
+    for (cursor->Seek(prefix);
+         cursor->Valid() && cursor->key().starts_with(prefix);
+         cursor->Next()) {
+      if (!deleted.contains(cursor->key().ToString())) {
+        return true;
       }
+    }
+    return false;
+  };
 
-      cursor->Next();
-      auto next_key = ParseIndexKey(cursor->key());
-      if (next_key && next_key->header == it->first.header) {
-        break;
+  memory::ArenaScope arena;
+  IndexContext context{collator_, *data, *tags, arena.resource()};
+  for (const IndexInfo& index : liveIndexes()) {
+    // Records are produced parent-first, so walking them backwards visits
+    // every branch's children before the branch itself.
+    auto entries = context.index(index);
+    for (auto it = entries.rbegin(); it != entries.rend(); it++) {
+      const IndexKey& key = it->first;
+      // Branch records are only removed once nothing is left beneath them.
+      if (!key.track && has_other_records(ExpandHeader(key.header, key.item))) {
+        continue;
       }
+      auto encoded = EncodeIndexKey(key);
+      batch.Delete(encoded);
+      deleted.insert(std::move(encoded));
     }
   }
+  for (const auto& prefix : SearchPrefixes(*data, *tags)) {
+    batch.Delete(EncodeSearchKey(prefix, data->id));
+  }
 }
 
 auto Database::dbIngestTagHashes(const TrackTags& tags,
@@ -729,7 +1245,7 @@ auto Database::getRecord(const SearchKey& c)
   }
 
   return std::make_pair(std::pmr::string{it->key().data(), it->key().size(),
-                                         &memory::kSpiRamResource},
+                                         &memory::kDatabaseResource},
                         Record{*key, it->value()});
 }
 
@@ -766,7 +1282,7 @@ auto SearchKey::startKey() const -> std::string_view {
 }
 
 Record::Record(const IndexKey& key, const leveldb::Slice& t)
-    : text_(t.data(), t.size(), &memory::kSpiRamResource) {
+    : text_(t.data(), t.size(), &memory::kDatabaseResource) {
   if (key.track) {
     contents_ = *key.track;
   } else {
@@ -795,7 +1311,7 @@ Iterator::Iterator(std::shared_ptr<Database> db, const IndexKey::Header& header)
     : db_(db), key_{}, current_() {
   std::string prefix = EncodeIndexPrefix(header);
   key_ = {
-      .prefix = {prefix.data(), prefix.size(), &memory::kSpiRamResource},
+      .prefix = {prefix.data(), prefix.size(), &memory::kDatabaseResource},
       .key = {},
       .offset = -1,
   };
@@ -9,9 +9,12 @@
 #include <stdint.h>
 #include <sys/_stdint.h>
 #include <cstdint>
+#include <functional>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <stack>
 #include <string>
 #include <string_view>
@@ -38,7 +41,7 @@
 
 namespace database {
 
-const uint8_t kCurrentDbVersion = 8;
+const uint8_t kCurrentDbVersion = 9;
 
 struct SearchKey;
 class Record;
@@ -69,6 +72,14 @@ class Database {
 
   auto schemaVersion() -> std::string;
 
+  /*
+   * Returns a value that's picked at random when the database is created.
+   * Track ids are only meaningful within the same generation; anything that
+   * stores them outside of the database should also store this, and discard
+   * the ids if it changes.
+   */
+  auto generation() -> uint32_t;
+
   auto sizeOnDiskBytes() -> size_t;
 
   /* Adds an arbitrary record to the database. */
@@ -79,14 +90,51 @@ class Database {
 
   auto getTrackPath(TrackId id) -> std::optional<std::string>;
   auto getTrack(TrackId id) -> std::shared_ptr<Track>;
+  /*
+   * Returns only the stored data for the given track, without reading its tags
+   * from disk. Prefer this to `getTrack` for bulk lookups, such as totalling up
+   * the durations of a list of tracks.
+   */
+  auto getTrackData(TrackId id) -> std::shared_ptr<TrackData>;
   auto getTrackID(std::string path) -> std::optional<TrackId>;
 
   auto setTrackData(TrackId id, const TrackData& data) -> void;
 
+  /* Returns every index that is ready to be browsed. */
   auto getIndexes() -> std::vector<IndexInfo>;
+
+  /*
+   * Defines a new index, and begins building it in the background from the
+   * tracks already in the database. The new index isn't returned by
+   * `getIndexes` until it is complete. Returns the new index's id, or nullopt
+   * if the index could not be created.
+   */
+  auto addIndex(MediaType type,
+                std::string_view name,
+                std::span<const Tag> components) -> std::optional<IndexId>;
+
+  /*
+   * Removes an index, and deletes its records in the background. Returns false
+   * if there was no such index.
+   */
+  auto removeIndex(IndexId) -> bool;
+
   auto updateIndexes() -> void;
   auto isUpdating() -> bool;
 
+  /*
+   * Returns up to `limit` tracks whose title, artist, or album contain a word
+   * beginning with each word of the query, in order of track id. This is
+   * intended to be called again as each character of a query is typed.
+   */
+  auto search(std::string_view query, size_t limit) -> std::vector<TrackId>;
+
+  /*
+   * Returns the data for the first track with an id greater than `after` that
+   * has no loudness information, and that hasn't already been analysed.
+   */
+  auto nextTrackNeedingAnalysis(TrackId after) -> std::shared_ptr<TrackData>;
+
   // Cannot be copied or moved.
   Database(const Database&) = delete;
   Database& operator=(const Database&) = delete;
@@ -102,9 +150,18 @@ class Database {
   TrackFinder track_finder_;
 
   // Not owned.
+  tasks::WorkerPool& bg_worker_;
   ITagParser& tag_parser_;
   locale::ICollator& collator_;
 
+  struct IndexEntry {
+    IndexInfo info;
+    IndexState state;
+  };
+
+  std::mutex indexes_mutex_;
+  std::vector<IndexEntry> indexes_;
+
   /* Internal utility for tracking a currently in-progress index update. */
   class UpdateTracker {
    public:
@@ -123,8 +180,12 @@ class Database {
   };
 
   std::atomic<bool> is_updating_;
+  std::atomic<bool> is_update_pending_;
+  std::atomic<bool> is_search_index_pending_;
   std::unique_ptr<UpdateTracker> update_tracker_;
 
+  uint32_t generation_;
+
   std::atomic<TrackId> next_track_id_;
 
   Database(leveldb::DB* db,
@@ -137,6 +198,23 @@ class Database {
   auto indexingCompleteCallback() -> void;
   auto calculateMediaType(TrackTags&, std::string_view) -> MediaType;
 
+  /* Returns every index that new tracks should be added to. */
+  auto liveIndexes() -> std::vector<IndexInfo>;
+  auto hasPendingIndexChanges() -> bool;
+  auto applyIndexChanges() -> void;
+
+  auto dbLoadGeneration() -> void;
+  auto dbLoadIndexes() -> void;
+  auto dbPutIndexInfo(const IndexInfo&, IndexState) -> void;
+  auto dbBuildIndex(const IndexInfo&) -> void;
+  auto dbBuildSearchIndex() -> void;
+  auto dbIndexExistingTracks(
+      std::optional<MediaType> type,
+      const std::function<void(const TrackData&,
+                               const TrackTags&,
+                               leveldb::WriteBatch&)>&) -> void;
+  auto dbDeleteIndex(IndexId) -> void;
+
   auto dbCalculateNextTrackId() -> void;
   auto dbMintNewTrackId() -> TrackId;
 
@@ -148,7 +226,8 @@ class Database {
                                const TrackTags&,
                                leveldb::WriteBatch&) -> void;
 
-  auto dbRemoveIndexes(std::shared_ptr<TrackData>) -> void;
+  auto dbRemoveIndexes(std::shared_ptr<TrackData>, leveldb::WriteBatch&)
+      -> void;
 
   auto dbIngestTagHashes(const TrackTags&,
                          std::pmr::unordered_map<Tag, uint64_t>&,
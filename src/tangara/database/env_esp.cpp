@@ -471,7 +471,10 @@ void EspEnv::Schedule(
     void* background_work_arg) {
   auto worker = sBackgroundThread;
   if (worker) {
-    worker->Dispatch<void>(
+    // Compactions run at normal priority, even though they're background
+    // work. Low priority writers (e.g. indexing) may stall until compaction
+    // catches up, so compaction must never wait for low priority work.
+    worker->Post(
         [=]() { std::invoke(background_work_function, background_work_arg); });
   }
 }
@@ -20,6 +20,7 @@
 #include "esp_log.h"
 #include "komihash.h"
 #include "leveldb/write_batch.h"
+#include "memory_resource.hpp"
 
 #include "database/records.hpp"
 #include "database/track.hpp"
@@ -83,149 +84,155 @@ static auto titleOrFilename(const TrackData& data, const TrackTags& tags)
   return data.filepath.substr(start + 1);
 }
 
-class Indexer {
- public:
-  Indexer(locale::ICollator& collator,
-          const IndexInfo& idx,
-          const TrackData& data,
-          const TrackTags& tags)
-      : collator_(collator),
-        index_(idx),
-        track_data_(data),
-        track_tags_(tags) {}
-
-  auto index() -> std::vector<std::pair<IndexKey, std::string>>;
-
- private:
-  auto handleLevel(const IndexKey::Header& header,
-                   std::span<const Tag> components) -> void;
-
-  auto handleItem(const IndexKey::Header& header,
-                  std::variant<std::pmr::string, uint32_t> item,
-                  std::span<const Tag> components) -> void;
-
-  auto missing_value(Tag tag) -> TagValue {
-    switch (tag) {
-      case Tag::kTitle:
-        return titleOrFilename(track_data_, track_tags_);
-      case Tag::kArtist:
-        return "Unknown Artist";
-      case Tag::kAlbum:
-        return "Unknown Album";
-      case Tag::kAlbumArtist:
-        return track_tags_.artist().value_or("Unknown Artist");
-      case Tag::kGenres:
-        return std::pmr::vector<std::pmr::string>{};
-      case Tag::kDisc:
-        return 0u;
-      case Tag::kTrack:
-        return 0u;
-      case Tag::kAlbumOrder:
-        return 0u;
-    }
-    return std::monostate{};
+IndexContext::IndexContext(locale::ICollator& collator,
+                           const TrackData& data,
+                           const TrackTags& tags,
+                           std::pmr::memory_resource* resource)
+    : collator_(collator),
+      resource_(resource),
+      track_data_(data),
+      track_tags_(tags),
+      items_(),
+      title_(),
+      expansions_(resource) {}
+
+auto IndexContext::index(const IndexInfo& index)
+    -> std::vector<std::pair<IndexKey, std::string>> {
+  std::vector<std::pair<IndexKey, std::string>> out;
+  if (index.type != track_data_.type || index.components.empty()) {
+    return out;
   }
-
-  locale::ICollator& collator_;
-  const IndexInfo index_;
-  const TrackData& track_data_;
-  const TrackTags& track_tags_;
-
-  std::vector<std::pair<IndexKey, std::string>> out_;
-};
-
-auto Indexer::index() -> std::vector<std::pair<IndexKey, std::string>> {
-  out_.clear();
-
   IndexKey::Header root_header{
-      .id = index_.id,
+      .id = index.id,
       .depth = 0,
       .components_hash = 0,
   };
-  handleLevel(root_header, index_.components);
-
-  return out_;
+  handleLevel(root_header, index.components, out);
+  return out;
 }
 
-auto Indexer::handleLevel(const IndexKey::Header& header,
-                          std::span<const Tag> components) -> void {
+auto IndexContext::handleLevel(
+    const IndexKey::Header& header,
+    std::span<const Tag> components,
+    std::vector<std::pair<IndexKey, std::string>>& out) -> void {
   Tag component = components.front();
-  TagValue value = track_tags_.get(component);
+  const auto& items = itemsFor(component);
+
+  for (size_t i = 0; i < items.size(); i++) {
+    IndexKey key{
+        .header = header,
+        .item = items[i].key,
+        .track = {},
+    };
+
+    if (components.size() == 1) {
+      key.track = track_data_.id;
+      out.emplace_back(key, title());
+    } else {
+      out.emplace_back(key, items[i].text);
+      handleLevel(expand(header, component, i), components.subspan(1), out);
+    }
+  }
+}
+
+auto IndexContext::itemsFor(Tag tag) -> const std::pmr::vector<Item>& {
+  auto& cached = items_[static_cast<size_t>(tag)];
+  if (cached) {
+    return *cached;
+  }
+  cached.emplace(resource_);
+
+  TagValue value = track_tags_.get(tag);
   if (std::holds_alternative<std::monostate>(value)) {
-    value = missing_value(component);
+    value = missingValue(tag);
   }
 
+  auto add_string = [&](const std::pmr::string& str) {
+    Item& item = cached->emplace_back(Item{
+        .key = std::pmr::string{resource_},
+        .text = {str.data(), str.size()},
+    });
+    collator_.Transform(str, item.key);
+  };
+
   std::visit(
       [&](auto&& arg) {
         using T = std::decay_t<decltype(arg)>;
-        if constexpr (std::is_same_v<T, std::monostate>) {
-          ESP_LOGW(kTag, "dropping component without value: %s",
-                   tagName(components.front()).c_str());
-        } else if constexpr (std::is_same_v<T, std::pmr::string>) {
-          handleItem(header, arg, components);
+        if constexpr (std::is_same_v<T, std::pmr::string>) {
+          add_string(arg);
         } else if constexpr (std::is_same_v<T, uint32_t>) {
-          handleItem(header, arg, components);
+          // CBOR's varint encoding actually works great for lexicographical
+          // sorting.
+          std::string encoded = cppbor::Uint{arg}.toString();
+          cached->emplace_back(Item{
+              .key = {encoded.data(), encoded.size(), resource_},
+              .text = {},
+          });
         } else if constexpr (std::is_same_v<
                                  T, std::span<const std::pmr::string>>) {
           for (const auto& i : arg) {
-            handleItem(header, i, components);
+            add_string(i);
           }
         }
       },
       value);
-}
-
-auto Indexer::handleItem(const IndexKey::Header& header,
-                         std::variant<std::pmr::string, uint32_t> item,
-                         std::span<const Tag> components) -> void {
-  IndexKey key{
-      .header = header,
-      .item = {},
-      .track = {},
-  };
-  std::string value;
 
-  std::string item_text;
-  std::visit(
-      [&](auto&& arg) {
-        using T = std::decay_t<decltype(arg)>;
-        if constexpr (std::is_same_v<T, std::pmr::string>) {
-          value = {arg.data(), arg.size()};
-          auto xfrm = collator_.Transform(value);
-          key.item = {xfrm.data(), xfrm.size()};
-        } else if constexpr (std::is_same_v<T, uint32_t>) {
-          // CBOR's varint encoding actually works great for lexicographical
-          // sorting.
-          key.item = cppbor::Uint{arg}.toString();
-        }
-      },
-      item);
+  return *cached;
+}
 
-  std::optional<IndexKey::Header> next_level;
-  if (components.size() == 1) {
-    value = titleOrFilename(track_data_, track_tags_);
-    key.track = track_data_.id;
-  } else {
-    next_level = ExpandHeader(key.header, key.item);
+auto IndexContext::title() -> const std::string& {
+  if (!title_) {
+    auto title = titleOrFilename(track_data_, track_tags_);
+    title_.emplace(title.data(), title.size());
   }
+  return *title_;
+}
 
-  out_.emplace_back(key, value);
-
-  if (next_level) {
-    handleLevel(*next_level, components.subspan(1));
+auto IndexContext::expand(const IndexKey::Header& header,
+                          Tag tag,
+                          size_t item) -> IndexKey::Header {
+  // The expanded hash only depends on the parent's hash and on the item, so
+  // it's the same for any index that shares a prefix with another (e.g. every
+  // index that begins with kAlbum).
+  for (const auto& e : expansions_) {
+    if (e.parent_hash == header.components_hash && e.tag == tag &&
+        e.item == item) {
+      IndexKey::Header ret{header};
+      ret.depth++;
+      ret.components_hash = e.hash;
+      return ret;
+    }
   }
+  auto ret = ExpandHeader(header, itemsFor(tag)[item].key);
+  expansions_.push_back(Expansion{
+      .parent_hash = header.components_hash,
+      .tag = tag,
+      .item = item,
+      .hash = ret.components_hash,
+  });
+  return ret;
 }
 
-auto Index(locale::ICollator& collator,
-           const IndexInfo& index,
-           const TrackData& data,
-           const TrackTags& tags)
-    -> std::vector<std::pair<IndexKey, std::string>> {
-  if (index.type != data.type) {
-    return {};
+auto IndexContext::missingValue(Tag tag) -> TagValue {
+  switch (tag) {
+    case Tag::kTitle:
+      return titleOrFilename(track_data_, track_tags_);
+    case Tag::kArtist:
+      return "Unknown Artist";
+    case Tag::kAlbum:
+      return "Unknown Album";
+    case Tag::kAlbumArtist:
+      return track_tags_.artist().value_or("Unknown Artist");
+    case Tag::kGenres:
+      return std::span<const std::pmr::string>{};
+    case Tag::kDisc:
+      return 0u;
+    case Tag::kTrack:
+      return 0u;
+    case Tag::kAlbumOrder:
+      return 0u;
   }
-  Indexer indexer{collator, index, data, tags};
-  return indexer.index();
+  return std::monostate{};
 }
 
 auto ExpandHeader(const IndexKey::Header& header,
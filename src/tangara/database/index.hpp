@@ -8,7 +8,11 @@
 
 #include <stdint.h>
 
+#include <array>
 #include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
 #include <string>
 #include <variant>
 #include <vector>
@@ -37,6 +41,17 @@ struct IndexInfo {
   std::vector<Tag> components;
 };
 
+/* Lifecycle of an index, as stored alongside its definition. */
+enum class IndexState {
+  // Records for existing tracks are still being generated. New tracks are
+  // added to the index as usual in the meantime.
+  kBuilding = 0,
+  // The index is complete.
+  kReady = 1,
+  // The index has been removed, but its records haven't all been deleted yet.
+  kRemoving = 2,
+};
+
 struct IndexKey {
   struct Header {
     // The index that this key was created for.
@@ -63,16 +78,72 @@ struct IndexKey {
   std::optional<TrackId> track;
 };
 
-auto Index(locale::ICollator&,
-           const IndexInfo&,
-           const TrackData&,
-           const TrackTags&) -> std::vector<std::pair<IndexKey, std::string>>;
+/*
+ * Produces the index records for a single track. Several indexes often share
+ * components (e.g. both kAllTracks and kTracksByGenre end with the title), so
+ * the work for each component is done lazily and then reused for every index
+ * that the context is used with:
+ *  - tag values are fetched from the TrackTags once,
+ *  - strings are collated once,
+ *  - header hashes are computed once for each parent header and item.
+ *
+ * Contexts refer to the TrackData and TrackTags they were created with, and so
+ * must not outlive them. Their working state is allocated from the given
+ * resource, which is typically a scoped arena since contexts are short-lived.
+ */
+class IndexContext {
+ public:
+  IndexContext(locale::ICollator&,
+               const TrackData&,
+               const TrackTags&,
+               std::pmr::memory_resource* = &memory::kDatabaseResource);
+
+  /* Returns every record that this track should have in the given index. */
+  auto index(const IndexInfo&) -> std::vector<std::pair<IndexKey, std::string>>;
+
+  IndexContext(const IndexContext&) = delete;
+  IndexContext& operator=(const IndexContext&) = delete;
+
+ private:
+  struct Item {
+    // The sortable form of this item, for use in IndexKey::item.
+    std::pmr::string key;
+    // The human-readable form of this item, for use as a record's value. This
+    // is empty for numeric items.
+    std::string text;
+  };
+
+  struct Expansion {
+    uint64_t parent_hash;
+    Tag tag;
+    size_t item;
+    uint64_t hash;
+  };
+
+  auto handleLevel(const IndexKey::Header&,
+                   std::span<const Tag> components,
+                   std::vector<std::pair<IndexKey, std::string>>& out) -> void;
+  auto itemsFor(Tag) -> const std::pmr::vector<Item>&;
+  auto title() -> const std::string&;
+  auto expand(const IndexKey::Header&, Tag, size_t item) -> IndexKey::Header;
+  auto missingValue(Tag) -> TagValue;
+
+  locale::ICollator& collator_;
+  std::pmr::memory_resource* resource_;
+  const TrackData& track_data_;
+  const TrackTags& track_tags_;
+
+  static constexpr size_t kNumTags = static_cast<size_t>(Tag::kGenres) + 1;
+  std::array<std::optional<std::pmr::vector<Item>>, kNumTags> items_;
+  std::optional<std::string> title_;
+  std::pmr::vector<Expansion> expansions_;
+};
 
 auto ExpandHeader(const IndexKey::Header&,
                   const std::optional<std::pmr::string>&) -> IndexKey::Header;
 
-// Predefined indexes
-// TODO(jacqueline): Make these defined at runtime! :)
+// Indexes that every database starts with. Further indexes may be added and
+// removed at runtime; see Database::addIndex.
 
 extern const IndexInfo kAlbumsByArtist;
 extern const IndexInfo kTracksByGenre;
@@ -53,6 +53,8 @@ static const char kDataPrefix = 'D';
 static const char kHashPrefix = 'H';
 static const char kTagHashPrefix = 'T';
 static const char kIndexPrefix = 'I';
+static const char kIndexInfoPrefix = 'X';
+static const char kSearchPrefix = 'S';
 static const char kFieldSeparator = '\0';
 
 static constexpr auto makePrefix(char p) -> std::string {
@@ -97,6 +99,31 @@ auto EncodeDataValue(const TrackData& track) -> std::string {
       cppbor::Uint{static_cast<unsigned int>(track.type)},
       cppbor::Uint{track.play_count},
   };
+  if (!track.replay_gain) {
+    val.add(cppbor::Null{});
+  } else if (*track.replay_gain < 0) {
+    val.add(cppbor::Nint{*track.replay_gain});
+  } else {
+    val.add(cppbor::Uint{static_cast<uint64_t>(*track.replay_gain)});
+  }
+  val.add(cppbor::Bool{track.is_loudness_analysed});
+  if (!track.audio) {
+    val.add(cppbor::Null{});
+  } else {
+    cppbor::Array audio;
+    auto add = [&](const auto& prop) {
+      if (prop) {
+        audio.add(cppbor::Uint{*prop});
+      } else {
+        audio.add(cppbor::Null{});
+      }
+    };
+    add(track.audio->duration_ms);
+    add(track.audio->sample_rate);
+    add(track.audio->num_channels);
+    add(track.audio->bitrate_kbps);
+    val.add(std::move(audio));
+  }
   return val.toString();
 }
 
@@ -152,6 +179,30 @@ auto ParseDataValue(const leveldb::Slice& slice) -> std::shared_ptr<TrackData> {
     res->play_count = vals->get(9)->asUint()->unsignedValue();
   }
 
+  if (vals->size() >= 11 && vals->get(10)->asInt()) {
+    res->replay_gain = vals->get(10)->asInt()->value();
+  }
+
+  if (vals->size() >= 12 && vals->get(11)->asBool()) {
+    res->is_loudness_analysed = vals->get(11)->asBool()->value();
+  }
+
+  if (vals->size() >= 13 && vals->get(12)->type() == cppbor::ARRAY) {
+    auto audio = vals->get(12)->asArray();
+    auto get = [&](size_t i) -> std::optional<uint32_t> {
+      if (i >= audio->size() || audio->get(i)->type() != cppbor::UINT) {
+        return {};
+      }
+      return audio->get(i)->asUint()->unsignedValue();
+    };
+    res->audio = AudioProperties{
+        .duration_ms = get(0),
+        .sample_rate = get(1),
+        .num_channels = get(2),
+        .bitrate_kbps = get(3),
+    };
+  }
+
   return res;
 }
 
@@ -266,6 +317,114 @@ auto ParseIndexKey(const leveldb::Slice& slice) -> std::optional<IndexKey> {
   return result;
 }
 
+/* 'I/0x83 0x01' */
+auto EncodeIndexIdPrefix(IndexId id) -> std::string {
+  // Index headers are a cbor array of [id, depth, hash]. Encode a header for
+  // this index, then trim off the depth and hash (which are single bytes when
+  // zero) to leave a prefix that matches every depth.
+  std::string header = cppbor::Array{
+      cppbor::Uint{id},
+      cppbor::Uint{0},
+      cppbor::Uint{0},
+  }.toString();
+  return makePrefix(kIndexPrefix) + header.substr(0, header.size() - 2);
+}
+
+/* 'X/' */
+auto EncodeIndexInfoPrefix() -> std::string {
+  return makePrefix(kIndexInfoPrefix);
+}
+
+/* 'X/ 0x01' */
+auto EncodeIndexInfoKey(IndexId id) -> std::string {
+  return EncodeIndexInfoPrefix() + cppbor::Uint{id}.toString();
+}
+
+auto EncodeIndexInfoValue(const IndexInfo& info, IndexState state)
+    -> std::string {
+  cppbor::Array components;
+  for (const auto& tag : info.components) {
+    components.add(cppbor::Uint{static_cast<uint8_t>(tag)});
+  }
+  cppbor::Array val{
+      cppbor::Uint{info.id},
+      cppbor::Uint{static_cast<uint8_t>(info.type)},
+      cppbor::Tstr{info.name},
+      std::move(components),
+      cppbor::Uint{static_cast<uint8_t>(state)},
+  };
+  return val.toString();
+}
+
+auto ParseIndexInfoValue(const leveldb::Slice& slice)
+    -> std::optional<std::pair<IndexInfo, IndexState>> {
+  auto [item, unused, err] = cppbor::parseWithViews(
+      reinterpret_cast<const uint8_t*>(slice.data()), slice.size());
+  if (!item || item->type() != cppbor::ARRAY) {
+    return {};
+  }
+  auto vals = item->asArray();
+  if (vals->size() < 5 || vals->get(0)->type() != cppbor::UINT ||
+      vals->get(1)->type() != cppbor::UINT ||
+      vals->get(2)->type() != cppbor::TSTR ||
+      vals->get(3)->type() != cppbor::ARRAY ||
+      vals->get(4)->type() != cppbor::UINT) {
+    return {};
+  }
+
+  auto state = vals->get(4)->asUint()->unsignedValue();
+  if (state > static_cast<uint8_t>(IndexState::kRemoving)) {
+    return {};
+  }
+
+  IndexInfo info{
+      .id = static_cast<IndexId>(vals->get(0)->asUint()->unsignedValue()),
+      .type = static_cast<MediaType>(vals->get(1)->asUint()->unsignedValue()),
+      .name = {vals->get(2)->asViewTstr()->view().data(),
+               vals->get(2)->asViewTstr()->view().size(),
+               &memory::kDatabaseResource},
+      .components = {},
+  };
+  auto components = vals->get(3)->asArray();
+  for (size_t i = 0; i < components->size(); i++) {
+    if (components->get(i)->type() != cppbor::UINT) {
+      return {};
+    }
+    info.components.push_back(
+        static_cast<Tag>(components->get(i)->asUint()->unsignedValue()));
+  }
+
+  return std::make_pair(info, static_cast<IndexState>(state));
+}
+
+/* 'S/' */
+auto EncodeAllSearchPrefix() -> std::string {
+  return makePrefix(kSearchPrefix);
+}
+
+/* 'S/ beat /' */
+auto EncodeSearchPrefix(std::string_view word_prefix) -> std::string {
+  std::string out = makePrefix(kSearchPrefix);
+  out += word_prefix;
+  out += kFieldSeparator;
+  return out;
+}
+
+/* 'S/ beat / 0xACAB' */
+auto EncodeSearchKey(std::string_view word_prefix, TrackId id) -> std::string {
+  // Track ids are encoded as cbor uints, which sort in numeric order.
+  return EncodeSearchPrefix(word_prefix) + TrackIdToBytes(id);
+}
+
+auto ParseSearchKey(const leveldb::Slice& slice, size_t prefix_size)
+    -> std::optional<TrackId> {
+  if (slice.size() <= prefix_size) {
+    return {};
+  }
+  return BytesToTrackId(
+      {slice.data() + prefix_size, slice.size() - prefix_size});
+}
+
 auto TrackIdToBytes(TrackId id) -> std::string {
   return cppbor::Uint{id}.toString();
 }
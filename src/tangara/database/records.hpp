@@ -73,6 +73,45 @@ auto EncodeIndexPrefix(const IndexKey::Header&) -> std::string;
 auto EncodeIndexKey(const IndexKey&) -> std::string;
 auto ParseIndexKey(const leveldb::Slice&) -> std::optional<IndexKey>;
 
+/* Encodes a prefix that matches every record of one index, at all depths. */
+auto EncodeIndexIdPrefix(IndexId) -> std::string;
+
+/* Encodes a prefix that matches all index definitions. */
+auto EncodeIndexInfoPrefix() -> std::string;
+
+/* Encodes the key under which an index's definition is stored. */
+auto EncodeIndexInfoKey(IndexId) -> std::string;
+
+/* Encodes an index's definition, along with its current state. */
+auto EncodeIndexInfoValue(const IndexInfo&, IndexState) -> std::string;
+
+/*
+ * Parses a definition previously encoded by EncodeIndexInfoValue. Returns
+ * nullopt if parsing fails.
+ */
+auto ParseIndexInfoValue(const leveldb::Slice&)
+    -> std::optional<std::pair<IndexInfo, IndexState>>;
+
+/* Encodes a prefix that matches all search index keys. */
+auto EncodeAllSearchPrefix() -> std::string;
+
+/*
+ * Encodes a prefix that matches the search index keys of every track with a
+ * word beginning with the given (normalised) prefix. Keys with this prefix are
+ * ordered by track id.
+ */
+auto EncodeSearchPrefix(std::string_view word_prefix) -> std::string;
+
+/* Encodes a search index key for one track and word prefix. */
+auto EncodeSearchKey(std::string_view word_prefix, TrackId) -> std::string;
+
+/*
+ * Parses the track id from a search index key, given the length of the
+ * search prefix that it was found with.
+ */
+auto ParseSearchKey(const leveldb::Slice&, size_t prefix_size)
+    -> std::optional<TrackId>;
+
 /* Encodes a TrackId as bytes. */
 auto TrackIdToBytes(TrackId id) -> std::string;
 
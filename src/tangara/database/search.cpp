@@ -0,0 +1,116 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "database/search.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "database/track.hpp"
+
+namespace database {
+
+static auto isSeparator(char c) -> bool {
+  // Only plain ASCII is treated as a separator; bytes that are part of a
+  // multibyte UTF-8 character are always kept.
+  unsigned char u = static_cast<unsigned char>(c);
+  return u < 0x80 && !std::isalnum(u);
+}
+
+static auto isContinuationByte(char c) -> bool {
+  return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+auto SearchTokens(std::string_view text) -> std::vector<std::string> {
+  std::vector<std::string> out;
+  std::string current;
+  for (char c : text) {
+    if (isSeparator(c)) {
+      if (!current.empty()) {
+        out.push_back(std::move(current));
+        current.clear();
+      }
+      continue;
+    }
+    current += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  if (!current.empty()) {
+    out.push_back(std::move(current));
+  }
+  return out;
+}
+
+auto SearchIndexPrefix(std::string_view token) -> std::string_view {
+  if (token.size() <= kMaxSearchPrefix) {
+    return token;
+  }
+  size_t len = kMaxSearchPrefix;
+  while (len > 0 && isContinuationByte(token[len])) {
+    len--;
+  }
+  return token.substr(0, len);
+}
+
+/* Returns the normalised words of every tag that the search index covers. */
+static auto searchableWords(const TrackData& data, const TrackTags& tags)
+    -> std::vector<std::string> {
+  std::vector<std::string> out;
+  auto add = [&](std::string_view text) {
+    auto words = SearchTokens(text);
+    out.insert(out.end(), std::make_move_iterator(words.begin()),
+               std::make_move_iterator(words.end()));
+  };
+
+  if (tags.title()) {
+    add(*tags.title());
+  } else {
+    // Untitled tracks are listed by their filename, so they should be
+    // searchable by it as well.
+    auto start = data.filepath.find_last_of('/');
+    add(start == std::pmr::string::npos
+            ? std::string_view{data.filepath}
+            : std::string_view{data.filepath}.substr(start + 1));
+  }
+  if (tags.artist()) {
+    add(*tags.artist());
+  }
+  if (tags.album()) {
+    add(*tags.album());
+  }
+  return out;
+}
+
+auto SearchPrefixes(const TrackData& data, const TrackTags& tags)
+    -> std::vector<std::string> {
+  std::unordered_set<std::string> prefixes;
+  for (const auto& word : searchableWords(data, tags)) {
+    std::string_view indexed = SearchIndexPrefix(word);
+    for (size_t len = 1; len <= indexed.size(); len++) {
+      // Don't split multibyte characters.
+      if (len < indexed.size() && isContinuationByte(indexed[len])) {
+        continue;
+      }
+      prefixes.emplace(indexed.substr(0, len));
+    }
+  }
+  return {prefixes.begin(), prefixes.end()};
+}
+
+auto MatchesSearch(const std::vector<std::string>& tokens,
+                   const TrackData& data,
+                   const TrackTags& tags) -> bool {
+  auto words = searchableWords(data, tags);
+  return std::all_of(tokens.begin(), tokens.end(), [&](const auto& token) {
+    return std::any_of(words.begin(), words.end(), [&](const auto& word) {
+      return word.starts_with(token);
+    });
+  });
+}
+
+}  // namespace database
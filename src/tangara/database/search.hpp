@@ -0,0 +1,55 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "database/track.hpp"
+
+namespace database {
+
+/*
+ * Words are indexed by each of their prefixes up to this many bytes long.
+ * Search terms longer than this are looked up by their first kMaxSearchPrefix
+ * bytes, and then checked against each matching track's tags.
+ */
+constexpr size_t kMaxSearchPrefix = 8;
+
+/*
+ * Splits some text into normalised words for searching. Words are separated by
+ * whitespace and ASCII punctuation, and ASCII letters are lowercased. Any other
+ * characters are kept as-is.
+ */
+auto SearchTokens(std::string_view text) -> std::vector<std::string>;
+
+/*
+ * Returns every distinct prefix of every word in the track's title, artist, and
+ * album, in no particular order. These are the keys under which the track
+ * should be stored in the search index.
+ */
+auto SearchPrefixes(const TrackData&, const TrackTags&)
+    -> std::vector<std::string>;
+
+/*
+ * Returns the portion of a search token that is stored in the search index.
+ * This is the token truncated to kMaxSearchPrefix bytes, without splitting a
+ * multibyte character.
+ */
+auto SearchIndexPrefix(std::string_view token) -> std::string_view;
+
+/*
+ * Returns whether every one of the given tokens is a prefix of some word in the
+ * track's title, artist, or album.
+ */
+auto MatchesSearch(const std::vector<std::string>& tokens,
+                   const TrackData&,
+                   const TrackTags&) -> bool;
+
+}  // namespace database
@@ -13,10 +13,14 @@
 #include <iomanip>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <strings.h>
 
+#include "database/buffered_file.hpp"
 #include "database/track.hpp"
 #include "debug.hpp"
 #include "drivers/spi.hpp"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "ff.h"
 #include "ogg/ogg.h"
@@ -45,45 +49,76 @@ static auto convert_tag(int tag) -> std::optional<Tag> {
   }
 }
 
+/*
+ * Handles the ReplayGain and R128 loudness tags, which we don't treat as
+ * regular tags since they're not shown or indexed. Returns true if the tag was
+ * a gain tag.
+ */
+static auto parse_gain(TrackTags& tags, int t, const char* k, const char* v)
+    -> bool {
+  switch (t) {
+    case Ttrackgain:
+      tags.trackGain(v);
+      return true;
+    case Talbumgain:
+      tags.albumGain(v);
+      return true;
+    case Ttrackpeak:
+    case Talbumpeak:
+      // We saturate when applying gain, so peaks aren't needed.
+      return true;
+    case Tunknown:
+      // libtags doesn't know about R128 tags, so these come through with their
+      // original key.
+      if (strcasecmp(k, "R128_TRACK_GAIN") == 0) {
+        tags.r128TrackGain(v);
+        return true;
+      }
+      if (strcasecmp(k, "R128_ALBUM_GAIN") == 0) {
+        tags.r128AlbumGain(v);
+        return true;
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
 namespace libtags {
 
 struct Aux {
-  FIL file;
-  FILINFO info;
+  BufferedFile file;
   TrackTags* tags;
 };
 
 static int read(Tagctx* ctx, void* buf, int cnt) {
   Aux* aux = reinterpret_cast<Aux*>(ctx->aux);
-  if (f_eof(&aux->file)) {
-    return 0;
-  }
-  UINT bytes_read;
-  if (f_read(&aux->file, buf, cnt, &bytes_read) != FR_OK) {
+  if (cnt < 0) {
     return -1;
   }
-  return bytes_read;
+  return aux->file.read(buf, cnt);
 }
 
 static int seek(Tagctx* ctx, int offset, int whence) {
   Aux* aux = reinterpret_cast<Aux*>(ctx->aux);
-  FRESULT res;
+  int64_t base;
   if (whence == 0) {
-    // Seek from the start of the file. This is f_lseek's behaviour.
-    res = f_lseek(&aux->file, offset);
+    // Seek from the start of the file.
+    base = 0;
   } else if (whence == 1) {
     // Seek from current offset.
-    res = f_lseek(&aux->file, aux->file.fptr + offset);
+    base = aux->file.tell();
   } else if (whence == 2) {
     // Seek from the end of the file
-    res = f_lseek(&aux->file, aux->info.fsize + offset);
+    base = aux->file.size();
   } else {
     return -1;
   }
-  if (res != FR_OK) {
+  int64_t pos = base + offset;
+  if (pos < 0 || !aux->file.seek(pos)) {
     return -1;
   }
-  return aux->file.fptr;
+  return pos;
 }
 
 static void tag(Tagctx* ctx,
@@ -94,11 +129,14 @@ static void tag(Tagctx* ctx,
                 int size,
                 Tagread f) {
   Aux* aux = reinterpret_cast<Aux*>(ctx->aux);
+  if (parse_gain(*aux->tags, t, k, v)) {
+    return;
+  }
   auto tag = convert_tag(t);
   if (!tag) {
     return;
   }
-  std::pmr::string value{v, &memory::kSpiRamResource};
+  std::pmr::string value{v, &memory::kDatabaseResource};
   if (value.empty()) {
     return;
   }
@@ -107,14 +145,42 @@ static void tag(Tagctx* ctx,
 
 static void toc(Tagctx* ctx, int ms, int offset) {}
 
+/* libtags uses zero for any stream properties it couldn't work out. */
+static auto property(int val) -> std::optional<uint32_t> {
+  if (val <= 0) {
+    return {};
+  }
+  return val;
+}
+
 }  // namespace libtags
 
+/*
+ * Estimates the bitrate of a file from its size, for formats that don't include
+ * it in their headers.
+ */
+static auto estimate_bitrate(AudioProperties& audio, FSIZE_t file_size)
+    -> void {
+  if (audio.bitrate_kbps || !audio.duration_ms || *audio.duration_ms == 0) {
+    return;
+  }
+  // Bits per millisecond is equivalent to kilobits per second.
+  audio.bitrate_kbps = file_size * 8 / *audio.duration_ms;
+}
+
 static const std::size_t kBufSize = 1024;
 [[maybe_unused]] static const char* kTag = "TAGS";
 
 TagParserImpl::TagParserImpl() {
   parsers_.emplace_back(new OggTagParser());
   parsers_.emplace_back(new GenericTagParser());
+
+  // Cached tags live in PSRAM, so scale the cache with however much of it is
+  // free; one shard per 512 KiB.
+  size_t free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+  num_shards_ = std::clamp<size_t>(free / (512 * 1024), kMinShards, kMaxShards);
+  shards_ = std::make_unique<Shard[]>(num_shards_);
+  ESP_LOGI(kTag, "caching tags for up to %u tracks", num_shards_ * kShardSize);
 }
 
 auto TagParserImpl::ReadAndParseTags(std::string_view path)
@@ -124,16 +190,79 @@ auto TagParserImpl::ReadAndParseTags(std::string_view path)
   }
 
   // Check the cache first to see if we can skip parsing this file completely.
+  Shard& shard = shardFor(path);
+  if (auto cached = lookup(shard, path)) {
+    return *cached;
+  }
+
+  std::shared_ptr<InFlight> parsing;
   {
-    std::lock_guard<std::mutex> lock{cache_mutex_};
-    std::optional<std::shared_ptr<TrackTags>> cached =
-        cache_.Get({path.data(), path.size()});
-    if (cached) {
+    std::unique_lock<std::mutex> lock{in_flight_mutex_};
+    auto it = std::find_if(in_flight_.begin(), in_flight_.end(),
+                           [&](const auto& p) { return p->path == path; });
+    if (it != in_flight_.end()) {
+      // Another task is already parsing this file. Wait for its result.
+      std::shared_ptr<InFlight> other = *it;
+      in_flight_cv_.wait(lock, [&]() { return other->done; });
+      return other->tags;
+    }
+    // Results are cached before their parse stops being in-flight, so the
+    // file may have finished parsing since we last checked.
+    if (auto cached = lookup(shard, path)) {
       return *cached;
     }
+    parsing = std::make_shared<InFlight>(std::string{path}, false, nullptr);
+    in_flight_.push_back(parsing);
+  }
+
+  std::shared_ptr<TrackTags> tags = parse(path);
+
+  // Store the result in the cache for later.
+  if (tags) {
+    std::unique_lock<std::shared_mutex> lock{shard.mutex};
+    shard.cache.Put({path.data(), path.size(), &memory::kDatabaseResource},
+                    tags);
   }
 
-  // Nothing in the cache; try each of our parsers.
+  {
+    std::lock_guard<std::mutex> lock{in_flight_mutex_};
+    parsing->tags = tags;
+    parsing->done = true;
+    std::erase(in_flight_, parsing);
+  }
+  in_flight_cv_.notify_all();
+
+  return tags;
+}
+
+auto TagParserImpl::shardFor(std::string_view path) -> Shard& {
+  // Each shard's cache picks slots using the low bits of this same hash, so
+  // pick shards using the high bits. Otherwise every key within a shard would
+  // share the same few home slots.
+  return shards_[(util::LruHash(path) >> 32) % num_shards_];
+}
+
+auto TagParserImpl::lookup(Shard& shard, std::string_view path)
+    -> std::optional<std::shared_ptr<TrackTags>> {
+  std::optional<std::shared_ptr<TrackTags>> cached;
+  {
+    std::shared_lock<std::shared_mutex> lock{shard.mutex};
+    cached = shard.cache.Peek(path);
+  }
+  if (cached) {
+    // Mark the entry as recently used, unless doing so would mean waiting on
+    // other readers; a slightly stale eviction order is cheaper than blocking.
+    std::unique_lock<std::shared_mutex> lock{shard.mutex, std::try_to_lock};
+    if (lock) {
+      shard.cache.Get(path);
+    }
+  }
+  return cached;
+}
+
+auto TagParserImpl::parse(std::string_view path)
+    -> std::shared_ptr<TrackTags> {
+  // Try each of our parsers.
   std::shared_ptr<TrackTags> tags;
   for (auto& parser : parsers_) {
     tags = parser->ReadAndParseTags(path);
@@ -157,12 +286,6 @@ auto TagParserImpl::ReadAndParseTags(std::string_view path)
     }
   }
 
-  // Store the result in the cache for later.
-  {
-    std::lock_guard<std::mutex> lock{cache_mutex_};
-    cache_.Put({path.data(), path.size(), &memory::kSpiRamResource}, tags);
-  }
-
   return tags;
 }
 
@@ -189,13 +312,16 @@ auto OggTagParser::ReadAndParseTags(std::string_view p)
   bool stream_init = false;
 
   std::string path{p};
-  FIL file;
-  if (f_open(&file, path.c_str(), FA_READ) != FR_OK) {
+  BufferedFile file;
+  if (!file.open(path)) {
     ESP_LOGW(kTag, "failed to open file '%s'", path.c_str());
     return {};
   }
 
   std::shared_ptr<TrackTags> tags;
+  AudioProperties audio;
+  bool is_opus = false;
+  uint16_t pre_skip = 0;
 
   // The comments packet is the second in the stream. This is *usually* the
   // second page, sometimes overflowing onto the third page. There is no
@@ -207,9 +333,8 @@ auto OggTagParser::ReadAndParseTags(std::string_view p)
     while (ogg_sync_pageout(&sync, &page) != 1) {
       char* buffer = ogg_sync_buffer(&sync, 512);
 
-      UINT br;
-      FRESULT fres = f_read(&file, buffer, 512, &br);
-      if (fres != FR_OK || br == 0) {
+      int br = file.read(buffer, 512);
+      if (br <= 0) {
         goto finish;
       }
 
@@ -233,10 +358,16 @@ auto OggTagParser::ReadAndParseTags(std::string_view p)
     // Try to pull out a packet.
     ogg_packet packet;
     if (ogg_stream_packetout(&stream, &packet) == 1) {
-      // We're interested in the second packet (packetno == 1) only.
+      // The first packet is the identification header, which describes the
+      // format of the audio stream.
       if (packet.packetno < 1) {
+        std::span<unsigned char> data{packet.packet,
+                                      static_cast<size_t>(packet.bytes)};
+        is_opus = parseIdentification(audio, pre_skip, data);
         continue;
       }
+      // Other than that, we're interested in the second packet (packetno == 1)
+      // only.
       if (packet.packetno > 1) {
         goto finish;
       }
@@ -263,7 +394,20 @@ finish:
     ogg_stream_clear(&stream);
   }
   ogg_sync_clear(&sync);
-  f_close(&file);
+
+  if (tags) {
+    // The stream's length isn't in any of its headers, but the granule
+    // position of its final page gives its total number of samples.
+    auto granule = findLastGranule(file);
+    if (granule && audio.sample_rate && *granule > pre_skip) {
+      // Opus granule positions include the encoder's pre-skip, and are always
+      // at 48kHz regardless of the original sample rate.
+      uint64_t samples = is_opus ? *granule - pre_skip : *granule;
+      audio.duration_ms = samples * 1000 / *audio.sample_rate;
+    }
+    estimate_bitrate(audio, file.size());
+    tags->audio(audio);
+  }
 
   return tags;
 }
@@ -292,6 +436,14 @@ auto OggTagParser::parseComments(TrackTags& res, std::span<unsigned char> data)
 
       if (nameToTag_.contains(key_upper) && !val.empty()) {
         res.set(nameToTag_[key_upper], val);
+      } else if (key_upper == "REPLAYGAIN_TRACK_GAIN") {
+        res.trackGain(val);
+      } else if (key_upper == "REPLAYGAIN_ALBUM_GAIN") {
+        res.albumGain(val);
+      } else if (key_upper == "R128_TRACK_GAIN") {
+        res.r128TrackGain(val);
+      } else if (key_upper == "R128_ALBUM_GAIN") {
+        res.r128AlbumGain(val);
       }
     }
 
@@ -299,6 +451,78 @@ auto OggTagParser::parseComments(TrackTags& res, std::span<unsigned char> data)
   }
 }
 
+auto OggTagParser::parseIdentification(AudioProperties& audio,
+                                       uint16_t& pre_skip,
+                                       std::span<unsigned char> data) -> bool {
+  if (data.size() >= 19 && memcmp(data.data(), "OpusHead", 8) == 0) {
+    audio.num_channels = data[9];
+    pre_skip = static_cast<uint16_t>(data[11]) << 8 | data[10];
+    // Opus always decodes to 48kHz; the header's sample rate is only that of
+    // the original input.
+    audio.sample_rate = 48000;
+    return true;
+  }
+  if (data.size() >= 28 && data[0] == 1 &&
+      memcmp(data.data() + 1, "vorbis", 6) == 0) {
+    audio.num_channels = data[11];
+    audio.sample_rate = parseLength(data.subspan(12));
+    uint32_t nominal_bitrate = parseLength(data.subspan(20));
+    if (nominal_bitrate > 0 && nominal_bitrate < INT32_MAX) {
+      audio.bitrate_kbps = nominal_bitrate / 1000;
+    }
+    if (audio.sample_rate == 0u) {
+      audio.sample_rate.reset();
+    }
+  }
+  return false;
+}
+
+auto OggTagParser::findLastGranule(BufferedFile& file)
+    -> std::optional<uint64_t> {
+  // Enough of a page header to get at the granule position.
+  constexpr size_t kHeaderSize = 14;
+  // The last page is almost always within the last few KiB of the file, so
+  // we don't bother looking any further back than this.
+  constexpr FSIZE_t kMaxSearch = 64 * 1024;
+
+  // Fine to have this on the stack; see GenericTagParser.
+  char buf[kBufSize];
+  FSIZE_t size = file.size();
+  FSIZE_t end = size;
+  while (end >= kHeaderSize && size - end < kMaxSearch) {
+    FSIZE_t start = end > kBufSize ? end - kBufSize : 0;
+    if (!file.seek(start)) {
+      return {};
+    }
+    int br = file.read(buf, end - start);
+    if (br < 0 || static_cast<FSIZE_t>(br) != end - start) {
+      return {};
+    }
+
+    // Search backwards, so that the first page we find is the last one.
+    for (ssize_t i = br - static_cast<ssize_t>(kHeaderSize); i >= 0; i--) {
+      if (memcmp(buf + i, "OggS", 4) != 0) {
+        continue;
+      }
+      uint64_t granule = 0;
+      for (int b = 7; b >= 0; b--) {
+        granule = granule << 8 | static_cast<uint8_t>(buf[i + 6 + b]);
+      }
+      // A granule position of -1 means no packets finished on this page.
+      if (granule != UINT64_MAX) {
+        return granule;
+      }
+    }
+
+    if (start == 0) {
+      break;
+    }
+    // Overlap with the previous block, in case a header spans both.
+    end = start + kHeaderSize - 1;
+  }
+  return {};
+}
+
 auto OggTagParser::parseLength(std::span<unsigned char> data) -> uint64_t {
   return static_cast<uint64_t>(data[3]) << 24 |
          static_cast<uint64_t>(data[2]) << 16 |
@@ -313,8 +537,7 @@ auto GenericTagParser::ReadAndParseTags(std::string_view p)
   auto out = TrackTags::create();
   aux.tags = out.get();
 
-  if (f_stat(path.c_str(), &aux.info) != FR_OK ||
-      f_open(&aux.file, path.c_str(), FA_READ) != FR_OK) {
+  if (!aux.file.open(path)) {
     return {};
   }
 
@@ -331,7 +554,6 @@ auto GenericTagParser::ReadAndParseTags(std::string_view p)
   ctx.bufsz = kBufSize;
 
   int res = tagsget(&ctx);
-  f_close(&aux.file);
 
   if (res != 0) {
     // Parsing failed.
@@ -359,6 +581,15 @@ auto GenericTagParser::ReadAndParseTags(std::string_view p)
       out->encoding(Container::kUnsupported);
   }
 
+  AudioProperties audio{
+      .duration_ms = libtags::property(ctx.duration),
+      .sample_rate = libtags::property(ctx.samplerate),
+      .num_channels = libtags::property(ctx.channels),
+      .bitrate_kbps = libtags::property(ctx.bitrate / 1000),
+  };
+  estimate_bitrate(audio, aux.file.size());
+  out->audio(audio);
+
   return out;
 }
 
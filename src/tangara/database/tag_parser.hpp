@@ -7,8 +7,17 @@
 #pragma once
 
 #include <stdint.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "database/buffered_file.hpp"
 #include "database/track.hpp"
 #include "lru_cache.hpp"
 
@@ -28,14 +37,50 @@ class TagParserImpl : public ITagParser {
       -> std::shared_ptr<TrackTags> override;
 
  private:
+  // Entries held by each shard of the cache.
+  static constexpr int kShardSize = 8;
+  // Bounds on how many shards the cache is split into.
+  static constexpr size_t kMinShards = 2;
+  static constexpr size_t kMaxShards = 8;
+
+  struct Shard {
+    std::shared_mutex mutex;
+    util::LruCache<kShardSize, std::pmr::string, std::shared_ptr<TrackTags>>
+        cache;
+  };
+
+  /* A parse of a file that is currently underway on some task. */
+  struct InFlight {
+    std::string path;
+    bool done;
+    std::shared_ptr<TrackTags> tags;
+  };
+
+  auto shardFor(std::string_view path) -> Shard&;
+  auto lookup(Shard&, std::string_view path)
+      -> std::optional<std::shared_ptr<TrackTags>>;
+  auto parse(std::string_view path) -> std::shared_ptr<TrackTags>;
+
   std::vector<std::unique_ptr<ITagParser>> parsers_;
 
   /*
    * Cache of tags that have already been extracted from files. Ideally this
-   * cache should be slightly larger than any page sizes in the UI.
+   * cache should be slightly larger than any page sizes in the UI. It's split
+   * into shards by path, each with its own lock, so that scanning tasks rarely
+   * contend with each other, and lookups within a shard may happen
+   * concurrently.
+   */
+  size_t num_shards_;
+  std::unique_ptr<Shard[]> shards_;
+
+  /*
+   * Files that are being parsed right now. Tasks that miss the cache for one
+   * of these wait for the existing parse to finish, rather than reading the
+   * file a second time.
    */
-  std::mutex cache_mutex_;
-  util::LruCache<8, std::pmr::string, std::shared_ptr<TrackTags>> cache_;
+  std::mutex in_flight_mutex_;
+  std::condition_variable in_flight_cv_;
+  std::vector<std::shared_ptr<InFlight>> in_flight_;
 };
 
 class OggTagParser : public ITagParser {
@@ -46,6 +91,10 @@ class OggTagParser : public ITagParser {
 
  private:
   auto parseComments(TrackTags&, std::span<unsigned char> data) -> void;
+  auto parseIdentification(AudioProperties&,
+                           uint16_t& pre_skip,
+                           std::span<unsigned char> data) -> bool;
+  auto findLastGranule(BufferedFile&) -> std::optional<uint64_t>;
   auto parseLength(std::span<unsigned char> data) -> uint64_t;
 
   std::unordered_map<std::string, Tag> nameToTag_;
@@ -6,6 +6,8 @@
 
 #include "database/track.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <memory_resource>
@@ -22,6 +24,36 @@ namespace database {
 
 static constexpr char kGenreDelimiters[] = ",;";
 
+/*
+ * R128 gains are relative to -23 LUFS, whereas ReplayGain uses -18 LUFS. This
+ * is the difference between the two, in hundredths of a dB.
+ */
+static constexpr int32_t kR128ToReplayGainOffset = 500;
+
+/* Parses a ReplayGain style gain string, e.g. "-7.89 dB" */
+static auto parseReplayGain(std::string_view s) -> std::optional<int16_t> {
+  std::string copy = {s.data(), s.size()};
+  char* end;
+  float db = std::strtof(copy.c_str(), &end);
+  if (end == copy.c_str() || !std::isfinite(db)) {
+    return {};
+  }
+  return static_cast<int16_t>(
+      std::clamp<long>(std::lround(db * 100), INT16_MIN, INT16_MAX));
+}
+
+/* Parses an R128 style gain string, which is a Q7.8 integer. */
+static auto parseR128Gain(std::string_view s) -> std::optional<int16_t> {
+  std::string copy = {s.data(), s.size()};
+  char* end;
+  long q78 = std::strtol(copy.c_str(), &end, 10);
+  if (end == copy.c_str()) {
+    return {};
+  }
+  long gain = (q78 * 100) / 256 + kR128ToReplayGainOffset;
+  return static_cast<int16_t>(std::clamp<long>(gain, INT16_MIN, INT16_MAX));
+}
+
 auto tagName(Tag t) -> std::string {
   switch (t) {
     case Tag::kTitle:
@@ -44,6 +76,16 @@ auto tagName(Tag t) -> std::string {
   return "";
 }
 
+auto tagFromName(std::string_view name) -> std::optional<Tag> {
+  for (uint8_t i = 0; i <= static_cast<uint8_t>(Tag::kGenres); i++) {
+    Tag t = static_cast<Tag>(i);
+    if (tagName(t) == name) {
+      return t;
+    }
+  }
+  return {};
+}
+
 auto tagHash(const TagValue& t) -> uint64_t {
   return std::visit(
       [&](auto&& arg) {
@@ -94,7 +136,7 @@ auto tagToString(const TagValue& val) -> std::string {
 auto TrackTags::create() -> std::shared_ptr<TrackTags> {
   return std::allocate_shared<TrackTags,
                               std::pmr::polymorphic_allocator<TrackTags>>(
-      &memory::kSpiRamResource);
+      &memory::kDatabaseResource);
 }
 
 template <typename T>
@@ -267,6 +309,37 @@ auto TrackTags::genres(const std::string_view s) -> void {
   }
 }
 
+auto TrackTags::trackGain() const -> const std::optional<int16_t>& {
+  return track_gain_;
+}
+
+auto TrackTags::trackGain(const std::string_view s) -> void {
+  track_gain_ = parseReplayGain(s);
+}
+
+auto TrackTags::r128TrackGain(const std::string_view s) -> void {
+  track_gain_ = parseR128Gain(s);
+}
+
+auto TrackTags::albumGain() const -> const std::optional<int16_t>& {
+  return album_gain_;
+}
+
+auto TrackTags::albumGain(const std::string_view s) -> void {
+  album_gain_ = parseReplayGain(s);
+}
+
+auto TrackTags::r128AlbumGain(const std::string_view s) -> void {
+  album_gain_ = parseR128Gain(s);
+}
+
+auto TrackTags::preferredGain() const -> std::optional<int16_t> {
+  if (track_gain_) {
+    return track_gain_;
+  }
+  return album_gain_;
+}
+
 /*
  * Uses a komihash stream to incrementally hash tags. This lowers the
  * function's memory footprint a little so that it's safe to call from any
@@ -304,6 +377,9 @@ auto database::TrackData::clone() const -> std::shared_ptr<TrackData> {
   data->last_position = last_position;
   data->play_count = play_count;
   data->type = type;
+  data->replay_gain = replay_gain;
+  data->is_loudness_analysed = is_loudness_analysed;
+  data->audio = audio;
   return data;
 }
 
@@ -13,6 +13,7 @@
 #include <optional>
 #include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <variant>
@@ -81,9 +82,25 @@ using TagValue = std::variant<std::monostate,
                               std::span<const std::pmr::string>>;
 
 auto tagName(Tag) -> std::string;
+/* The inverse of tagName. Returns nullopt if there is no tag with this name. */
+auto tagFromName(std::string_view) -> std::optional<Tag>;
 auto tagHash(const TagValue&) -> uint64_t;
 auto tagToString(const TagValue&) -> std::string;
 
+/*
+ * Properties of a track's encoded audio stream. These are read from the same
+ * headers as the track's tags, so they're available without opening the file
+ * with a codec. Any of them may be missing if the file's headers don't say.
+ */
+struct AudioProperties {
+  std::optional<uint32_t> duration_ms;
+  std::optional<uint32_t> sample_rate;
+  std::optional<uint8_t> num_channels;
+  std::optional<uint32_t> bitrate_kbps;
+
+  bool operator==(const AudioProperties&) const = default;
+};
+
 /*
  * Owning container for tag-related track metadata that was extracted from a
  * file.
@@ -93,7 +110,7 @@ class TrackTags {
   static auto create() -> std::shared_ptr<TrackTags>;
 
   TrackTags()
-      : encoding_(Container::kUnsupported), genres_(&memory::kSpiRamResource) {}
+      : encoding_(Container::kUnsupported), genres_(&memory::kDatabaseResource) {}
 
   TrackTags(const TrackTags& other) = delete;
   TrackTags& operator=(TrackTags& other) = delete;
@@ -108,6 +125,9 @@ class TrackTags {
   auto encoding() const -> Container { return encoding_; };
   auto encoding(Container e) -> void { encoding_ = e; };
 
+  auto audio() const -> const AudioProperties& { return audio_; };
+  auto audio(const AudioProperties& a) -> void { audio_ = a; };
+
   auto title() const -> const std::optional<std::pmr::string>&;
   auto title(std::string_view) -> void;
 
@@ -131,6 +151,27 @@ class TrackTags {
   auto genres() const -> std::span<const std::pmr::string>;
   auto genres(const std::string_view) -> void;
 
+  /*
+   * ReplayGain adjustments, in hundredths of a dB, relative to the ReplayGain
+   * 2.0 reference level of -18 LUFS. These may be set either from
+   * REPLAYGAIN_* style strings (e.g. "-7.89 dB"), or from R128_* style Q7.8
+   * integers, which are relative to -23 LUFS.
+   */
+  auto trackGain() const -> const std::optional<int16_t>&;
+  auto trackGain(const std::string_view) -> void;
+  auto r128TrackGain(const std::string_view) -> void;
+
+  auto albumGain() const -> const std::optional<int16_t>&;
+  auto albumGain(const std::string_view) -> void;
+  auto r128AlbumGain(const std::string_view) -> void;
+
+  /*
+   * The gain that should be used to normalise this track's loudness. This is
+   * the track gain if there is one, since tracks are often heard outside the
+   * context of their album (e.g. when shuffling), or the album gain otherwise.
+   */
+  auto preferredGain() const -> std::optional<int16_t>;
+
   /*
    * Returns a hash of the 'identifying' tags of this track. That is, a hash
    * that can be used to determine if one track is likely the same as another,
@@ -141,6 +182,7 @@ class TrackTags {
 
  private:
   Container encoding_;
+  AudioProperties audio_;
 
   std::optional<std::pmr::string> title_;
   std::optional<std::pmr::string> artist_;
@@ -149,6 +191,9 @@ class TrackTags {
   std::optional<uint8_t> disc_;
   std::optional<uint16_t> track_;
   std::pmr::vector<std::pmr::string> genres_;
+
+  std::optional<int16_t> track_gain_;
+  std::optional<int16_t> album_gain_;
 };
 
 /*
@@ -174,12 +219,15 @@ struct TrackData {
       : id(0),
         filepath(),
         tags_hash(0),
-        individual_tag_hashes(&memory::kSpiRamResource),
+        individual_tag_hashes(&memory::kDatabaseResource),
         is_tombstoned(false),
         modified_at(),
         last_position(0),
         play_count(0),
-        type(MediaType::kUnknown) {}
+        type(MediaType::kUnknown),
+        replay_gain(),
+        is_loudness_analysed(false),
+        audio() {}
 
   TrackId id;
   std::pmr::string filepath;
@@ -191,6 +239,24 @@ struct TrackData {
   uint32_t play_count;
   MediaType type;
 
+  /*
+   * Gain to apply to this track for loudness normalisation, in hundredths of
+   * a dB. Taken from the track's tags where possible, or otherwise measured
+   * by a background loudness analysis.
+   */
+  std::optional<int16_t> replay_gain;
+  /*
+   * Whether a loudness analysis has been attempted for this track. Used to
+   * avoid repeatedly analysing tracks that we can't decode.
+   */
+  bool is_loudness_analysed;
+
+  /*
+   * Properties of the track's audio stream, as of when its tags were last
+   * read. Missing if the track was indexed before these were recorded.
+   */
+  std::optional<AudioProperties> audio;
+
   TrackData(const TrackData&& other) = delete;
   TrackData& operator=(TrackData& other) = delete;
   auto clone() const -> std::shared_ptr<TrackData>;
@@ -13,19 +13,20 @@
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <utility>
 
 #include "database/track_finder.hpp"
 #include "ff.h"
 
 #include "drivers/spi.hpp"
-#include "memory_resource.hpp"
+#include "pool.hpp"
 
 namespace database {
 
 static_assert(sizeof(TCHAR) == sizeof(char), "TCHAR must be CHAR");
 
 CandidateIterator::CandidateIterator(std::string_view root)
-    : to_explore_(&memory::kSpiRamResource) {
+    : to_explore_(&memory::kSpiRamPool) {
   to_explore_.push_back({root.data(), root.size()});
 }
 
@@ -33,10 +34,10 @@ auto CandidateIterator::next(FILINFO& info) -> std::optional<std::string> {
   std::scoped_lock<std::mutex> lock{mut_};
   while (!to_explore_.empty() || current_) {
     if (!current_) {
-      current_.emplace();
+      current_.emplace(std::pmr::string{&memory::kSpiRamPool}, FF_DIR{});
 
       // Get the next directory to iterate through.
-      current_->first = to_explore_.front();
+      current_->first = std::move(to_explore_.front());
       to_explore_.pop_front();
       const TCHAR* next_path =
           static_cast<const TCHAR*>(current_->first.data());
@@ -60,14 +61,14 @@ auto CandidateIterator::next(FILINFO& info) -> std::optional<std::string> {
       continue;
     } else {
       // A valid file or folder.
-      std::pmr::string full_path{&memory::kSpiRamResource};
+      std::pmr::string full_path{&memory::kSpiRamPool};
       full_path += current_->first;
       full_path += "/";
       full_path += info.fname;
 
       if (info.fattrib & AM_DIR) {
         // This is a directory. Add it to the explore queue.
-        to_explore_.push_back(full_path);
+        to_explore_.push_back(std::move(full_path));
       } else {
         // This is a file! We can return now.
         return {{full_path.data(), full_path.size()}};
@@ -98,21 +99,23 @@ auto TrackFinder::launch(std::string_view root) -> void {
 }
 
 auto TrackFinder::schedule() -> void {
-  pool_.Dispatch<void>([&]() {
-    FILINFO info;
-    auto next = iterator_->next(info);
-    if (next) {
-      std::invoke(processor_, info, *next);
-      schedule();
-    } else {
-      std::scoped_lock<std::mutex> lock{workers_mutex_};
-      num_workers_ -= 1;
-      if (num_workers_ == 0) {
-        iterator_.reset();
-        std::invoke(complete_cb_);
-      }
-    }
-  });
+  pool_.Post(
+      [&]() {
+        FILINFO info;
+        auto next = iterator_->next(info);
+        if (next) {
+          std::invoke(processor_, info, *next);
+          schedule();
+        } else {
+          std::scoped_lock<std::mutex> lock{workers_mutex_};
+          num_workers_ -= 1;
+          if (num_workers_ == 0) {
+            iterator_.reset();
+            std::invoke(complete_cb_);
+          }
+        }
+      },
+      tasks::WorkPriority::kLow);
 }
 
 }  // namespace database
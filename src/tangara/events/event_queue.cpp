@@ -6,6 +6,10 @@
 
 #include "events/event_queue.hpp"
 
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/portmacro.h"
 #include "freertos/queue.h"
@@ -16,9 +20,119 @@
 
 namespace events {
 
+Queue::Queue(tasks::perf::Metric metric)
+    : metric_(metric),
+      has_events_(xSemaphoreCreateBinary()),
+      slots_(),
+      head_(0),
+      tail_(0),
+      overflow_size_(0),
+      overflow_mutex_(),
+      overflow_() {
+  for (size_t i = 0; i < kCapacity; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+auto Queue::Add(tasks::WorkItem fn) -> std::optional<size_t> {
+  tasks::QueuedWork work{
+      .fn = std::move(fn),
+      .queued_at = tasks::perf::Now(),
+  };
+  // Once anything has overflowed, keep overflowing until the consumer has
+  // caught up, so that work from any one task is still run in order.
+  std::optional<size_t> position;
+  if (overflow_size_.load(std::memory_order_acquire) == 0) {
+    position = tryPush(work);
+  }
+  if (!position) {
+    std::lock_guard<std::mutex> lock{overflow_mutex_};
+    overflow_.push_back(std::move(work));
+    overflow_size_.fetch_add(1, std::memory_order_release);
+  }
+  xSemaphoreGive(has_events_);
+  return position;
+}
+
+auto Queue::IsLast(size_t position) -> bool {
+  // Work added to the ring after this position would have advanced head_, and
+  // work added whilst the ring was full would be in the overflow list.
+  return head_.load(std::memory_order_acquire) == position + 1 &&
+         overflow_size_.load(std::memory_order_acquire) == 0;
+}
+
+auto Queue::Service(TickType_t max_wait) -> bool {
+  bool res = xSemaphoreTake(has_events_, max_wait);
+  if (!res) {
+    return false;
+  }
+
+  bool had_work = false;
+  for (;;) {
+    tasks::QueuedWork work;
+    // The ring always holds older work than the overflow list, so drain it
+    // first.
+    if (!tryPop(work) && !popOverflow(work)) {
+      return had_work;
+    }
+    had_work = true;
+    tasks::perf::RecordSince(metric_, work.queued_at);
+    work.fn();
+  }
+}
+
+auto Queue::tryPush(tasks::QueuedWork& work) -> std::optional<size_t> {
+  size_t pos = head_.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot& slot = slots_[pos & (kCapacity - 1)];
+    size_t seq = slot.sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      // The slot is free; try to claim it before another producer does.
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        slot.work = std::move(work);
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        return pos;
+      }
+    } else if (diff < 0) {
+      // The consumer hasn't finished with this slot yet, so the ring is full.
+      return {};
+    } else {
+      // Another producer claimed this slot first.
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+auto Queue::tryPop(tasks::QueuedWork& out) -> bool {
+  Slot& slot = slots_[tail_ & (kCapacity - 1)];
+  if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+    // Either the ring is empty, or the producer that claimed this slot hasn't
+    // finished writing to it. In the latter case, it will signal has_events_
+    // once it's done, and we'll pick up its work then.
+    return false;
+  }
+  out = std::move(slot.work);
+  slot.sequence.store(tail_ + kCapacity, std::memory_order_release);
+  tail_++;
+  return true;
+}
+
+auto Queue::popOverflow(tasks::QueuedWork& out) -> bool {
+  if (overflow_size_.load(std::memory_order_acquire) == 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock{overflow_mutex_};
+  out = std::move(overflow_.front());
+  overflow_.pop_front();
+  overflow_size_.fetch_sub(1, std::memory_order_release);
+  return true;
+}
+
 namespace queues {
-static Queue sSystemAndAudio;
-static Queue sUi;
+static Queue sSystemAndAudio{tasks::perf::Metric::kSystemEvents};
+static Queue sUi{tasks::perf::Metric::kUiEvents};
 
 auto SystemAndAudio() -> Queue* {
   return &sSystemAndAudio;
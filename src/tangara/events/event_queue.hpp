@@ -6,55 +6,65 @@
 
 #pragma once
 
-#include <functional>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <list>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <type_traits>
+#include <utility>
 
 #include "audio/audio_fsm.hpp"
 #include "freertos/FreeRTOS.h"
 #include "freertos/portmacro.h"
 #include "freertos/queue.h"
+#include "perf.hpp"
 #include "system_fsm/system_fsm.hpp"
 #include "tinyfsm.hpp"
+#include "work_item.hpp"
 
 #include "ui/ui_fsm.hpp"
 
 namespace events {
 
+/*
+ * A queue of work to be run on a single task, which may be added to from any
+ * number of other tasks.
+ *
+ * Work is stored in a fixed-size ring of slots, each of which can hold a small
+ * callable inline, so adding work is lock-free and doesn't allocate. If the
+ * ring ever fills up because its task has fallen far behind, further work goes
+ * to a slower mutex-guarded overflow list until the task catches up, rather
+ * than blocking or dropping events.
+ */
 class Queue {
  public:
-  Queue() : has_events_(xSemaphoreCreateBinary()), mut_(), events_() {}
-
-  auto Add(std::function<void(void)> fn) {
-    {
-      std::lock_guard<std::mutex> lock{mut_};
-      events_.push_back(fn);
-    }
-    xSemaphoreGive(has_events_);
-  }
-
-  auto Service(TickType_t max_wait) -> bool {
-    bool res = xSemaphoreTake(has_events_, max_wait);
-    if (!res) {
-      return false;
-    }
-
-    bool had_work = false;
-    for (;;) {
-      std::function<void(void)> fn;
-      {
-        std::lock_guard<std::mutex> lock{mut_};
-        if (events_.empty()) {
-          return had_work;
-        }
-        had_work = true;
-        fn = events_.front();
-        events_.pop_front();
-      }
-      std::invoke(fn);
-    }
-  }
+  static constexpr size_t kCapacity = 32;
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "capacity must be a power of two");
+
+  /* The latency of work in this queue is recorded against the given metric. */
+  explicit Queue(tasks::perf::Metric);
+
+  /*
+   * Adds work to the end of the queue. Returns the work's position within the
+   * ring, or nothing if the ring was full and the work had to overflow.
+   */
+  auto Add(tasks::WorkItem fn) -> std::optional<size_t>;
+
+  /*
+   * Returns whether the work added at the given position is still the most
+   * recent work in the queue; i.e. nothing else has been added after it.
+   */
+  auto IsLast(size_t position) -> bool;
+
+  /*
+   * Runs all of the work currently in the queue, after waiting up to max_wait
+   * for some to arrive. Must only be called from the task that owns this
+   * queue. Returns whether any work was run.
+   */
+  auto Service(TickType_t max_wait) -> bool;
 
   auto has_events() -> SemaphoreHandle_t { return has_events_; }
 
@@ -62,9 +72,32 @@ class Queue {
   void operator=(Queue const&) = delete;
 
  private:
+  auto tryPush(tasks::QueuedWork&) -> std::optional<size_t>;
+  auto tryPop(tasks::QueuedWork&) -> bool;
+  auto popOverflow(tasks::QueuedWork&) -> bool;
+
+  struct Slot {
+    /*
+     * Which turn this slot is on. A slot at position n in the ring is free for
+     * a producer when this equals n, and holds work for the consumer when this
+     * equals n + 1.
+     */
+    std::atomic<size_t> sequence;
+    tasks::QueuedWork work;
+  };
+
+  tasks::perf::Metric metric_;
   SemaphoreHandle_t has_events_;
-  std::mutex mut_;
-  std::list<std::function<void(void)>> events_;
+
+  std::array<Slot, kCapacity> slots_;
+  // Position of the next slot to be written. Shared by all producers.
+  std::atomic<size_t> head_;
+  // Position of the next slot to be read. Only touched by the consumer.
+  size_t tail_;
+
+  std::atomic<size_t> overflow_size_;
+  std::mutex overflow_mutex_;
+  std::list<tasks::QueuedWork> overflow_;
 };
 
 template <class Machine>
@@ -74,20 +107,62 @@ class Dispatcher {
 
   template <typename Event>
   auto Dispatch(const Event& ev) -> void {
-    auto dispatch_fn = [=]() {
-      tinyfsm::FsmList<Machine>::template dispatch<Event>(ev);
-    };
-    queue_->Add(dispatch_fn);
+    queue_->Add(
+        [ev]() { tinyfsm::FsmList<Machine>::template dispatch<Event>(ev); });
   }
 
-  auto RunOnTask(const std::function<void(void)>& fn) -> void {
-    queue_->Add(fn);
+  /*
+   * Dispatches an event that describes the complete current state of
+   * something, such that only the most recent one matters. If an earlier event
+   * of the same type is still waiting at the very end of the queue, then it is
+   * replaced by this one instead of queueing both. Events are never replaced
+   * if anything else was queued after them, since that would deliver newer
+   * state ahead of the work in between.
+   */
+  template <typename Event>
+  auto DispatchCoalesced(const Event& ev) -> void {
+    // One of these exists for each combination of state machine and event
+    // type.
+    static Pending<Event> sPending;
+    std::lock_guard<std::mutex> lock{sPending.mutex};
+    if (sPending.event && sPending.position &&
+        queue_->IsLast(*sPending.position)) {
+      sPending.event = ev;
+      return;
+    }
+    sPending.event = ev;
+    uint32_t id = ++sPending.id;
+    sPending.position = queue_->Add([ev, id]() {
+      std::optional<Event> latest;
+      {
+        std::lock_guard<std::mutex> lock{sPending.mutex};
+        // If this is still the pending event, then it may have been replaced
+        // by a newer one since it was queued.
+        if (sPending.id == id && sPending.event) {
+          latest.swap(sPending.event);
+        }
+      }
+      tinyfsm::FsmList<Machine>::template dispatch<Event>(latest.value_or(ev));
+    });
   }
 
+  auto RunOnTask(tasks::WorkItem fn) -> void { queue_->Add(std::move(fn)); }
+
   Dispatcher(Dispatcher const&) = delete;
   void operator=(Dispatcher const&) = delete;
 
  private:
+  template <typename Event>
+  struct Pending {
+    std::mutex mutex;
+    // The latest event, if it hasn't been delivered yet.
+    std::optional<Event> event;
+    // Identifies the queued work that will deliver `event`.
+    uint32_t id;
+    // Where in the queue that work was added, if it wasn't overflowed.
+    std::optional<size_t> position;
+  };
+
   Queue* queue_;
 };
 
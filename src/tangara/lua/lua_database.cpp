@@ -6,9 +6,11 @@
 
 #include "lua/lua_database.hpp"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <type_traits>
+#include <vector>
 #include <variant>
 
 #include "lua.hpp"
@@ -125,6 +127,35 @@ static void pushTrack(lua_State* L, const database::Track& track) {
   lua_pushliteral(L, "play_count");
   lua_pushinteger(L, track.data().play_count);
   lua_settable(L, -3);
+
+  if (!track.data().audio) {
+    return;
+  }
+  const auto& audio = *track.data().audio;
+
+  if (audio.duration_ms) {
+    lua_pushliteral(L, "duration");
+    lua_pushinteger(L, *audio.duration_ms / 1000);
+    lua_settable(L, -3);
+  }
+
+  if (audio.sample_rate) {
+    lua_pushliteral(L, "sample_rate");
+    lua_pushinteger(L, *audio.sample_rate);
+    lua_settable(L, -3);
+  }
+
+  if (audio.num_channels) {
+    lua_pushliteral(L, "channels");
+    lua_pushinteger(L, *audio.num_channels);
+    lua_settable(L, -3);
+  }
+
+  if (audio.bitrate_kbps) {
+    lua_pushliteral(L, "bitrate_kbps");
+    lua_pushinteger(L, *audio.bitrate_kbps);
+    lua_settable(L, -3);
+  }
 }
 
 static auto version(lua_State* L) -> int {
@@ -161,7 +192,7 @@ static auto update(lua_State* L) -> int {
   }
 
   instance->services().bg_worker().Dispatch<void>(
-      [=]() { db->updateIndexes(); });
+      [=]() { db->updateIndexes(); }, tasks::WorkPriority::kLow);
   return 0;
 }
 
@@ -184,11 +215,118 @@ static auto track_by_id(lua_State* L) -> int {
   return 1;
 }
 
+static auto total_duration(lua_State* L) -> int {
+  luaL_checktype(L, 1, LUA_TTABLE);
+
+  Bridge* instance = Bridge::Get(L);
+  auto db = instance->services().database().lock();
+  if (!db) {
+    return 0;
+  }
+
+  // Only the stored track data is needed for this, so this doesn't touch any
+  // of the tracks' files.
+  uint64_t total_ms = 0;
+  lua_Integer len = luaL_len(L, 1);
+  for (lua_Integer i = 1; i <= len; i++) {
+    lua_geti(L, 1, i);
+    auto id = luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+
+    auto data = db->getTrackData(id);
+    if (data && data->audio && data->audio->duration_ms) {
+      total_ms += *data->audio->duration_ms;
+    }
+  }
+
+  lua_pushinteger(L, total_ms / 1000);
+  return 1;
+}
+
+static auto search(lua_State* L) -> int {
+  size_t query_len;
+  const char* query = luaL_checklstring(L, 1, &query_len);
+  auto limit = luaL_optinteger(L, 2, 50);
+
+  Bridge* instance = Bridge::Get(L);
+  auto db = instance->services().database().lock();
+  if (!db) {
+    return 0;
+  }
+
+  auto results =
+      db->search({query, query_len}, std::max<lua_Integer>(limit, 0));
+  lua_createtable(L, results.size(), 0);
+  for (size_t i = 0; i < results.size(); i++) {
+    lua_pushinteger(L, results[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+static auto add_index(lua_State* L) -> int {
+  size_t name_len;
+  const char* name = luaL_checklstring(L, 1, &name_len);
+  lua_Integer raw_type = luaL_checkinteger(L, 2);
+  if (raw_type < static_cast<lua_Integer>(database::MediaType::kUnknown) ||
+      raw_type > static_cast<lua_Integer>(database::MediaType::kAudiobook)) {
+    return luaL_argerror(L, 2, "unknown media type");
+  }
+  auto type = static_cast<database::MediaType>(raw_type);
+  luaL_checktype(L, 3, LUA_TTABLE);
+
+  std::vector<database::Tag> components;
+  lua_Integer len = luaL_len(L, 3);
+  for (lua_Integer i = 1; i <= len; i++) {
+    lua_geti(L, 3, i);
+    auto tag = database::tagFromName(luaL_checkstring(L, -1));
+    lua_pop(L, 1);
+    if (!tag) {
+      return luaL_error(L, "unknown tag in index components");
+    }
+    components.push_back(*tag);
+  }
+
+  Bridge* instance = Bridge::Get(L);
+  auto db = instance->services().database().lock();
+  if (!db) {
+    return 0;
+  }
+
+  auto id = db->addIndex(type, {name, name_len}, components);
+  if (!id) {
+    return 0;
+  }
+  lua_pushinteger(L, *id);
+  return 1;
+}
+
+static auto remove_index(lua_State* L) -> int {
+  auto id = luaL_checkinteger(L, 1);
+
+  Bridge* instance = Bridge::Get(L);
+  auto db = instance->services().database().lock();
+  if (!db) {
+    return 0;
+  }
+
+  lua_pushboolean(L, db->removeIndex(id));
+  return 1;
+}
+
 static const struct luaL_Reg kDatabaseFuncs[] = {
-    {"indexes", indexes}, {"version", version},
-    {"size", size},       {"recreate", recreate},
-    {"update", update},   {"track_by_id", track_by_id},
-    {NULL, NULL}};
+    {"indexes", indexes},
+    {"version", version},
+    {"size", size},
+    {"recreate", recreate},
+    {"update", update},
+    {"track_by_id", track_by_id},
+    {"total_duration", total_duration},
+    {"search", search},
+    {"add_index", add_index},
+    {"remove_index", remove_index},
+    {NULL, NULL},
+};
 
 /*
  * Struct to be used as userdata for the Lua representation of database records.
@@ -27,21 +27,22 @@ namespace lua {
 
 class Allocator {
  public:
-  Allocator() : total_allocated_(0) {}
-
   auto alloc(void* ptr, size_t osize, size_t nsize) -> void* {
-    total_allocated_ = total_allocated_ - osize + nsize;
-    // ESP_LOGI(kTag, "lua realloc -> %u KiB", total_allocated_ / 1024);
+    // For new allocations, Lua passes the type of the new object as osize,
+    // rather than a size.
+    size_t old_size = ptr ? osize : 0;
     if (nsize == 0) {
       heap_caps_free(ptr);
+      memory::RecordFree(memory::Subsystem::kLua, old_size);
       return NULL;
-    } else {
-      return heap_caps_realloc(ptr, nsize, MALLOC_CAP_SPIRAM);
     }
+    void* res = heap_caps_realloc(ptr, nsize, MALLOC_CAP_SPIRAM);
+    if (res) {
+      memory::RecordFree(memory::Subsystem::kLua, old_size);
+      memory::RecordAlloc(memory::Subsystem::kLua, nsize);
+    }
+    return res;
   }
-
- private:
-  size_t total_allocated_;
 };
 
 static auto lua_alloc(void* ud,
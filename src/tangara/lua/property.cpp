@@ -7,12 +7,15 @@
 #include "lua/property.hpp"
 #include <sys/_stdint.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <memory>
 #include <memory_resource>
 #include <sstream>
 #include <string>
 #include <variant>
+#include <vector>
 
 #include "database/track.hpp"
 #include "drivers/bluetooth_types.hpp"
@@ -145,7 +148,7 @@ static auto generic_function_cb(lua_State* state) -> int {
   return std::invoke(fn, state);
 }
 
-PropertyBindings::PropertyBindings() : functions_(&memory::kSpiRamResource) {}
+PropertyBindings::PropertyBindings() : functions_(&memory::kLuaResource) {}
 
 auto PropertyBindings::install(lua_State* L) -> void {
   lua_pushstring(L, kBinderKey);
@@ -217,20 +220,54 @@ auto PropertyBindings::GetFunction(size_t i) -> const LuaFunction& {
 template <class... Ts>
 inline constexpr bool always_false_v = false;
 
+// Properties that have been set since the last call to applyPending.
+static std::vector<Property*> sPendingProperties;
+// Properties whose bindings are currently being applied. Kept around between
+// frames so that its storage can be reused.
+static std::vector<Property*> sApplyingProperties;
+
+static std::atomic<uint32_t> sNumUpdates;
+static std::atomic<uint32_t> sNumCoalesced;
+
+auto Property::ValueDeleter::operator()(LuaValue* val) const -> void {
+  std::pmr::polymorphic_allocator<LuaValue>{&memory::kLuaResource}
+      .delete_object(val);
+}
+
 Property::Property(const LuaValue& val)
-    : value_(memory::SpiRamAllocator<LuaValue>().new_object<LuaValue>(val)),
+    : value_(std::pmr::polymorphic_allocator<LuaValue>{&memory::kLuaResource}
+                 .new_object<LuaValue>(val)),
       cb_(),
-      bindings_(&memory::kSpiRamResource) {}
+      bindings_(&memory::kLuaResource),
+      is_pending_(false) {}
 
 Property::Property(const LuaValue& val,
                    std::function<bool(const LuaValue& val)> cb)
-    : value_(memory::SpiRamAllocator<LuaValue>().new_object<LuaValue>(val)),
+    : value_(std::pmr::polymorphic_allocator<LuaValue>{&memory::kLuaResource}
+                 .new_object<LuaValue>(val)),
       cb_(cb),
-      bindings_(&memory::kSpiRamResource) {}
+      bindings_(&memory::kLuaResource),
+      is_pending_(false) {}
+
+Property::~Property() {
+  if (is_pending_) {
+    std::erase(sPendingProperties, this);
+    std::replace(sApplyingProperties.begin(), sApplyingProperties.end(), this,
+                 static_cast<Property*>(nullptr));
+  }
+}
 
 auto Property::setDirect(const LuaValue& val) -> void {
   *value_ = val;
-  reapplyAll();
+  sNumUpdates.fetch_add(1, std::memory_order_relaxed);
+  if (is_pending_) {
+    // Our bindings haven't been applied since the last update, so they'll
+    // only ever see this new value.
+    sNumCoalesced.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  is_pending_ = true;
+  sPendingProperties.push_back(this);
 }
 
 auto Property::set(const LuaValue& val) -> bool {
@@ -262,6 +299,12 @@ static void pushTrack(lua_State* L, const audio::TrackInfo& track) {
     lua_settable(L, -3);
   }
 
+  if (track.replay_gain) {
+    lua_pushliteral(L, "replay_gain_db");
+    lua_pushnumber(L, track.replay_gain.value() / 100.0);
+    lua_settable(L, -3);
+  }
+
   lua_pushliteral(L, "encoding");
   lua_pushstring(L, codecs::StreamTypeToString(track.encoding).c_str());
   lua_settable(L, -3);
@@ -393,6 +436,29 @@ auto Property::reapplyAll() -> void {
   }
 }
 
+auto Property::applyPending() -> void {
+  // Swap the lists rather than iterating over sPendingProperties directly,
+  // since bindings may set other properties whilst they're being applied.
+  // Those will be applied on the next frame.
+  sApplyingProperties.swap(sPendingProperties);
+  for (size_t i = 0; i < sApplyingProperties.size(); i++) {
+    Property* p = sApplyingProperties[i];
+    if (!p) {
+      continue;
+    }
+    p->is_pending_ = false;
+    p->reapplyAll();
+  }
+  sApplyingProperties.clear();
+}
+
+auto Property::stats() -> Stats {
+  return {
+      .updates = sNumUpdates.load(std::memory_order_relaxed),
+      .coalesced = sNumCoalesced.load(std::memory_order_relaxed),
+  };
+}
+
 auto Property::applySingle(lua_State* L, int ref, bool mark_dirty) -> bool {
   int top = lua_gettop(L);
 
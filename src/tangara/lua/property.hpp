@@ -34,18 +34,20 @@ class Property {
   Property() : Property(std::monostate{}) {}
   Property(const LuaValue&);
   Property(const LuaValue&, std::function<bool(const LuaValue&)> filter);
+  ~Property();
 
   auto get() -> const LuaValue& { return *value_; }
 
   /*
    * Assigns a new value to this property, bypassing the filter fn. All
-   * bindings will be marked as dirty, and if active, will be reapplied.
+   * bindings will be marked as dirty, and if active, will be reapplied during
+   * the next call to applyPending.
    */
   auto setDirect(const LuaValue&) -> void;
   /*
    * Invokes the filter fn, and if successful, assigns the new value to this
    * property. All bindings will be marked as dirty, and if active, will be
-   * reapplied.
+   * reapplied during the next call to applyPending.
    */
   auto set(const LuaValue&) -> bool;
 
@@ -58,13 +60,37 @@ class Property {
   /* Reapplies all active, dirty bindings associated with this Property. */
   auto reapplyAll() -> void;
 
+  /*
+   * Reapplies the bindings of every Property that has been set since the last
+   * call, using each one's latest value. Must be called only from the UI task;
+   * it's intended to be called once per frame, so that a Property that changes
+   * many times in quick succession only invokes its bindings once.
+   */
+  static auto applyPending() -> void;
+
+  struct Stats {
+    // How many times any Property has been set.
+    uint32_t updates;
+    // How many of those updates were superseded by a later one before their
+    // bindings were applied.
+    uint32_t coalesced;
+  };
+  static auto stats() -> Stats;
+
   auto addLuaBinding(lua_State*, int ref) -> void;
   auto applySingle(lua_State*, int ref, bool mark_dirty) -> bool;
 
  private:
-  std::unique_ptr<LuaValue> value_;
+  // Values are allocated from the Lua memory resource, so they must be given
+  // back to it rather than deleted.
+  struct ValueDeleter {
+    auto operator()(LuaValue*) const -> void;
+  };
+
+  std::unique_ptr<LuaValue, ValueDeleter> value_;
   std::optional<std::function<bool(const LuaValue&)>> cb_;
   std::pmr::vector<std::pair<lua_State*, int>> bindings_;
+  bool is_pending_;
 };
 
 /*
@@ -35,6 +35,7 @@
 #include "drivers/spiffs.hpp"
 #include "drivers/touchwheel.hpp"
 #include "events/event_queue.hpp"
+#include "perf.hpp"
 #include "system_fsm/service_locator.hpp"
 #include "system_fsm/system_events.hpp"
 #include "tasks.hpp"
@@ -123,6 +124,8 @@ auto Booting::exit() -> void {
   TimerHandle_t timer = xTimerCreate("INTERRUPTS", kInterruptCheckPeriod, true,
                                      NULL, check_interrupts_cb);
   xTimerStart(timer, portMAX_DELAY);
+
+  tasks::perf::StartSampling();
 }
 
 auto Booting::react(const BootComplete& ev) -> void {
@@ -16,6 +16,7 @@
 #include "result.hpp"
 
 #include "audio/audio_fsm.hpp"
+#include "audio/loudness.hpp"
 #include "drivers/storage.hpp"
 #include "events/event_queue.hpp"
 #include "system_fsm/system_events.hpp"
@@ -31,6 +32,8 @@ static const TickType_t kTicksBeforeUnmount = pdMS_TO_TICKS(10000);
 
 static TimerHandle_t sUnmountTimer = nullptr;
 
+static std::unique_ptr<audio::LoudnessScanner> sLoudnessScanner;
+
 static void timer_callback(TimerHandle_t timer) {
   events::System().Dispatch(internal::UnmountTimeout{});
 }
@@ -53,10 +56,16 @@ void Running::react(const KeyLockChanged& ev) {
 
 void Running::react(const audio::PlaybackUpdate& ev) {
   checkIdle();
+  checkLoudnessAnalysis();
 }
 
 void Running::react(const database::event::UpdateFinished&) {
   checkIdle();
+  checkLoudnessAnalysis();
+}
+
+void Running::react(const LoudnessAnalysisChanged&) {
+  checkLoudnessAnalysis();
 }
 
 void Running::react(const internal::UnmountTimeout&) {
@@ -139,6 +148,23 @@ auto Running::checkIdle() -> void {
   }
 }
 
+/*
+ * Loudness analysis needs a codec and a lot of reading from the sd card, so
+ * we only let it run whilst nothing is being played.
+ */
+auto Running::checkLoudnessAnalysis() -> void {
+  if (!sLoudnessScanner) {
+    return;
+  }
+  auto db = sServices->database().lock();
+  if (db && !db->isUpdating() && sServices->nvs().DbLoudnessAnalysis() &&
+      audio::AudioState::is_in_state<audio::states::Standby>()) {
+    sLoudnessScanner->start();
+  } else {
+    sLoudnessScanner->stop();
+  }
+}
+
 auto Running::updateSdState(drivers::SdState state) -> void {
   sServices->sd(state);
   events::Ui().Dispatch(SdStateChanged{});
@@ -195,6 +221,12 @@ void Running::react(const internal::Mount& ev) {
   ESP_LOGI(kTag, "storage loaded okay");
   updateSdState(drivers::SdState::kMounted);
 
+  if (!sLoudnessScanner) {
+    sLoudnessScanner = std::make_unique<audio::LoudnessScanner>(
+        sServices->database(), sServices->tag_parser(),
+        sServices->bg_worker());
+  }
+
   // Tell the database to refresh so that we pick up any changes from the newly
   // mounted card.
   if (sServices->nvs().DbAutoIndex()) {
@@ -209,11 +241,17 @@ void Running::react(const internal::Mount& ev) {
       }
       db->updateIndexes();
     });
+  } else {
+    // There's no update to wait for, so loudness analysis can start now.
+    checkLoudnessAnalysis();
   }
 }
 
 auto Running::unmountStorage() -> void {
   ESP_LOGW(kTag, "unmounting storage");
+  if (sLoudnessScanner) {
+    sLoudnessScanner->stop();
+  }
   sServices->track_queue().close();
   sServices->database({});
   sStorage.reset();
@@ -70,6 +70,12 @@ struct BluetoothEvent : tinyfsm::Event {
   drivers::bluetooth::Event event;
 };
 
+/*
+ * Sent when the user has enabled or disabled background loudness analysis of
+ * tracks in the database.
+ */
+struct LoudnessAnalysisChanged : tinyfsm::Event {};
+
 struct HapticTrigger : tinyfsm::Event {
   drivers::Haptics::Effect effect;
 };
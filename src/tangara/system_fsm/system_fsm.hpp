@@ -61,6 +61,7 @@ class SystemState : public tinyfsm::Fsm<SystemState> {
   virtual void react(const SamdUsbMscChanged&) {}
   virtual void react(const database::event::UpdateFinished&) {}
   virtual void react(const audio::PlaybackUpdate&) {}
+  virtual void react(const LoudnessAnalysisChanged&) {}
   virtual void react(const internal::IdleTimeout&) {}
   virtual void react(const internal::UnmountTimeout&) {}
   virtual void react(const internal::Mount&) {}
@@ -101,6 +102,7 @@ class Running : public SystemState {
   void react(const SdDetectChanged&) override;
   void react(const audio::PlaybackUpdate&) override;
   void react(const database::event::UpdateFinished&) override;
+  void react(const LoudnessAnalysisChanged&) override;
   void react(const SamdUsbMscChanged&) override;
   void react(const StorageError&) override;
 
@@ -111,6 +113,7 @@ class Running : public SystemState {
 
  private:
   auto checkIdle() -> void;
+  auto checkLoudnessAnalysis() -> void;
 
   auto updateSdState(drivers::SdState) -> void;
   auto unmountStorage() -> void;
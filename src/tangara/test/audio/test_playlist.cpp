@@ -9,9 +9,13 @@
 #include <dirent.h>
 
 #include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "catch2/catch.hpp"
 
+#include "database/buffered_file.hpp"
 #include "drivers/gpios.hpp"
 #include "drivers/i2c.hpp"
 #include "drivers/spi.hpp"
@@ -24,6 +28,25 @@ namespace audio {
 
 static const std::string kTestFilename = "test_playlist2.m3u";
 static const std::string kTestFilePath = kTestFilename;
+static const std::string kTestQueuePath = "test_queue";
+static constexpr uint32_t kTestGeneration = 1234;
+
+static auto writeLines(const std::string& path,
+                       const std::vector<std::string>& lines) -> bool {
+  FIL file;
+  if (f_open(&file, path.c_str(), FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+    return false;
+  }
+  bool ok = true;
+  for (const auto& line : lines) {
+    ok &= f_puts(line.c_str(), &file) >= 0;
+    ok &= f_putc('\n', &file) >= 0;
+  }
+  f_close(&file);
+  // Make sure we don't pick up a stale index for an older version of the file.
+  f_unlink((path + ".cache").c_str());
+  return ok;
+}
 
 TEST_CASE("playlist file", "[integration]") {
   I2CFixture i2c;
@@ -39,17 +62,228 @@ TEST_CASE("playlist file", "[integration]") {
   {
     std::unique_ptr<drivers::SdStorage> result(
         drivers::SdStorage::Create(*gpios).value());
-    MutablePlaylist plist(kTestFilePath);
+
+    SECTION("empty file appears empty") {
+      REQUIRE(writeLines(kTestFilePath, {}));
+
+      Playlist plist(kTestFilePath);
+      REQUIRE(plist.open());
+      REQUIRE(plist.buildIndex());
+      REQUIRE(plist.size() == 0);
+      REQUIRE(plist.value().empty());
+    }
+
+    SECTION("read from the playlist file") {
+      REQUIRE(writeLines(kTestFilePath, {
+                                            "#EXTM3U",
+                                            "test1.mp3",
+                                            "test2.mp3",
+                                            "",
+                                            "#EXTINF:123,Some Track",
+                                            "test3.mp3",
+                                            "test4.wav",
+                                            "directory/test1.mp3",
+                                            "directory/test2.mp3",
+                                            "a/really/long/directory/test1.mp3",
+                                            "directory/and/another/test2.mp3",
+                                        }));
+
+      Playlist plist(kTestFilePath);
+      REQUIRE(plist.open());
+      REQUIRE(plist.buildIndex());
+      REQUIRE(plist.size() == 8);
+      REQUIRE(plist.value() == "test1.mp3");
+      plist.next();
+      REQUIRE(plist.value() == "test2.mp3");
+      plist.next();
+      REQUIRE(plist.value() == "test3.mp3");
+      plist.prev();
+      REQUIRE(plist.value() == "test2.mp3");
+      plist.skipTo(7);
+      REQUIRE(plist.value() == "directory/and/another/test2.mp3");
+      REQUIRE(plist.valueAt(3) == "test4.wav");
+    }
+
+    SECTION("step backwards over comments and blank lines") {
+      // Long enough items that the file spans several of BufferedFile's
+      // buffers, so that scanning backwards has to refill.
+      auto item = [](size_t i) {
+        return "track " + std::to_string(i) + " " + std::string(200, 'x');
+      };
+      std::vector<std::string> lines{"#EXTM3U"};
+      for (size_t i = 0; i < 300; i++) {
+        if (i % 3 == 0) {
+          lines.push_back("#EXTINF:123,Track " + std::to_string(i));
+        }
+        if (i % 5 == 0) {
+          lines.push_back("");
+        }
+        lines.push_back(item(i));
+      }
+      REQUIRE(writeLines(kTestFilePath, lines));
+
+      Playlist plist(kTestFilePath);
+      REQUIRE(plist.open());
+      REQUIRE(plist.buildIndex());
+      REQUIRE(plist.size() == 300);
+
+      // Start at the end so that every step back moves before the start of
+      // the window of known offsets.
+      plist.skipTo(299);
+      REQUIRE(plist.value() == item(299));
+      for (size_t i = 299; i > 0; i--) {
+        plist.prev();
+        REQUIRE(plist.currentPosition() == i - 1);
+        REQUIRE(plist.value() == item(i - 1));
+      }
+    }
+
+    SECTION("lines longer than the read buffer") {
+      std::string long_item(database::BufferedFile::kBufferSize + 1000, 'a');
+      REQUIRE(writeLines(kTestFilePath, {
+                                            "first.mp3",
+                                            long_item,
+                                            "#" + long_item,
+                                            "last.mp3",
+                                        }));
+
+      Playlist plist(kTestFilePath);
+      REQUIRE(plist.open());
+      REQUIRE(plist.buildIndex());
+      REQUIRE(plist.size() == 3);
+      plist.next();
+      REQUIRE(plist.value() == long_item);
+      plist.next();
+      REQUIRE(plist.value() == "last.mp3");
+      plist.prev();
+      REQUIRE(plist.value() == long_item);
+      plist.prev();
+      REQUIRE(plist.value() == "first.mp3");
+    }
+
+    SECTION("index is built in the background") {
+      std::vector<std::string> lines;
+      for (size_t i = 0; i < 1000; i++) {
+        lines.push_back("track " + std::to_string(i));
+      }
+      REQUIRE(writeLines(kTestFilePath, lines));
+
+      Playlist plist(kTestFilePath);
+      REQUIRE(plist.open());
+      // Only the first item is available until the index is built.
+      REQUIRE(!plist.isIndexed());
+      REQUIRE(plist.size() == 1);
+      REQUIRE(plist.value() == "track 0");
+
+      bool res = false;
+      std::thread builder{[&]() { res = plist.buildIndex(); }};
+      builder.join();
+      REQUIRE(res);
+      REQUIRE(plist.isIndexed());
+      REQUIRE(plist.size() == 1000);
+      plist.skipTo(999);
+      REQUIRE(plist.value() == "track 999");
+
+      // The finished index is saved, so it doesn't need building again.
+      Playlist plist2(kTestFilePath);
+      REQUIRE(plist2.open());
+      REQUIRE(plist2.isIndexed());
+      REQUIRE(plist2.size() == 1000);
+    }
+
+    SECTION("closing the playlist stops its index being built") {
+      std::vector<std::string> lines;
+      for (size_t i = 0; i < 100000; i++) {
+        lines.push_back("track " + std::to_string(i));
+      }
+      REQUIRE(writeLines(kTestFilePath, lines));
+
+      {
+        Playlist plist(kTestFilePath);
+        REQUIRE(plist.open());
+        plist.close();
+        REQUIRE(!plist.buildIndex());
+      }
+
+      Playlist plist(kTestFilePath);
+      REQUIRE(plist.open());
+      REQUIRE(!plist.isIndexed());
+
+      bool res = false;
+      std::thread builder{[&]() { res = plist.buildIndex(); }};
+      // Wait for the build to get underway before closing.
+      while (plist.size() <= 1 && !plist.isIndexed()) {
+        std::this_thread::yield();
+      }
+      plist.close();
+      builder.join();
+
+      // The build may have managed to finish before the close, but if it
+      // didn't then it mustn't have saved a partial index.
+      REQUIRE(plist.isIndexed() == res);
+      Playlist plist2(kTestFilePath);
+      REQUIRE(plist2.open());
+      REQUIRE(plist2.isIndexed() == res);
+    }
+
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < 1000; i++) {
+      lines.push_back("track " + std::to_string(i));
+    }
+    REQUIRE(writeLines(kTestFilePath, lines));
+
+    BENCHMARK("opening large playlist file") {
+      Playlist plist(kTestFilePath);
+      REQUIRE(plist.open());
+      REQUIRE(plist.buildIndex());
+      REQUIRE(plist.size() == lines.size());
+      return plist.size();
+    };
+
+    BENCHMARK("seeking after opening a large file") {
+      Playlist plist(kTestFilePath);
+      REQUIRE(plist.open());
+      REQUIRE(plist.buildIndex());
+
+      plist.skipTo(500);
+      REQUIRE(plist.value() == "track 500");
+      plist.skipTo(999);
+      REQUIRE(plist.value() == "track 999");
+      plist.skipTo(1);
+      REQUIRE(plist.value() == "track 1");
+
+      return plist.size();
+    };
+  }
+}
+
+TEST_CASE("queue file", "[integration]") {
+  I2CFixture i2c;
+  SpiFixture spi;
+  std::unique_ptr<drivers::IGpios> gpios{drivers::Gpios::Create(false)};
+
+  if (gpios->Get(drivers::IGpios::Pin::kSdCardDetect)) {
+    // Skip if nothing is inserted.
+    SKIP("no sd card detected; skipping storage tests");
+    return;
+  }
+
+  {
+    std::unique_ptr<drivers::SdStorage> result(
+        drivers::SdStorage::Create(*gpios).value());
+    MutablePlaylist plist(kTestQueuePath);
+    REQUIRE(plist.open(kTestGeneration));
 
     SECTION("empty file appears empty") {
       REQUIRE(plist.clear());
 
       REQUIRE(plist.size() == 0);
       REQUIRE(plist.currentPosition() == 0);
-      REQUIRE(plist.value().empty());
+      REQUIRE(!plist.value());
     }
 
-    SECTION("write to the playlist file") {
+    SECTION("write to the queue file") {
+      REQUIRE(plist.clear());
       plist.append("test1.mp3");
       plist.append("test2.mp3");
       plist.append("test3.mp3");
@@ -60,16 +294,84 @@ TEST_CASE("playlist file", "[integration]") {
       plist.append("directory/and/another/test2.mp3");
       REQUIRE(plist.size() == 8);
 
-      SECTION("read from the playlist file") {
-        Playlist plist2(kTestFilePath);
-        REQUIRE(plist2.open());
+      SECTION("read from the queue file") {
+        MutablePlaylist plist2(kTestQueuePath);
+        REQUIRE(plist2.open(kTestGeneration));
         REQUIRE(plist2.size() == 8);
-        REQUIRE(plist2.value() == "test1.mp3");
+        REQUIRE(plist2.value() == MutablePlaylist::Item{"test1.mp3"});
         plist2.next();
-        REQUIRE(plist2.value() == "test2.mp3");
+        REQUIRE(plist2.value() == MutablePlaylist::Item{"test2.mp3"});
         plist2.prev();
-        REQUIRE(plist2.value() == "test1.mp3");
+        REQUIRE(plist2.value() == MutablePlaylist::Item{"test1.mp3"});
+      }
+    }
+
+    SECTION("track ids and paths can be mixed") {
+      REQUIRE(plist.clear());
+      plist.append(database::TrackId{42});
+      plist.append("test1.mp3");
+      plist.append(database::TrackId{7});
+      plist.append("test1.mp3");
+      REQUIRE(plist.size() == 4);
+
+      MutablePlaylist plist2(kTestQueuePath);
+      REQUIRE(plist2.open(kTestGeneration));
+      REQUIRE(plist2.size() == 4);
+      REQUIRE(plist2.value() == MutablePlaylist::Item{database::TrackId{42}});
+      plist2.skipTo(3);
+      REQUIRE(plist2.value() == MutablePlaylist::Item{"test1.mp3"});
+      plist2.skipTo(2);
+      REQUIRE(plist2.value() == MutablePlaylist::Item{database::TrackId{7}});
+    }
+
+    SECTION("paths containing newlines are skipped") {
+      REQUIRE(plist.clear());
+      plist.append("test1.mp3");
+      plist.append("two\nlines.mp3");
+      plist.append("test2.mp3");
+      REQUIRE(plist.size() == 2);
+
+      MutablePlaylist plist2(kTestQueuePath);
+      REQUIRE(plist2.open(kTestGeneration));
+      REQUIRE(plist2.size() == 2);
+      REQUIRE(plist2.value() == MutablePlaylist::Item{"test1.mp3"});
+      plist2.next();
+      REQUIRE(plist2.value() == MutablePlaylist::Item{"test2.mp3"});
+    }
+
+    SECTION("appending many track ids at once") {
+      REQUIRE(plist.clear());
+      plist.append("test1.mp3");
+      std::vector<database::TrackId> ids;
+      for (database::TrackId i = 0; i < 1000; i++) {
+        ids.push_back(i);
       }
+      // Ids this large can't be told apart from paths, so they're skipped.
+      ids.push_back(database::TrackId{1u << 31});
+      plist.appendMany(ids);
+      REQUIRE(plist.sync());
+      REQUIRE(plist.size() == 1001);
+
+      MutablePlaylist plist2(kTestQueuePath);
+      REQUIRE(plist2.open(kTestGeneration));
+      REQUIRE(plist2.size() == 1001);
+      REQUIRE(plist2.value() == MutablePlaylist::Item{"test1.mp3"});
+      plist2.skipTo(1);
+      REQUIRE(plist2.value() == MutablePlaylist::Item{database::TrackId{0}});
+      plist2.skipTo(1000);
+      REQUIRE(plist2.value() == MutablePlaylist::Item{database::TrackId{999}});
+    }
+
+    SECTION("queues from another database are discarded") {
+      REQUIRE(plist.clear());
+      plist.append(database::TrackId{42});
+      plist.append("test1.mp3");
+      REQUIRE(plist.size() == 2);
+
+      MutablePlaylist plist2(kTestQueuePath);
+      REQUIRE(plist2.open(kTestGeneration + 1));
+      REQUIRE(plist2.size() == 0);
+      REQUIRE(!plist2.value());
     }
 
     REQUIRE(plist.clear());
@@ -77,13 +379,13 @@ TEST_CASE("playlist file", "[integration]") {
     size_t tracks = 0;
 
     BENCHMARK("appending items") {
-      plist.append("track " + std::to_string(plist.size()));
+      plist.append(database::TrackId(plist.size()));
       return tracks++;
     };
 
     BENCHMARK("opening large playlist file") {
-      Playlist plist2(kTestFilePath);
-      REQUIRE(plist2.open());
+      MutablePlaylist plist2(kTestQueuePath);
+      REQUIRE(plist2.open(kTestGeneration));
       REQUIRE(plist2.size() == tracks);
       return plist2.size();
     };
@@ -92,34 +394,34 @@ TEST_CASE("playlist file", "[integration]") {
       REQUIRE(plist.size() == tracks);
 
       plist.skipTo(50);
-      REQUIRE(plist.value() == "track 50");
+      REQUIRE(plist.value() == MutablePlaylist::Item{database::TrackId{50}});
       plist.skipTo(99);
-      REQUIRE(plist.value() == "track 99");
+      REQUIRE(plist.value() == MutablePlaylist::Item{database::TrackId{99}});
       plist.skipTo(1);
-      REQUIRE(plist.value() == "track 1");
+      REQUIRE(plist.value() == MutablePlaylist::Item{database::TrackId{1}});
 
       return plist.size();
     };
 
     BENCHMARK("seeking after opening a large file") {
-      Playlist plist2(kTestFilePath);
-      REQUIRE(plist2.open());
+      MutablePlaylist plist2(kTestQueuePath);
+      REQUIRE(plist2.open(kTestGeneration));
       REQUIRE(plist.size() == tracks);
       REQUIRE(tracks >= 100);
 
       plist.skipTo(50);
-      REQUIRE(plist.value() == "track 50");
+      REQUIRE(plist.value() == MutablePlaylist::Item{database::TrackId{50}});
       plist.skipTo(99);
-      REQUIRE(plist.value() == "track 99");
+      REQUIRE(plist.value() == MutablePlaylist::Item{database::TrackId{99}});
       plist.skipTo(1);
-      REQUIRE(plist.value() == "track 1");
+      REQUIRE(plist.value() == MutablePlaylist::Item{database::TrackId{1}});
 
       return plist.size();
     };
 
     BENCHMARK("opening a large file and appending") {
-      MutablePlaylist plist2(kTestFilePath);
-      REQUIRE(plist2.open());
+      MutablePlaylist plist2(kTestQueuePath);
+      REQUIRE(plist2.open(kTestGeneration));
       REQUIRE(plist2.size() >= 100);
       plist2.append("A/Nother/New/Item.opus");
       return plist2.size();
@@ -25,6 +25,7 @@
 #include "drivers/display.hpp"
 #include "events/event_queue.hpp"
 #include "input/lvgl_input_driver.hpp"
+#include "lua/property.hpp"
 #include "tasks.hpp"
 #include "ui/ui_fsm.hpp"
 
@@ -62,6 +63,11 @@ auto UiTask::Main() -> void {
       input_->setGroup(current_group);
     }
 
+    // Apply property changes from the events we've just handled (and from
+    // Lua during the last frame) before drawing, so that each binding runs at
+    // most once per frame.
+    lua::Property::applyPending();
+
     TickType_t delay = lv_timer_handler();
     vTaskDelay(pdMS_TO_TICKS(std::clamp<TickType_t>(delay, 0, 100)));
   }
@@ -280,6 +280,17 @@ lua::Property UiState::sVolumeLimit{
       return true;
     }};
 
+lua::Property UiState::sVolumeReplayGain{
+    false, [](const lua::LuaValue& val) {
+      if (!std::holds_alternative<bool>(val)) {
+        return false;
+      }
+      events::Audio().Dispatch(audio::SetReplayGain{
+          .enabled = std::get<bool>(val),
+      });
+      return true;
+    }};
+
 lua::Property UiState::sDisplayBrightness{
     0, [](const lua::LuaValue& val) {
       std::optional<int> brightness = 0;
@@ -311,6 +322,16 @@ lua::Property UiState::sDatabaseAutoUpdate{
       return true;
     }};
 
+lua::Property UiState::sDatabaseAnalyseLoudness{
+    false, [](const lua::LuaValue& val) {
+      if (!std::holds_alternative<bool>(val)) {
+        return false;
+      }
+      sServices->nvs().DbLoudnessAnalysis(std::get<bool>(val));
+      events::System().Dispatch(system_fsm::LoudnessAnalysisChanged{});
+      return true;
+    }};
+
 lua::Property UiState::sSdMounted{false};
 
 lua::Property UiState::sUsbMassStorageEnabled{
@@ -665,6 +686,7 @@ void Lua::entry() {
                                    {"current_db", &sVolumeCurrentDb},
                                    {"left_bias", &sVolumeLeftBias},
                                    {"limit_db", &sVolumeLimit},
+                                   {"replay_gain", &sVolumeReplayGain},
                                });
 
     registry.AddPropertyModule("display",
@@ -703,10 +725,16 @@ void Lua::entry() {
         "time", {
                     {"ticks", [&](lua_State* s) { return Ticks(s); }},
                 });
+    registry.AddPropertyModule(
+        "memory", {
+                      {"usage", [&](lua_State* s) { return MemoryUsage(s); }},
+                  });
     registry.AddPropertyModule("database",
                                {
                                    {"updating", &sDatabaseUpdating},
                                    {"auto_update", &sDatabaseAutoUpdate},
+                                   {"analyse_loudness",
+                                    &sDatabaseAnalyseLoudness},
                                });
     registry.AddPropertyModule("sd_card", {
                                               {"mounted", &sSdMounted},
@@ -718,6 +746,8 @@ void Lua::entry() {
                                });
 
     sDatabaseAutoUpdate.setDirect(sServices->nvs().DbAutoIndex());
+    sDatabaseAnalyseLoudness.setDirect(sServices->nvs().DbLoudnessAnalysis());
+    sVolumeReplayGain.setDirect(sServices->nvs().ReplayGain());
 
     auto bt = sServices->bluetooth();
     sBluetoothEnabled.setDirect(bt.enabled());
@@ -746,7 +776,7 @@ auto Lua::PushLuaScreen(lua_State* s, bool replace) -> int {
   auto new_screen =
       std::allocate_shared<screens::Lua,
                            std::pmr::polymorphic_allocator<screens::Lua>>(
-          &memory::kSpiRamResource);
+          &memory::kUiResource);
 
   // Tell lvgl about the new roots.
   luavgl_set_root(s, new_screen->content());
@@ -809,6 +839,25 @@ auto Lua::Ticks(lua_State* s) -> int {
   return 1;
 }
 
+auto Lua::MemoryUsage(lua_State* s) -> int {
+  lua_createtable(s, 0, memory::kNumSubsystems);
+  for (size_t i = 0; i < memory::kNumSubsystems; i++) {
+    auto subsystem = static_cast<memory::Subsystem>(i);
+    auto usage = memory::GetUsage(subsystem);
+
+    lua_createtable(s, 0, 3);
+    lua_pushinteger(s, usage.live);
+    lua_setfield(s, -2, "live");
+    lua_pushinteger(s, usage.peak);
+    lua_setfield(s, -2, "peak");
+    lua_pushinteger(s, usage.allocs);
+    lua_setfield(s, -2, "allocs");
+
+    lua_setfield(s, -2, memory::SubsystemName(subsystem));
+  }
+  return 1;
+}
+
 auto Lua::ShowAlert(lua_State* s) -> int {
   if (!sCurrentScreen) {
     return 0;
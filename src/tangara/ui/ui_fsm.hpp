@@ -128,6 +128,7 @@ class UiState : public tinyfsm::Fsm<UiState> {
   static lua::Property sVolumeCurrentDb;
   static lua::Property sVolumeLeftBias;
   static lua::Property sVolumeLimit;
+  static lua::Property sVolumeReplayGain;
 
   static lua::Property sDisplayBrightness;
 
@@ -135,6 +136,7 @@ class UiState : public tinyfsm::Fsm<UiState> {
 
   static lua::Property sDatabaseUpdating;
   static lua::Property sDatabaseAutoUpdate;
+  static lua::Property sDatabaseAnalyseLoudness;
 
   static lua::Property sSdMounted;
 
@@ -174,6 +176,7 @@ class Lua : public UiState {
   auto HideAlert(lua_State*) -> int;
 
   auto Ticks(lua_State*) -> int;
+  auto MemoryUsage(lua_State*) -> int;
 
   auto SetPlaying(const lua::LuaValue&) -> bool;
   auto SetRandom(const lua::LuaValue&) -> bool;
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "perf.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+#include "esp_timer.h"
+
+namespace tasks {
+namespace perf {
+
+// Samples in bucket b are less than 2^(b + kFirstBucketBits) microseconds.
+static constexpr size_t kFirstBucketBits = 4;
+
+static constexpr int64_t kWindowMicros = 1000 * 1000;
+
+struct Window {
+  // The window's second since boot, plus one so that zero means unused.
+  std::atomic<uint32_t> second;
+  std::atomic<uint32_t> max;
+};
+
+struct Histogram {
+  std::atomic<uint32_t> count;
+  std::atomic<uint32_t> max;
+  std::array<std::atomic<uint32_t>, kNumBuckets> buckets;
+  std::array<Window, kNumWindows> windows;
+};
+
+// Kept in internal RAM; atomics in PSRAM aren't supported on the ESP32.
+static std::array<Histogram, kNumMetrics> sHistograms;
+
+static auto currentSecond() -> uint32_t {
+  return static_cast<uint32_t>(esp_timer_get_time() / kWindowMicros);
+}
+
+static auto bucketFor(uint32_t micros) -> size_t {
+  size_t width = std::bit_width(micros);
+  if (width <= kFirstBucketBits) {
+    return 0;
+  }
+  return std::min(width - kFirstBucketBits, kNumBuckets - 1);
+}
+
+static auto storeMax(std::atomic<uint32_t>& dest, uint32_t val) -> void {
+  uint32_t current = dest.load(std::memory_order_relaxed);
+  while (val > current &&
+         !dest.compare_exchange_weak(current, val, std::memory_order_relaxed)) {
+  }
+}
+
+auto Now() -> uint32_t {
+  return static_cast<uint32_t>(esp_timer_get_time());
+}
+
+auto Record(Metric m, uint32_t micros) -> void {
+  Histogram& h = sHistograms[static_cast<size_t>(m)];
+  h.count.fetch_add(1, std::memory_order_relaxed);
+  h.buckets[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+  storeMax(h.max, micros);
+
+  // Windows are reused in a ring, so the first sample in each new second has
+  // to clear out whatever was left from kNumWindows seconds ago. A sample that
+  // races with this may be lost, which is fine for our purposes.
+  uint32_t second = currentSecond();
+  Window& w = h.windows[second % kNumWindows];
+  uint32_t seen = w.second.load(std::memory_order_relaxed);
+  if (seen != second + 1 &&
+      w.second.compare_exchange_strong(seen, second + 1,
+                                       std::memory_order_relaxed)) {
+    w.max.store(0, std::memory_order_relaxed);
+  }
+  storeMax(w.max, micros);
+}
+
+auto Name(Metric m) -> const char* {
+  switch (m) {
+    case Metric::kUiEvents:
+      return "ui events";
+    case Metric::kSystemEvents:
+      return "sys events";
+    case Metric::kWorkHigh:
+      return "work high";
+    case Metric::kWorkNormal:
+      return "work normal";
+    case Metric::kWorkLow:
+      return "work low";
+    case Metric::kAudioCommands:
+      return "audio cmds";
+    case Metric::kDecode:
+      return "decode";
+    case Metric::kConvert:
+      return "convert";
+    case Metric::kSinkFill:
+      return "sink fill";
+    case Metric::kCount:
+      break;
+  }
+  return "unknown";
+}
+
+auto Summarise(Metric m) -> Summary {
+  const Histogram& h = sHistograms[static_cast<size_t>(m)];
+  Summary out{
+      .count = h.count.load(std::memory_order_relaxed),
+      .max = h.max.load(std::memory_order_relaxed),
+      .buckets = {},
+      .recent_max = {},
+  };
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    out.buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+  }
+
+  uint32_t now = currentSecond();
+  for (size_t i = 0; i < kNumWindows; i++) {
+    uint32_t second = now - (kNumWindows - 1) + i;
+    const Window& w = h.windows[second % kNumWindows];
+    if (w.second.load(std::memory_order_relaxed) == second + 1) {
+      out.recent_max[i] = w.max.load(std::memory_order_relaxed);
+    }
+  }
+  return out;
+}
+
+auto Percentile(const Summary& s, uint8_t percent) -> uint32_t {
+  if (s.count == 0) {
+    return 0;
+  }
+  uint64_t target = (static_cast<uint64_t>(s.count) * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets - 1; i++) {
+    seen += s.buckets[i];
+    if (seen >= target) {
+      return std::min<uint32_t>(1 << (i + kFirstBucketBits), s.max);
+    }
+  }
+  return s.max;
+}
+
+auto Reset() -> void {
+  for (auto& h : sHistograms) {
+    h.count.store(0, std::memory_order_relaxed);
+    h.max.store(0, std::memory_order_relaxed);
+    for (auto& b : h.buckets) {
+      b.store(0, std::memory_order_relaxed);
+    }
+    for (auto& w : h.windows) {
+      w.second.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+}  // namespace perf
+}  // namespace tasks
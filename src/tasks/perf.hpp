@@ -0,0 +1,110 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Lightweight, always-on profiling of how long things take. Other components
+ * record durations against a fixed set of metrics; these are kept as
+ * histograms that can be dumped (and reset) from the console with `perf`.
+ *
+ * Recording a sample is lock-free and allocation-free, so it's safe to do from
+ * any task, including the audio pipeline. It must not be done from an ISR.
+ */
+namespace tasks {
+namespace perf {
+
+enum class Metric {
+  // Time from an event being queued to it being handled.
+  kUiEvents,
+  kSystemEvents,
+  // Time from work being posted to a WorkerPool to it starting, by priority.
+  kWorkHigh,
+  kWorkNormal,
+  kWorkLow,
+  // Time from the decoder sending a command to the sample processor to the
+  // processor receiving it.
+  kAudioCommands,
+  // Time taken by each stage of the audio pipeline, per call.
+  kDecode,
+  kConvert,
+  kSinkFill,
+
+  kCount,
+};
+
+constexpr size_t kNumMetrics = static_cast<size_t>(Metric::kCount);
+
+/*
+ * Samples are bucketed by powers of two. The first bucket holds samples under
+ * 16us, and the last holds everything from 16ms upwards.
+ */
+constexpr size_t kNumBuckets = 12;
+
+/* How many seconds of recent history are kept for each metric and task. */
+constexpr size_t kNumWindows = 16;
+
+/* Returns a timestamp in microseconds, for measuring durations. Wraps. */
+auto Now() -> uint32_t;
+
+auto Record(Metric, uint32_t micros) -> void;
+
+inline auto RecordSince(Metric m, uint32_t start) -> void {
+  Record(m, Now() - start);
+}
+
+struct Summary {
+  // Samples recorded since the last reset.
+  uint32_t count;
+  uint32_t max;
+  std::array<uint32_t, kNumBuckets> buckets;
+  // The largest sample in each of the last kNumWindows seconds, oldest first.
+  // Zero for seconds without any samples.
+  std::array<uint32_t, kNumWindows> recent_max;
+};
+
+auto Name(Metric) -> const char*;
+auto Summarise(Metric) -> Summary;
+
+/*
+ * Returns an upper bound on the given percentile of a summary's samples, in
+ * microseconds, based on which bucket it falls into.
+ */
+auto Percentile(const Summary&, uint8_t percent) -> uint32_t;
+
+/*
+ * Starts sampling the CPU usage of every task once per second. Requires
+ * FreeRTOS's trace facility and run time stats; without them, this does
+ * nothing.
+ */
+auto StartSampling() -> void;
+
+struct TaskLoad {
+  std::string name;
+  // Percentage of CPU time used, averaged over the last kNumWindows seconds.
+  uint8_t average;
+  uint8_t peak;
+  // Percentage of CPU time used during each of the last kNumWindows seconds,
+  // oldest first.
+  std::array<uint8_t, kNumWindows> recent;
+};
+
+auto TaskLoads() -> std::vector<TaskLoad>;
+
+/*
+ * Clears all recorded histograms. Task loads only cover a fixed window of
+ * recent history, so they're left as-is.
+ */
+auto Reset() -> void;
+
+}  // namespace perf
+}  // namespace tasks
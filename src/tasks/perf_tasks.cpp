@@ -0,0 +1,158 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "perf.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "memory_resource.hpp"
+
+namespace tasks {
+namespace perf {
+
+// Extra room to leave in sStatus for tasks created after it was sized, so that
+// it doesn't need to grow every time a new task starts.
+static constexpr size_t kTaskHeadroom = 8;
+
+struct TaskHistory {
+  TaskHandle_t handle;
+  char name[configMAX_TASK_NAME_LEN];
+  uint32_t last_run_time;
+  std::array<uint8_t, kNumWindows> load;
+  bool seen;
+};
+
+static std::mutex sMutex;
+static std::pmr::vector<TaskHistory>* sHistory = nullptr;
+// Scratch space for uxTaskGetSystemState, so that sampling only allocates if
+// the number of tasks grows beyond its capacity.
+static TaskStatus_t* sStatus = nullptr;
+static size_t sStatusCapacity = 0;
+static uint32_t sLastTotalRunTime = 0;
+// The window that the next sample will be written to. This is also the oldest
+// window that we have.
+static size_t sNextWindow = 0;
+
+// Sampling needs both a list of every task, and how long each has run for.
+#define PERF_TASK_SAMPLING \
+  (configUSE_TRACE_FACILITY == 1 && configGENERATE_RUN_TIME_STATS == 1)
+
+#if PERF_TASK_SAMPLING
+static auto resizeStatus() -> void {
+  delete[] sStatus;
+  sStatusCapacity = uxTaskGetNumberOfTasks() + kTaskHeadroom;
+  sStatus = new TaskStatus_t[sStatusCapacity];
+}
+
+static auto sample(TimerHandle_t) -> void {
+  uint32_t total_run_time = 0;
+  size_t num_tasks =
+      uxTaskGetSystemState(sStatus, sStatusCapacity, &total_run_time);
+  if (num_tasks == 0) {
+    // uxTaskGetSystemState fills in nothing at all if there are more tasks than
+    // will fit. Make room for them all, and catch up on the next sample.
+    resizeStatus();
+    return;
+  }
+  uint32_t elapsed = total_run_time - sLastTotalRunTime;
+  sLastTotalRunTime = total_run_time;
+  if (elapsed == 0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock{sMutex};
+  for (auto& h : *sHistory) {
+    h.seen = false;
+  }
+
+  for (size_t i = 0; i < num_tasks; i++) {
+    const TaskStatus_t& status = sStatus[i];
+    auto it = std::find_if(
+        sHistory->begin(), sHistory->end(),
+        [&](const auto& h) { return h.handle == status.xHandle; });
+    if (it == sHistory->end()) {
+      // We don't know how much of the elapsed time belonged to a new task, so
+      // start counting from the next sample.
+      TaskHistory h{
+          .handle = status.xHandle,
+          .name = {},
+          .last_run_time = status.ulRunTimeCounter,
+          .load = {},
+          .seen = true,
+      };
+      std::strncpy(h.name, status.pcTaskName, sizeof(h.name) - 1);
+      sHistory->push_back(h);
+      continue;
+    }
+    uint32_t ran_for = status.ulRunTimeCounter - it->last_run_time;
+    it->last_run_time = status.ulRunTimeCounter;
+    uint64_t percent = static_cast<uint64_t>(ran_for) * 100 / elapsed;
+    it->load[sNextWindow] = std::min<uint64_t>(100, percent);
+    it->seen = true;
+  }
+
+  // Forget about any tasks that have since been deleted.
+  std::erase_if(*sHistory, [](const auto& h) { return !h.seen; });
+
+  sNextWindow = (sNextWindow + 1) % kNumWindows;
+}
+#endif
+
+auto StartSampling() -> void {
+#if !PERF_TASK_SAMPLING
+  // TaskLoads() stays empty.
+  return;
+#else
+  std::lock_guard<std::mutex> lock{sMutex};
+  if (sHistory) {
+    return;
+  }
+  sHistory = new std::pmr::vector<TaskHistory>(&memory::kSpiRamResource);
+  resizeStatus();
+  sHistory->reserve(sStatusCapacity);
+
+  TimerHandle_t timer =
+      xTimerCreate("perf", pdMS_TO_TICKS(1000), pdTRUE, NULL, sample);
+  xTimerStart(timer, portMAX_DELAY);
+#endif
+}
+
+auto TaskLoads() -> std::vector<TaskLoad> {
+  std::vector<TaskLoad> out;
+  std::lock_guard<std::mutex> lock{sMutex};
+  if (!sHistory) {
+    return out;
+  }
+  for (const auto& h : *sHistory) {
+    TaskLoad load{
+        .name = h.name,
+        .average = 0,
+        .peak = 0,
+        .recent = {},
+    };
+    uint32_t sum = 0;
+    for (size_t i = 0; i < kNumWindows; i++) {
+      uint8_t val = h.load[(sNextWindow + i) % kNumWindows];
+      load.recent[i] = val;
+      load.peak = std::max(load.peak, val);
+      sum += val;
+    }
+    load.average = sum / kNumWindows;
+    out.push_back(std::move(load));
+  }
+  return out;
+}
+
+}  // namespace perf
+}  // namespace tasks
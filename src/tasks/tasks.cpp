@@ -6,13 +6,18 @@
 
 #include "tasks.hpp"
 
+#include <cassert>
 #include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
 
 #include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/portmacro.h"
 
 #include "memory_resource.hpp"
+#include "perf.hpp"
 
 namespace tasks {
 
@@ -112,22 +117,160 @@ auto PersistentMain(void* fn) -> void {
   vTaskDelete(NULL);
 }
 
-auto WorkerPool::Main(void* q) {
-  QueueHandle_t queue = reinterpret_cast<QueueHandle_t>(q);
+static constexpr size_t kMaxLowPriorityRunning = WorkerPool::kNumWorkers - 1;
+
+WorkerPool::Worker::Worker()
+    : pool(nullptr),
+      index(0),
+      task(nullptr),
+      mutex(),
+      queues{
+          WorkQueue{&memory::kSpiRamResource},
+          WorkQueue{&memory::kSpiRamResource},
+          WorkQueue{&memory::kSpiRamResource},
+      } {}
+
+static auto latencyMetric(WorkPriority p) -> perf::Metric {
+  switch (p) {
+    case WorkPriority::kHigh:
+      return perf::Metric::kWorkHigh;
+    case WorkPriority::kNormal:
+      return perf::Metric::kWorkNormal;
+    case WorkPriority::kLow:
+      return perf::Metric::kWorkLow;
+  }
+  return perf::Metric::kWorkNormal;
+}
+
+auto WorkerPool::Main(void* w) {
+  Worker& self = *reinterpret_cast<Worker*>(w);
+  WorkerPool& pool = *self.pool;
+  self.task = xTaskGetCurrentTaskHandle();
   while (1) {
-    WorkItem item;
-    if (xQueueReceive(queue, &item, portMAX_DELAY)) {
-      std::invoke(*item);
-      delete item;
+    auto next = pool.Take(self);
+    if (!next) {
+      // Check again whilst holding the idle lock, so that we can't miss a
+      // wakeup from work that was pushed after our first check.
+      std::unique_lock<std::mutex> lock{pool.idle_mutex_};
+      next = pool.Take(self);
+      if (!next) {
+        pool.idle_workers_ |= 1 << self.index;
+        lock.unlock();
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        continue;
+      }
     }
+
+    auto& [work, priority] = *next;
+    perf::RecordSince(latencyMetric(priority), work.queued_at);
+    if (!work.token.cancelled()) {
+      std::invoke(work.fn);
+    }
+
+    if (priority == WorkPriority::kLow) {
+      pool.num_low_running_--;
+    }
+  }
+}
+
+auto WorkerPool::Post(WorkItem item, WorkPriority priority) -> void {
+  Enqueue({.fn = std::move(item), .queued_at = perf::Now()}, priority);
+}
+
+auto WorkerPool::Post(WorkItem item,
+                      WorkPriority priority,
+                      const CancellationToken& token) -> void {
+  // The token is kept alongside the work rather than captured by it, so that
+  // it doesn't take up any of the WorkItem's inline storage.
+  Enqueue({.fn = std::move(item), .queued_at = perf::Now(), .token = token},
+          priority);
+}
+
+auto WorkerPool::Enqueue(QueuedWork&& work, WorkPriority priority) -> void {
+  // Work dispatched from a worker is usually a continuation of that worker's
+  // current work, so keep it local. Anything else is spread evenly.
+  Worker* target = CurrentWorker();
+  if (!target) {
+    target = &workers_[next_worker_++ % kNumWorkers];
+  }
+  {
+    std::lock_guard<std::mutex> lock{target->mutex};
+    target->queues[static_cast<size_t>(priority)].push_back(std::move(work));
+  }
+
+  std::lock_guard<std::mutex> lock{idle_mutex_};
+  if (idle_workers_ == 0) {
+    // Every worker is busy; the next one to finish will pick this up.
+    return;
+  }
+  // Prefer waking the worker that now owns the item.
+  size_t to_wake = target->index;
+  if (!(idle_workers_ & (1 << to_wake))) {
+    to_wake = __builtin_ctz(idle_workers_);
   }
+  idle_workers_ &= ~(1 << to_wake);
+  xTaskNotifyGive(workers_[to_wake].task);
 }
 
-static constexpr size_t kNumWorkers = 4;
-static constexpr size_t kMaxPendingItems = 8;
+auto WorkerPool::Take(Worker& self)
+    -> std::optional<std::pair<QueuedWork, WorkPriority>> {
+  for (size_t p = 0; p < kNumPriorities; p++) {
+    auto priority = static_cast<WorkPriority>(p);
+
+    if (priority == WorkPriority::kLow) {
+      // Claim a slot for low priority work before looking for any.
+      size_t running = num_low_running_;
+      do {
+        if (running >= kMaxLowPriorityRunning) {
+          return {};
+        }
+      } while (!num_low_running_.compare_exchange_weak(running, running + 1));
+    }
+
+    for (size_t i = 0; i < kNumWorkers; i++) {
+      Worker& victim = workers_[(self.index + i) % kNumWorkers];
+      auto item = TryTakeFrom(victim, priority, i != 0);
+      if (item) {
+        return std::make_pair(std::move(*item), priority);
+      }
+    }
+
+    if (priority == WorkPriority::kLow) {
+      num_low_running_--;
+    }
+  }
+  return {};
+}
+
+auto WorkerPool::TryTakeFrom(Worker& victim, WorkPriority priority, bool steal)
+    -> std::optional<QueuedWork> {
+  std::lock_guard<std::mutex> lock{victim.mutex};
+  auto& queue = victim.queues[static_cast<size_t>(priority)];
+  if (queue.empty()) {
+    return {};
+  }
+  if (steal) {
+    return queue.pop_front();
+  }
+  return queue.pop_back();
+}
+
+auto WorkerPool::CurrentWorker() -> Worker* {
+  TaskHandle_t current = xTaskGetCurrentTaskHandle();
+  for (auto& worker : workers_) {
+    if (worker.task == current) {
+      return &worker;
+    }
+  }
+  return nullptr;
+}
 
 WorkerPool::WorkerPool()
-    : queue_(xQueueCreate(kMaxPendingItems, sizeof(WorkItem))) {
+    : workers_(),
+      next_worker_(0),
+      num_low_running_(0),
+      idle_workers_(0),
+      completions_(&memory::kSpiRamResource) {
   for (size_t i = 0; i < kNumWorkers; i++) {
     auto stack = AllocateStack<Type::kBackgroundWorker>();
     // Task buffers must be in internal ram. Thankfully they're fairly small.
@@ -136,8 +279,13 @@ WorkerPool::WorkerPool()
 
     std::string name = "worker_" + std::to_string(i);
 
-    xTaskCreateStatic(&Main, name.c_str(), stack.size(), queue_,
-                      Priority<Type::kBackgroundWorker>(), stack.data(),
+    // The worker records its own task handle once it starts. It can't be woken
+    // before then, since it isn't marked as idle until it has started.
+    Worker& worker = workers_[i];
+    worker.pool = this;
+    worker.index = i;
+    xTaskCreateStatic(&Main, name.c_str(), stack.size(), &worker,
+                      tasks::Priority<Type::kBackgroundWorker>(), stack.data(),
                       buffer);
   }
 }
@@ -147,17 +295,4 @@ WorkerPool::~WorkerPool() {
   assert("worker pool destroyed" == 0);
 }
 
-template <>
-auto WorkerPool::Dispatch(const std::function<void(void)> fn)
-    -> std::future<void> {
-  std::shared_ptr<std::promise<void>> promise =
-      std::make_shared<std::promise<void>>();
-  WorkItem item = new std::function<void(void)>([=]() {
-    std::invoke(fn);
-    promise->set_value();
-  });
-  xQueueSend(queue_, &item, portMAX_DELAY);
-  return promise->get_future();
-}
-
 }  // namespace tasks
@@ -6,13 +6,19 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <memory>
 #include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <span>
 #include <string>
+#include <type_traits>
+#include <utility>
 
 #include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
@@ -21,6 +27,8 @@
 #include "freertos/queue.h"
 #include "freertos/task.h"
 
+#include "work_item.hpp"
+
 namespace tasks {
 
 /*
@@ -73,37 +81,110 @@ auto StartPersistent(BaseType_t core, const std::function<void(void)>& fn)
                                 Priority<t>(), stack.data(), task_buffer, core);
 }
 
-class WorkerPool {
- private:
-  QueueHandle_t queue_;
-  using WorkItem = std::function<void(void)>*;
-  static auto Main(void* instance);
+/*
+ * How urgently a piece of background work needs to be run. Workers always take
+ * the most urgent work available, from any worker.
+ */
+enum class WorkPriority {
+  // Work that must not be delayed, such as keeping audio buffers filled.
+  kHigh = 0,
+  // Work that the user is probably waiting on, such as UI-triggered queries.
+  kNormal = 1,
+  // Long-running bulk work, such as indexing or loudness analysis. At most
+  // kNumWorkers - 1 low priority items are run at once, so that there is
+  // always a worker available for more urgent work.
+  kLow = 2,
+};
 
+class WorkerPool {
  public:
+  static constexpr size_t kNumWorkers = 4;
+
   WorkerPool();
   ~WorkerPool();
 
   /*
-   * Schedules the given function to be executed on the worker task, and
-   * asynchronously returns the result as a future.
+   * Schedules the given function to be executed on a worker task, without
+   * any way to wait for its result. Prefer this to Dispatch wherever the
+   * result isn't needed; it makes no allocations for most functions.
+   */
+  auto Post(WorkItem fn, WorkPriority priority = WorkPriority::kNormal)
+      -> void;
+
+  /*
+   * Schedules the given function to be executed on a worker task, unless the
+   * token is cancelled before it starts.
+   */
+  auto Post(WorkItem fn, WorkPriority priority, const CancellationToken& token)
+      -> void;
+
+  /*
+   * Schedules the given function to be executed on a worker task, and
+   * asynchronously returns the result as a future. The future's shared state
+   * comes from a pool owned by the WorkerPool, so this avoids the heap once
+   * the pool is warm.
    */
-  template <typename T>
-  auto Dispatch(const std::function<T(void)> fn) -> std::future<T> {
-    std::shared_ptr<std::promise<T>> promise =
-        std::make_shared<std::promise<T>>();
-    WorkItem item =
-        new std::function([=]() { promise->set_value(std::invoke(fn)); });
-    xQueueSend(queue_, &item, portMAX_DELAY);
-    return promise->get_future();
+  template <typename T, typename F>
+  auto Dispatch(F&& fn, WorkPriority priority = WorkPriority::kNormal)
+      -> std::future<T> {
+    std::promise<T> promise{std::allocator_arg,
+                            std::pmr::polymorphic_allocator<T>{&completions_}};
+    std::future<T> future = promise.get_future();
+    Post(
+        [fn = std::forward<F>(fn), promise = std::move(promise)]() mutable {
+          if constexpr (std::is_void_v<T>) {
+            std::invoke(fn);
+            promise.set_value();
+          } else {
+            promise.set_value(std::invoke(fn));
+          }
+        },
+        priority);
+    return future;
   }
 
   WorkerPool(const WorkerPool&) = delete;
   WorkerPool& operator=(const WorkerPool&) = delete;
-};
 
-/* Specialisation of Evaluate for functions that return nothing. */
-template <>
-auto WorkerPool::Dispatch(const std::function<void(void)> fn)
-    -> std::future<void>;
+ private:
+  static constexpr size_t kNumPriorities = 3;
+
+  /*
+   * Each worker owns a queue of pending work for each priority. Workers run
+   * their own most recently added work first, and steal the oldest work from
+   * other workers when they have none of their own at that priority.
+   */
+  struct Worker {
+    Worker();
+
+    WorkerPool* pool;
+    size_t index;
+    std::atomic<TaskHandle_t> task;
+
+    std::mutex mutex;
+    std::array<WorkQueue, kNumPriorities> queues;
+  };
+
+  static auto Main(void* worker);
+
+  auto Enqueue(QueuedWork&&, WorkPriority) -> void;
+
+  auto Take(Worker& self)
+      -> std::optional<std::pair<QueuedWork, WorkPriority>>;
+  auto TryTakeFrom(Worker& victim, WorkPriority, bool steal)
+      -> std::optional<QueuedWork>;
+  auto CurrentWorker() -> Worker*;
+
+  std::array<Worker, kNumWorkers> workers_;
+  std::atomic<size_t> next_worker_;
+  std::atomic<size_t> num_low_running_;
+
+  // Bitset of the workers that are waiting for work.
+  std::mutex idle_mutex_;
+  uint32_t idle_workers_;
+
+  // Shared states for the futures returned by Dispatch.
+  std::pmr::synchronized_pool_resource completions_;
+};
 
 }  // namespace tasks
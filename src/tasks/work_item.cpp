@@ -0,0 +1,83 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "work_item.hpp"
+
+#include <cstddef>
+#include <utility>
+
+namespace tasks {
+
+static constexpr size_t kInitialCapacity = 16;
+
+auto CancellationToken::Create() -> CancellationToken {
+  return CancellationToken{std::make_shared<std::atomic<bool>>(false)};
+}
+
+auto CancellationToken::cancel() -> void {
+  if (cancelled_) {
+    *cancelled_ = true;
+  }
+}
+
+auto CancellationToken::cancelled() const -> bool {
+  return cancelled_ && *cancelled_;
+}
+
+WorkQueue::WorkQueue(std::pmr::memory_resource* res)
+    : alloc_(res), items_(nullptr), capacity_(0), head_(0), size_(0) {}
+
+WorkQueue::~WorkQueue() {
+  while (!empty()) {
+    pop_front();
+  }
+  if (items_) {
+    alloc_.deallocate(items_, capacity_);
+  }
+}
+
+auto WorkQueue::push_back(QueuedWork&& item) -> void {
+  if (size_ == capacity_) {
+    grow();
+  }
+  new (&items_[(head_ + size_) & (capacity_ - 1)]) QueuedWork(std::move(item));
+  size_++;
+}
+
+auto WorkQueue::pop_front() -> QueuedWork {
+  QueuedWork& front = items_[head_];
+  QueuedWork out{std::move(front)};
+  front.~QueuedWork();
+  head_ = (head_ + 1) & (capacity_ - 1);
+  size_--;
+  return out;
+}
+
+auto WorkQueue::pop_back() -> QueuedWork {
+  QueuedWork& back = items_[(head_ + size_ - 1) & (capacity_ - 1)];
+  QueuedWork out{std::move(back)};
+  back.~QueuedWork();
+  size_--;
+  return out;
+}
+
+auto WorkQueue::grow() -> void {
+  size_t new_capacity = capacity_ == 0 ? kInitialCapacity : capacity_ * 2;
+  QueuedWork* new_items = alloc_.allocate(new_capacity);
+  for (size_t i = 0; i < size_; i++) {
+    QueuedWork& old = items_[(head_ + i) & (capacity_ - 1)];
+    new (&new_items[i]) QueuedWork(std::move(old));
+    old.~QueuedWork();
+  }
+  if (items_) {
+    alloc_.deallocate(items_, capacity_);
+  }
+  items_ = new_items;
+  capacity_ = new_capacity;
+  head_ = 0;
+}
+
+}  // namespace tasks
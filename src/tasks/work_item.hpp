@@ -0,0 +1,197 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tasks {
+
+/*
+ * A move-only function taking and returning nothing, for work that is
+ * dispatched to a WorkerPool.
+ *
+ * Unlike std::function, a WorkItem stores its callable inline whenever it fits
+ * within kInlineSize bytes, which covers the captures of nearly every lambda
+ * that we dispatch. This means that creating, queueing, and running a WorkItem
+ * usually makes no heap allocations at all. Larger callables still work, but
+ * are moved onto the heap.
+ */
+class WorkItem {
+ public:
+  static constexpr size_t kInlineSize = 64;
+
+  WorkItem() : ops_(nullptr) {}
+
+  template <typename F,
+            typename = std::enable_if_t<
+                !std::is_same_v<std::remove_cvref_t<F>, WorkItem>>>
+  WorkItem(F&& fn) : ops_(&OpsFor<std::remove_cvref_t<F>>::kOps) {
+    using Fn = std::remove_cvref_t<F>;
+    if constexpr (isInline<Fn>()) {
+      new (storage_) Fn(std::forward<F>(fn));
+    } else {
+      new (storage_) Fn*(new Fn(std::forward<F>(fn)));
+    }
+  }
+
+  WorkItem(WorkItem&& other) noexcept : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(storage_, other.storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  WorkItem& operator=(WorkItem&& other) noexcept {
+    if (this != &other) {
+      reset();
+      ops_ = other.ops_;
+      if (ops_) {
+        ops_->move(storage_, other.storage_);
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  ~WorkItem() { reset(); }
+
+  auto operator()() -> void { ops_->invoke(storage_); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  WorkItem(const WorkItem&) = delete;
+  WorkItem& operator=(const WorkItem&) = delete;
+
+ private:
+  struct Ops {
+    void (*invoke)(void*);
+    // Move-constructs into the first argument, and destroys the second.
+    void (*move)(void*, void*);
+    void (*destroy)(void*);
+  };
+
+  template <typename Fn>
+  static constexpr auto isInline() -> bool {
+    return sizeof(Fn) <= kInlineSize &&
+           alignof(Fn) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible_v<Fn>;
+  }
+
+  template <typename Fn>
+  struct OpsFor {
+    static auto get(void* s) -> Fn& {
+      if constexpr (isInline<Fn>()) {
+        return *std::launder(reinterpret_cast<Fn*>(s));
+      } else {
+        return **std::launder(reinterpret_cast<Fn**>(s));
+      }
+    }
+
+    static constexpr Ops kOps{
+        .invoke = [](void* s) { std::invoke(get(s)); },
+        .move =
+            [](void* dest, void* src) {
+              if constexpr (isInline<Fn>()) {
+                new (dest) Fn(std::move(get(src)));
+                get(src).~Fn();
+              } else {
+                new (dest) Fn*(*reinterpret_cast<Fn**>(src));
+              }
+            },
+        .destroy =
+            [](void* s) {
+              if constexpr (isInline<Fn>()) {
+                get(s).~Fn();
+              } else {
+                delete &get(s);
+              }
+            },
+    };
+  };
+
+  auto reset() -> void {
+    if (ops_) {
+      ops_->destroy(storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  alignas(std::max_align_t) std::byte storage_[kInlineSize];
+  const Ops* ops_;
+};
+
+/*
+ * Handle used to cancel work that has been dispatched to a WorkerPool.
+ * Cancelled work that hasn't started yet is never run. Long-running work may
+ * also check `cancelled()` itself in order to finish early.
+ *
+ * Copies of a token all refer to the same underlying flag. Default-constructed
+ * tokens can never be cancelled.
+ */
+class CancellationToken {
+ public:
+  static auto Create() -> CancellationToken;
+
+  CancellationToken() : cancelled_() {}
+
+  auto cancel() -> void;
+  auto cancelled() const -> bool;
+
+ private:
+  CancellationToken(std::shared_ptr<std::atomic<bool>> c) : cancelled_(c) {}
+  std::shared_ptr<std::atomic<bool>> cancelled_;
+};
+
+/* A WorkItem waiting in a WorkQueue. */
+struct QueuedWork {
+  WorkItem fn;
+  // When the work was queued, from perf::Now().
+  uint32_t queued_at;
+  // The work is dropped instead of run if this is cancelled whilst queued.
+  CancellationToken token = {};
+};
+
+/*
+ * A double-ended queue of work, stored in a ring buffer that grows as
+ * needed. Unlike std::deque, pushing and popping never allocates once the
+ * queue has grown to its working size.
+ */
+class WorkQueue {
+ public:
+  explicit WorkQueue(std::pmr::memory_resource*);
+  ~WorkQueue();
+
+  auto empty() const -> bool { return size_ == 0; }
+  auto size() const -> size_t { return size_; }
+
+  auto push_back(QueuedWork&&) -> void;
+  auto pop_front() -> QueuedWork;
+  auto pop_back() -> QueuedWork;
+
+  WorkQueue(const WorkQueue&) = delete;
+  WorkQueue& operator=(const WorkQueue&) = delete;
+
+ private:
+  auto grow() -> void;
+
+  std::pmr::polymorphic_allocator<QueuedWork> alloc_;
+  QueuedWork* items_;
+  // Always a power of two, so that indexes can wrap with a mask.
+  size_t capacity_;
+  size_t head_;
+  size_t size_;
+};
+
+}  // namespace tasks
@@ -6,76 +6,229 @@
 
 #pragma once
 
-#include <algorithm>
-#include <bitset>
+#include <array>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
-#include <list>
-#include <map>
 #include <optional>
-#include <unordered_map>
+#include <string_view>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
-#include "memory_resource.hpp"
+#include "komihash.h"
 
 namespace util {
 
+/*
+ * Hashes keys for an LruCache. Keys that look like strings (e.g. std::string,
+ * std::pmr::string, std::string_view) hash their contents, so that they can be
+ * looked up by any other string type without a conversion. Other keys must be
+ * trivially copyable, and hash their bytes.
+ */
+template <typename K>
+auto LruHash(const K& key) -> uint64_t {
+  if constexpr (std::is_convertible_v<const K&, std::string_view>) {
+    std::string_view str{key};
+    return komihash(str.data(), str.size(), 0);
+  } else {
+    static_assert(std::is_trivially_copyable_v<K>);
+    return komihash(&key, sizeof(K), 0);
+  }
+}
+
 /*
  * Basic least recently used cache. Stores the `Size` most recently accessed
  * entries in memory.
  *
- * Not safe for use from multiple tasks, but all operations are constant time.
+ * Entries are stored inline in a fixed array, and linked together by index in
+ * order of use. They're found through a small open-addressing hash table, with
+ * each entry's hash computed once when it's inserted. Every operation is a
+ * single hash lookup plus constant time bookkeeping, and no operation
+ * allocates (besides whatever copying the keys and values does).
+ *
+ * Not safe for use from multiple tasks.
  */
 template <int Size, typename K, typename V>
 class LruCache {
+  static_assert(Size > 0 && Size < UINT16_MAX / 2);
+
  public:
-  LruCache()
-      : entries_(&memory::kSpiRamResource),
-        key_to_it_(&memory::kSpiRamResource) {}
+  LruCache() : nodes_(), slots_(), head_(kNone), tail_(kNone), size_(0) {}
 
   auto Put(K key, V val) -> void {
-    if (key_to_it_.contains(key)) {
-      // This key was already present. Overwrite by removing the previous
-      // value.
-      entries_.erase(key_to_it_[key]);
-      key_to_it_.erase(key);
-    } else if (entries_.size() >= Size) {
-      // Cache is full. Evict the last entry.
-      key_to_it_.erase(entries_.back().first);
-      entries_.pop_back();
+    uint64_t hash = LruHash(key);
+    size_t slot = find(hash, key);
+    if (slots_[slot] != kEmpty) {
+      // This key was already present; overwrite its value.
+      uint16_t i = slots_[slot] - 1;
+      nodes_[i].entry->second = std::move(val);
+      moveToFront(i);
+      return;
+    }
+
+    uint16_t i;
+    if (size_ < Size) {
+      i = size_++;
+    } else {
+      // Cache is full. Evict the least recently used entry, and reuse its
+      // node. Removing it from the table may shuffle other slots around, so we
+      // need to look again for where the new key goes.
+      i = tail_;
+      erase(find(nodes_[i].hash, nodes_[i].entry->first));
+      unlink(i);
+      slot = find(hash, key);
     }
 
-    // Add the new value.
-    entries_.push_front({key, val});
-    key_to_it_[key] = entries_.begin();
+    nodes_[i].hash = hash;
+    nodes_[i].entry.emplace(std::move(key), std::move(val));
+    slots_[slot] = i + 1;
+    pushFront(i);
   }
 
-  auto Get(K key) -> std::optional<V> {
-    if (!key_to_it_.contains(key)) {
+  /*
+   * Returns the value for the given key, and marks it as the most recently
+   * used. The key may be of any type that can be hashed and compared with K.
+   */
+  template <typename Q>
+  auto Get(const Q& key) -> std::optional<V> {
+    size_t slot = find(LruHash(key), key);
+    if (slots_[slot] == kEmpty) {
       return {};
     }
-    // Use splice() to move the entry to the front of the list. This approach
-    // doesn't invalidate any of the iterators in key_to_it_, and is constant
-    // time.
-    auto it = key_to_it_[key];
-    entries_.splice(entries_.begin(), entries_, it);
-    return it->second;
+    uint16_t i = slots_[slot] - 1;
+    moveToFront(i);
+    return nodes_[i].entry->second;
+  }
+
+  /*
+   * Returns the value for the given key without marking it as used, so that
+   * concurrent readers may share access to the cache.
+   */
+  template <typename Q>
+  auto Peek(const Q& key) const -> std::optional<V> {
+    size_t slot = find(LruHash(key), key);
+    if (slots_[slot] == kEmpty) {
+      return {};
+    }
+    return nodes_[slots_[slot] - 1].entry->second;
   }
 
   auto Clear() -> void {
-    entries_.clear();
-    key_to_it_.clear();
+    for (auto& n : nodes_) {
+      n.entry.reset();
+    }
+    slots_.fill(kEmpty);
+    head_ = tail_ = kNone;
+    size_ = 0;
   }
 
+  /* Returns every entry, from most to least recently used. */
   auto Get() const -> std::vector<std::pair<K, V>> {
     std::vector<std::pair<K, V>> out;
-    out.resize(entries_.size());
-    std::copy(entries_.begin(), entries_.end(), out.begin());
+    out.reserve(size_);
+    for (uint16_t i = head_; i != kNone; i = nodes_[i].next) {
+      out.push_back(*nodes_[i].entry);
+    }
     return out;
   }
 
  private:
-  std::pmr::list<std::pair<K, V>> entries_;
-  std::pmr::map<K, decltype(entries_.begin())> key_to_it_;
+  static constexpr uint16_t kNone = UINT16_MAX;
+  static constexpr uint16_t kEmpty = 0;
+
+  // Keep the table at most half full, so that probe sequences stay short.
+  static constexpr size_t kNumSlots = std::bit_ceil<size_t>(Size * 2);
+  static constexpr size_t kSlotMask = kNumSlots - 1;
+
+  struct Node {
+    uint64_t hash;
+    uint16_t prev;
+    uint16_t next;
+    std::optional<std::pair<K, V>> entry;
+  };
+
+  /*
+   * Returns the slot containing the given key, or the empty slot where it
+   * would be inserted if it isn't present.
+   */
+  template <typename Q>
+  auto find(uint64_t hash, const Q& key) const -> size_t {
+    size_t slot = hash & kSlotMask;
+    while (slots_[slot] != kEmpty) {
+      const Node& n = nodes_[slots_[slot] - 1];
+      if (n.hash == hash && n.entry->first == key) {
+        break;
+      }
+      slot = (slot + 1) & kSlotMask;
+    }
+    return slot;
+  }
+
+  /*
+   * Empties the given slot. Rather than leaving a tombstone, any later slots in
+   * the same probe sequence are shifted back to fill the gap, so that lookups
+   * never need to skip over deleted slots.
+   */
+  auto erase(size_t slot) -> void {
+    size_t next = slot;
+    for (;;) {
+      next = (next + 1) & kSlotMask;
+      if (slots_[next] == kEmpty) {
+        break;
+      }
+      size_t home = nodes_[slots_[next] - 1].hash & kSlotMask;
+      // The entry in `next` can only move back to `slot` if its home slot
+      // isn't cyclically within (slot, next].
+      if (((next - home) & kSlotMask) >= ((next - slot) & kSlotMask)) {
+        slots_[slot] = slots_[next];
+        slot = next;
+      }
+    }
+    slots_[slot] = kEmpty;
+  }
+
+  auto unlink(uint16_t i) -> void {
+    Node& n = nodes_[i];
+    if (n.prev != kNone) {
+      nodes_[n.prev].next = n.next;
+    } else {
+      head_ = n.next;
+    }
+    if (n.next != kNone) {
+      nodes_[n.next].prev = n.prev;
+    } else {
+      tail_ = n.prev;
+    }
+  }
+
+  auto pushFront(uint16_t i) -> void {
+    Node& n = nodes_[i];
+    n.prev = kNone;
+    n.next = head_;
+    if (head_ != kNone) {
+      nodes_[head_].prev = i;
+    }
+    head_ = i;
+    if (tail_ == kNone) {
+      tail_ = i;
+    }
+  }
+
+  auto moveToFront(uint16_t i) -> void {
+    if (head_ == i) {
+      return;
+    }
+    unlink(i);
+    pushFront(i);
+  }
+
+  std::array<Node, Size> nodes_;
+  // Indexes into nodes_, plus one, so that zero can mark an empty slot.
+  std::array<uint16_t, kNumSlots> slots_;
+  uint16_t head_;
+  uint16_t tail_;
+  uint16_t size_;
 };
 
 }  // namespace util
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "alloc_tracking.hpp"
+
+#include <errno.h>
+#include <malloc.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Interposes the system allocator so that allocations from every library
+ * (including the C codecs, which don't go through heap_caps) are counted.
+ * This relies on glibc exporting its real allocator as __libc_*.
+ */
+
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+void __libc_free(void*);
+}
+
+namespace bench {
+
+static std::atomic<uint64_t> sNumAllocs;
+static std::atomic<std::size_t> sLiveBytes;
+static std::atomic<std::size_t> sBaselineBytes;
+static std::atomic<std::size_t> sPeakBytes;
+
+static auto Track(void* ptr) -> void* {
+  if (ptr) {
+    sNumAllocs++;
+    std::size_t live = sLiveBytes += malloc_usable_size(ptr);
+    std::size_t peak = sPeakBytes.load();
+    while (live > peak && !sPeakBytes.compare_exchange_weak(peak, live)) {
+    }
+  }
+  return ptr;
+}
+
+static auto Untrack(void* ptr) -> void {
+  if (ptr) {
+    sLiveBytes -= malloc_usable_size(ptr);
+  }
+}
+
+auto GetAllocStats() -> AllocStats {
+  std::size_t baseline = sBaselineBytes.load();
+  std::size_t peak = sPeakBytes.load();
+  return AllocStats{
+      .num_allocs = sNumAllocs.load(),
+      .live_bytes = sLiveBytes.load() - baseline,
+      .peak_bytes = peak > baseline ? peak - baseline : 0,
+  };
+}
+
+auto ResetAllocStats() -> void {
+  sNumAllocs = 0;
+  sBaselineBytes = sLiveBytes.load();
+  sPeakBytes = sLiveBytes.load();
+}
+
+}  // namespace bench
+
+extern "C" {
+
+void* malloc(size_t size) {
+  return bench::Track(__libc_malloc(size));
+}
+
+void* calloc(size_t n, size_t size) {
+  return bench::Track(__libc_calloc(n, size));
+}
+
+void* realloc(void* ptr, size_t size) {
+  bench::Untrack(ptr);
+  void* res = __libc_realloc(ptr, size);
+  if (res == nullptr && size > 0) {
+    // The original allocation is still live.
+    bench::sLiveBytes += malloc_usable_size(ptr);
+    return nullptr;
+  }
+  return bench::Track(res);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  return bench::Track(__libc_memalign(alignment, size));
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  return bench::Track(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+  void* ptr = bench::Track(__libc_memalign(alignment, size));
+  if (ptr == nullptr) {
+    return ENOMEM;
+  }
+  *out = ptr;
+  return 0;
+}
+
+void free(void* ptr) {
+  bench::Untrack(ptr);
+  __libc_free(ptr);
+}
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bench {
+
+struct AllocStats {
+  uint64_t num_allocs;
+  std::size_t live_bytes;
+  std::size_t peak_bytes;
+};
+
+/*
+ * Returns counters for every heap allocation made by this process since the
+ * last call to `ResetAllocStats`. The peak is measured relative to the live
+ * bytes at the time of the reset.
+ */
+auto GetAllocStats() -> AllocStats;
+auto ResetAllocStats() -> void;
+
+}  // namespace bench
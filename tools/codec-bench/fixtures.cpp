@@ -0,0 +1,316 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "fixtures.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "ogg/ogg.h"
+#include "opus.h"
+
+namespace bench {
+
+static constexpr uint32_t kSeconds = 10;
+static constexpr uint16_t kChannels = 2;
+
+/* Returns a mono sine sweep from 100Hz to 10kHz, at the given sample rate. */
+static auto SineSweep(uint32_t rate) -> std::vector<int16_t> {
+  uint32_t frames = rate * kSeconds;
+  std::vector<int16_t> out(frames);
+  double phase = 0;
+  for (uint32_t i = 0; i < frames; i++) {
+    double freq = 100 + 10000.0 * i / frames;
+    phase += 2 * M_PI * freq / rate;
+    out[i] = static_cast<int16_t>(std::sin(phase) * 16000);
+  }
+  return out;
+}
+
+static auto Append(std::vector<std::byte>& out, const void* p, std::size_t len)
+    -> void {
+  auto bytes = reinterpret_cast<const std::byte*>(p);
+  out.insert(out.end(), bytes, bytes + len);
+}
+
+auto GenerateWav() -> Input {
+  constexpr uint32_t kRate = 44100;
+  auto sweep = SineSweep(kRate);
+  uint32_t data_size = sweep.size() * kChannels * sizeof(int16_t);
+
+  std::vector<std::byte> out;
+  auto put = [&](const void* p, std::size_t len) { Append(out, p, len); };
+  auto put16 = [&](uint16_t v) { put(&v, 2); };
+  auto put32 = [&](uint32_t v) { put(&v, 4); };
+
+  put("RIFF", 4);
+  put32(36 + data_size);
+  put("WAVE", 4);
+  put("fmt ", 4);
+  put32(16);
+  put16(1);  // PCM
+  put16(kChannels);
+  put32(kRate);
+  put32(kRate * kChannels * sizeof(int16_t));
+  put16(kChannels * sizeof(int16_t));
+  put16(16);
+  put("data", 4);
+  put32(data_size);
+
+  for (int16_t s : sweep) {
+    put16(s);
+    put16(s);
+  }
+
+  return Input{"generated.wav", codecs::StreamType::kWav, std::move(out)};
+}
+
+/* Big-endian bit writer, plus the checksums that FLAC frames need. */
+class BitWriter {
+ public:
+  auto bits(uint32_t val, int count) -> void {
+    for (int i = count - 1; i >= 0; i--) {
+      acc_ = acc_ << 1 | ((val >> i) & 1);
+      if (++num_bits_ == 8) {
+        out_.push_back(static_cast<std::byte>(acc_));
+        acc_ = 0;
+        num_bits_ = 0;
+      }
+    }
+  }
+
+  auto unary(uint32_t zeroes) -> void {
+    for (uint32_t i = 0; i < zeroes; i++) {
+      bits(0, 1);
+    }
+    bits(1, 1);
+  }
+
+  auto align() -> void {
+    if (num_bits_ > 0) {
+      bits(0, 8 - num_bits_);
+    }
+  }
+
+  auto data() -> std::vector<std::byte>& { return out_; }
+
+  static auto crc8(std::span<const std::byte> data) -> uint8_t {
+    uint8_t crc = 0;
+    for (std::byte b : data) {
+      crc ^= static_cast<uint8_t>(b);
+      for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+      }
+    }
+    return crc;
+  }
+
+  static auto crc16(std::span<const std::byte> data) -> uint16_t {
+    uint16_t crc = 0;
+    for (std::byte b : data) {
+      crc ^= static_cast<uint16_t>(b) << 8;
+      for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+      }
+    }
+    return crc;
+  }
+
+ private:
+  std::vector<std::byte> out_;
+  uint32_t acc_ = 0;
+  int num_bits_ = 0;
+};
+
+/*
+ * Writes one channel of a block as a second order FIXED subframe, with its
+ * residual in a single Rice partition. This is nowhere near as compact as a
+ * real encoder's output, but it exercises the same decoding paths.
+ */
+static auto WriteFlacSubframe(BitWriter& w, std::span<const int16_t> samples)
+    -> void {
+  constexpr int kOrder = 2;
+  int order = std::min<int>(kOrder, samples.size());
+
+  std::vector<uint32_t> residuals;
+  uint64_t sum = 0;
+  for (std::size_t i = order; i < samples.size(); i++) {
+    int32_t predicted = 2 * samples[i - 1] - samples[i - 2];
+    int32_t r = samples[i] - predicted;
+    uint32_t folded =
+        static_cast<uint32_t>(r << 1) ^ static_cast<uint32_t>(r >> 31);
+    residuals.push_back(folded);
+    sum += folded;
+  }
+  uint64_t mean = residuals.empty() ? 0 : sum / residuals.size();
+  int rice = std::clamp<int>(std::bit_width(mean) - 1, 0, 14);
+
+  w.bits(0, 1);                 // Padding
+  w.bits(0b001000 | order, 6);  // FIXED, with the given order
+  w.bits(0, 1);                 // No wasted bits
+  for (int i = 0; i < order; i++) {
+    w.bits(static_cast<uint16_t>(samples[i]), 16);
+  }
+  w.bits(0, 2);  // 4 bit Rice parameters
+  w.bits(0, 4);  // One partition
+  w.bits(rice, 4);
+  for (uint32_t r : residuals) {
+    w.unary(r >> rice);
+    w.bits(r, rice);
+  }
+}
+
+auto GenerateFlac() -> Input {
+  constexpr uint32_t kRate = 44100;
+  constexpr uint32_t kBlockSize = 4096;
+  auto sweep = SineSweep(kRate);
+
+  BitWriter w;
+  for (char c : {'f', 'L', 'a', 'C'}) {
+    w.bits(c, 8);
+  }
+  // STREAMINFO, which is also the last metadata block.
+  w.bits(1, 1);
+  w.bits(0, 7);
+  w.bits(34, 24);
+  w.bits(kBlockSize, 16);
+  w.bits(kBlockSize, 16);
+  w.bits(0, 24);  // Frame sizes are unknown
+  w.bits(0, 24);
+  w.bits(kRate, 20);
+  w.bits(kChannels - 1, 3);
+  w.bits(16 - 1, 5);
+  w.bits(0, 4);  // Total samples; the upper 4 bits of 36
+  w.bits(sweep.size(), 32);
+  for (int i = 0; i < 4; i++) {
+    w.bits(0, 32);  // No MD5
+  }
+
+  uint32_t frame_number = 0;
+  for (std::size_t pos = 0; pos < sweep.size(); pos += kBlockSize) {
+    std::span<const int16_t> block{sweep.data() + pos,
+                                   std::min<std::size_t>(kBlockSize,
+                                                         sweep.size() - pos)};
+    std::size_t frame_start = w.data().size();
+
+    w.bits(0b11111111111110, 14);  // Sync code
+    w.bits(0, 1);
+    w.bits(0, 1);       // Fixed block size
+    w.bits(0b0111, 4);  // Block size is at the end of the header
+    w.bits(0b1001, 4);  // 44.1kHz
+    w.bits(0b0001, 4);  // Independent left and right channels
+    w.bits(0b100, 3);   // 16 bit samples
+    w.bits(0, 1);
+    // The frame number is UTF-8 encoded.
+    if (frame_number < 0x80) {
+      w.bits(frame_number, 8);
+    } else {
+      w.bits(0b110 << 5 | frame_number >> 6, 8);
+      w.bits(0b10 << 6 | (frame_number & 0x3F), 8);
+    }
+    w.bits(block.size() - 1, 16);
+    w.bits(BitWriter::crc8(std::span{w.data()}.subspan(frame_start)), 8);
+
+    for (uint16_t ch = 0; ch < kChannels; ch++) {
+      WriteFlacSubframe(w, block);
+    }
+    w.align();
+    w.bits(BitWriter::crc16(std::span{w.data()}.subspan(frame_start)), 16);
+    frame_number++;
+  }
+
+  return Input{"generated.flac", codecs::StreamType::kFlac,
+               std::move(w.data())};
+}
+
+auto GenerateOpus() -> Input {
+  constexpr uint32_t kRate = 48000;
+  constexpr int kFrameSize = kRate / 50;
+  auto sweep = SineSweep(kRate);
+
+  int err;
+  OpusEncoder* enc =
+      opus_encoder_create(kRate, kChannels, OPUS_APPLICATION_AUDIO, &err);
+  if (err != OPUS_OK) {
+    fprintf(stderr, "failed to create opus encoder: %d\n", err);
+    return Input{"generated.opus", codecs::StreamType::kOpus, {}};
+  }
+  opus_int32 pre_skip;
+  opus_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&pre_skip));
+
+  ogg_stream_state os;
+  ogg_stream_init(&os, 1);
+  std::vector<std::byte> out;
+  auto write_pages = [&](bool flush) {
+    ogg_page page;
+    while (flush ? ogg_stream_flush(&os, &page)
+                 : ogg_stream_pageout(&os, &page)) {
+      Append(out, page.header, page.header_len);
+      Append(out, page.body, page.body_len);
+    }
+  };
+  auto put_packet = [&](std::span<unsigned char> data, bool bos, bool eos,
+                        int64_t granule, int64_t packetno) {
+    ogg_packet packet{
+        .packet = data.data(),
+        .bytes = static_cast<long>(data.size()),
+        .b_o_s = bos,
+        .e_o_s = eos,
+        .granulepos = granule,
+        .packetno = packetno,
+    };
+    ogg_stream_packetin(&os, &packet);
+  };
+
+  // The identification and comment headers each get a page to themselves.
+  std::vector<unsigned char> head{'O', 'p', 'u', 's', 'H', 'e', 'a', 'd',
+                                  1,   kChannels};
+  head.push_back(pre_skip & 0xFF);
+  head.push_back(pre_skip >> 8);
+  for (int i = 0; i < 4; i++) {
+    head.push_back((kRate >> (i * 8)) & 0xFF);
+  }
+  head.insert(head.end(), {0, 0, 0});  // No gain, and mapping family 0
+  put_packet(head, true, false, 0, 0);
+  write_pages(true);
+
+  std::vector<unsigned char> tags{'O', 'p', 'u', 's', 'T', 'a', 'g', 's',
+                                  0,   0,   0,   0,   0,   0,   0,   0};
+  put_packet(tags, false, false, 0, 1);
+  write_pages(true);
+
+  std::vector<int16_t> pcm(kFrameSize * kChannels);
+  std::vector<unsigned char> packet(4000);
+  std::size_t num_frames = sweep.size() / kFrameSize;
+  for (std::size_t i = 0; i < num_frames; i++) {
+    for (int s = 0; s < kFrameSize; s++) {
+      pcm[s * 2] = pcm[s * 2 + 1] = sweep[i * kFrameSize + s];
+    }
+    int len = opus_encode(enc, pcm.data(), kFrameSize, packet.data(),
+                          packet.size());
+    if (len < 0) {
+      fprintf(stderr, "opus encode failed: %d\n", len);
+      break;
+    }
+    bool last = i + 1 == num_frames;
+    put_packet(std::span{packet.data(), static_cast<std::size_t>(len)}, false,
+               last, static_cast<int64_t>(i + 1) * kFrameSize, i + 2);
+    write_pages(last);
+  }
+
+  ogg_stream_clear(&os);
+  opus_encoder_destroy(enc);
+  return Input{"generated.opus", codecs::StreamType::kOpus, std::move(out)};
+}
+
+}  // namespace bench
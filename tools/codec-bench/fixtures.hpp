@@ -0,0 +1,32 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+
+namespace bench {
+
+struct Input {
+  std::string name;
+  codecs::StreamType type;
+  std::vector<std::byte> data;
+};
+
+/*
+ * Each of these generates a 10 second, 16 bit stereo sine sweep, encoded in
+ * the given format. There's no Vorbis encoder in the tree, so Vorbis files
+ * must be passed to the benchmark on the command line instead.
+ */
+auto GenerateWav() -> Input;
+auto GenerateFlac() -> Input;
+auto GenerateOpus() -> Input;
+
+}  // namespace bench
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+/*
+ * Host stand-in for ESP-IDF's capability-based heap. Capabilities are ignored,
+ * and everything is forwarded to the system allocator (where it is counted by
+ * alloc_tracking.cpp).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_EXEC (1 << 0)
+#define MALLOC_CAP_32BIT (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+static inline void* heap_caps_malloc(size_t size, uint32_t caps) {
+  return malloc(size);
+}
+
+static inline void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  return calloc(n, size);
+}
+
+static inline void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps) {
+  return realloc(ptr, size);
+}
+
+static inline void heap_caps_free(void* ptr) {
+  free(ptr);
+}
+
+static inline void* heap_caps_malloc_prefer(size_t size,
+                                            uint32_t caps1,
+                                            uint32_t caps2) {
+  return malloc(size);
+}
+
+static inline void* heap_caps_calloc_prefer(size_t n,
+                                            size_t size,
+                                            uint32_t caps1,
+                                            uint32_t caps2) {
+  return calloc(n, size);
+}
+
+static inline void* heap_caps_realloc_prefer(void* ptr,
+                                             size_t size,
+                                             uint32_t caps1,
+                                             uint32_t caps2) {
+  return realloc(ptr, size);
+}
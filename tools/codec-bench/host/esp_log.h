@@ -0,0 +1,28 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+/*
+ * Host stand-in for ESP-IDF's logging macros. Only warnings and errors are
+ * printed, so that log spam doesn't skew timings.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, fmt, ...) \
+  fprintf(stderr, "E (%s) " fmt "\n", tag __VA_OPT__(, ) __VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) \
+  fprintf(stderr, "W (%s) " fmt "\n", tag __VA_OPT__(, ) __VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) \
+  do {                          \
+  } while (0)
+#define ESP_LOGD(tag, fmt, ...) \
+  do {                          \
+  } while (0)
+#define ESP_LOGV(tag, fmt, ...) \
+  do {                          \
+  } while (0)
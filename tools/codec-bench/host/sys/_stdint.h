@@ -0,0 +1,11 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+/* newlib-specific header; glibc puts all of this in stdint.h. */
+
+#pragma once
+
+#include <stdint.h>
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+/*
+ * Host-side decode benchmark. Runs each input file through the same codec
+ * implementations used on-device, reading from memory so that only decoding
+ * is measured. For each input, this reports:
+ *
+ *  - the real-time factor (seconds of audio decoded per second of CPU time),
+ *  - CPU microseconds spent per second of audio,
+ *  - heap allocations and peak heap usage for the first stream a codec
+ *    decodes, and again when the codec is reused from a CodecPool.
+ *
+ * Absolute numbers are obviously not representative of an ESP32, but relative
+ * changes between runs are what we care about for catching regressions.
+ */
+
+#include <time.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "alloc_tracking.hpp"
+#include "codec.hpp"
+#include "fixtures.hpp"
+#include "sample.hpp"
+#include "test.mp3.hpp"
+#include "types.hpp"
+
+namespace bench {
+
+/* Matches the size of the decoder task's codec buffer. */
+static constexpr std::size_t kOutputBufferSamples = 4096;
+
+/* Decode each input at least this many times, for more stable timings. */
+static constexpr double kMinAudioSeconds = 60;
+
+class MemoryStream : public codecs::IStream {
+ public:
+  MemoryStream(codecs::StreamType type, std::span<const std::byte> data)
+      : IStream(type), data_(data), pos_(0) {}
+
+  auto Read(std::span<std::byte> dest) -> ssize_t override {
+    std::size_t len = std::min(dest.size(), data_.size() - pos_);
+    std::memcpy(dest.data(), data_.data() + pos_, len);
+    pos_ += len;
+    return len;
+  }
+
+  auto CanSeek() -> bool override { return true; }
+
+  auto SeekTo(int64_t destination, SeekFrom from) -> void override {
+    int64_t base = 0;
+    switch (from) {
+      case SeekFrom::kStartOfStream:
+        base = 0;
+        break;
+      case SeekFrom::kEndOfStream:
+        base = data_.size();
+        break;
+      case SeekFrom::kCurrentPosition:
+        base = pos_;
+        break;
+    }
+    pos_ = std::clamp<int64_t>(base + destination, 0, data_.size());
+  }
+
+  auto CurrentPosition() -> int64_t override { return pos_; }
+
+  auto Size() -> std::optional<int64_t> override { return data_.size(); }
+
+ private:
+  std::span<const std::byte> data_;
+  std::size_t pos_;
+};
+
+static auto TypeForPath(const std::string& path)
+    -> std::optional<codecs::StreamType> {
+  auto ext = path.substr(path.find_last_of('.') + 1);
+  if (ext == "mp3") {
+    return codecs::StreamType::kMp3;
+  } else if (ext == "flac") {
+    return codecs::StreamType::kFlac;
+  } else if (ext == "ogg" || ext == "oga") {
+    return codecs::StreamType::kVorbis;
+  } else if (ext == "opus") {
+    return codecs::StreamType::kOpus;
+  } else if (ext == "wav") {
+    return codecs::StreamType::kWav;
+  }
+  return {};
+}
+
+static auto LoadFile(const std::string& path) -> std::optional<Input> {
+  auto type = TypeForPath(path);
+  if (!type) {
+    fprintf(stderr, "skipping %s: unknown extension\n", path.c_str());
+    return {};
+  }
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    fprintf(stderr, "skipping %s: could not open\n", path.c_str());
+    return {};
+  }
+  std::vector<char> raw{std::istreambuf_iterator<char>(file), {}};
+  std::vector<std::byte> data(raw.size());
+  std::memcpy(data.data(), raw.data(), raw.size());
+  return Input{path, *type, std::move(data)};
+}
+
+static auto CpuSeconds() -> double {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct PassResult {
+  bool ok;
+  double audio_seconds;
+  AllocStats allocs;
+};
+
+/* Opens and fully decodes one stream with the given codec. */
+static auto DecodeOnce(codecs::ICodec& codec,
+                       const Input& input,
+                       std::span<sample::Sample> out) -> PassResult {
+  auto stream = std::make_shared<MemoryStream>(input.type, input.data);
+  auto format = codec.OpenStream(stream, 0);
+  if (format.has_error()) {
+    fprintf(stderr, "%s: failed to open: %s\n", input.name.c_str(),
+            codecs::ICodec::ErrorString(format.error()).c_str());
+    return {.ok = false, .audio_seconds = 0, .allocs = {}};
+  }
+
+  uint64_t samples = 0;
+  for (;;) {
+    auto res = codec.DecodeTo(out);
+    if (res.has_error()) {
+      fprintf(stderr, "%s: decode error: %s\n", input.name.c_str(),
+              codecs::ICodec::ErrorString(res.error()).c_str());
+      return {.ok = false, .audio_seconds = 0, .allocs = {}};
+    }
+    samples += res->samples_written;
+    if (res->is_stream_finished) {
+      break;
+    }
+  }
+  AllocStats allocs = GetAllocStats();
+
+  return {
+      .ok = true,
+      .audio_seconds = static_cast<double>(samples) / format->num_channels /
+                       format->sample_rate_hz,
+      .allocs = allocs,
+  };
+}
+
+static auto Run(const Input& input) -> void {
+  std::vector<sample::Sample> out(kOutputBufferSamples);
+  codecs::CodecPool pool;
+
+  // The first pass includes creating the codec's long-lived state.
+  ResetAllocStats();
+  auto codec = pool.Acquire(input.type);
+  if (!codec) {
+    fprintf(stderr, "%s: no codec\n", input.name.c_str());
+    return;
+  }
+
+  auto first = DecodeOnce(**codec, input, out);
+  pool.Release(*codec);
+  if (!first.ok || first.audio_seconds <= 0) {
+    return;
+  }
+
+  // Subsequent passes reuse the pooled codec, as happens between tracks.
+  AllocStats reused{};
+  double audio_seconds = 0;
+  double start = CpuSeconds();
+  do {
+    ResetAllocStats();
+    codec = pool.Acquire(input.type);
+    auto res = DecodeOnce(**codec, input, out);
+    pool.Release(*codec);
+    if (!res.ok) {
+      return;
+    }
+    reused = res.allocs;
+    audio_seconds += res.audio_seconds;
+  } while (audio_seconds < kMinAudioSeconds);
+  double cpu_seconds = CpuSeconds() - start;
+
+  printf("%-7s %8.1fx %10.0f %8lu %10.1f %8lu %10.1f  %s\n",
+         codecs::StreamTypeToString(input.type).c_str(),
+         audio_seconds / cpu_seconds, cpu_seconds / audio_seconds * 1e6,
+         first.allocs.num_allocs, first.allocs.peak_bytes / 1024.0,
+         reused.num_allocs, reused.peak_bytes / 1024.0, input.name.c_str());
+}
+
+}  // namespace bench
+
+int main(int argc, char** argv) {
+  std::vector<bench::Input> inputs;
+  inputs.push_back(bench::GenerateWav());
+  inputs.push_back(bench::GenerateFlac());
+  inputs.push_back(bench::GenerateOpus());
+  {
+    auto mp3 = reinterpret_cast<const std::byte*>(test_mp3);
+    inputs.push_back(bench::Input{"test.mp3.hpp", codecs::StreamType::kMp3,
+                                  {mp3, mp3 + test_mp3_len}});
+  }
+  for (int i = 1; i < argc; i++) {
+    if (auto input = bench::LoadFile(argv[i])) {
+      inputs.push_back(std::move(*input));
+    }
+  }
+
+  printf("%-7s %9s %10s %8s %10s %8s %10s  %s\n", "codec", "realtime",
+         "us/s", "allocs", "peak KiB", "reallocs", "repeak KiB", "input");
+  for (const auto& input : inputs) {
+    bench::Run(input);
+  }
+  return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn,
+                               const char* name,
+                               uint32_t stack_depth,
+                               void* param,
+                               UBaseType_t priority,
+                               StackType_t* stack,
+                               StaticTask_t* buffer);
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn,
+                                           const char* name,
+                                           uint32_t stack_depth,
+                                           void* param,
+                                           UBaseType_t priority,
+                                           StackType_t* stack,
+                                           StaticTask_t* buffer,
+                                           BaseType_t core);
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
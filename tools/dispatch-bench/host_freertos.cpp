@@ -0,0 +1,98 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Each task is a detached std::thread, plus the state needed for direct to
+ * task notifications. Tasks (and the main thread, which is given a task
+ * lazily) are never freed, which matches how the firmware uses them.
+ */
+struct HostTask {
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint32_t notifications = 0;
+};
+
+static thread_local HostTask* sCurrentTask = nullptr;
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn,
+                               const char*,
+                               uint32_t,
+                               void* param,
+                               UBaseType_t,
+                               StackType_t*,
+                               StaticTask_t*) {
+  auto* task = new HostTask();
+  std::thread{[=]() {
+    sCurrentTask = task;
+    fn(param);
+  }}.detach();
+  return task;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn,
+                                           const char* name,
+                                           uint32_t stack_depth,
+                                           void* param,
+                                           UBaseType_t priority,
+                                           StackType_t* stack,
+                                           StaticTask_t* buffer,
+                                           BaseType_t) {
+  return xTaskCreateStatic(fn, name, stack_depth, param, priority, stack,
+                           buffer);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  if (!sCurrentTask) {
+    sCurrentTask = new HostTask();
+  }
+  return sCurrentTask;
+}
+
+void vTaskDelete(TaskHandle_t) {
+  for (;;) {
+    std::this_thread::sleep_for(std::chrono::hours(1));
+  }
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  {
+    std::lock_guard<std::mutex> lock{task->mutex};
+    task->notifications++;
+  }
+  task->cv.notify_one();
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+  HostTask* task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock{task->mutex};
+  auto ready = [&]() { return task->notifications > 0; };
+  if (ticks == portMAX_DELAY) {
+    task->cv.wait(lock, ready);
+  } else {
+    task->cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+  }
+  uint32_t count = task->notifications;
+  if (clear_on_exit) {
+    task->notifications = 0;
+  } else if (count > 0) {
+    task->notifications--;
+  }
+  return count;
+}
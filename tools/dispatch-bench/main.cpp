@@ -0,0 +1,181 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+/*
+ * Host-side benchmark for dispatching work to a tasks::WorkerPool. For each way
+ * of dispatching work, this reports:
+ *
+ *  - heap allocations per dispatched item, over a burst of items,
+ *  - the time taken by the dispatching call itself,
+ *  - the latency from dispatching an item to it starting on a worker, when the
+ *    pool is otherwise idle.
+ *
+ * 'legacy' reproduces how WorkerPool dispatched work before it had inline
+ * work items: a heap-allocated std::function and a shared std::promise per
+ * item, sent through a single shared queue.
+ *
+ * Absolute numbers are obviously not representative of an ESP32, but relative
+ * changes between runs are what we care about for catching regressions.
+ */
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc_tracking.hpp"
+#include "tasks.hpp"
+
+namespace bench {
+
+static constexpr size_t kBurstItems = 100000;
+static constexpr size_t kLatencySamples = 10000;
+
+static auto NowNs() -> uint64_t {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* The previous WorkerPool design, minus the FreeRTOS queue's size limit. */
+class LegacyPool {
+ public:
+  LegacyPool() {
+    for (size_t i = 0; i < tasks::WorkerPool::kNumWorkers; i++) {
+      std::thread{[this]() { Main(); }}.detach();
+    }
+  }
+
+  auto Dispatch(const std::function<void(void)> fn) -> std::future<void> {
+    std::shared_ptr<std::promise<void>> promise =
+        std::make_shared<std::promise<void>>();
+    auto* item = new std::function<void(void)>([=]() {
+      std::invoke(fn);
+      promise->set_value();
+    });
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      queue_.push_back(item);
+    }
+    cv_.notify_one();
+    return promise->get_future();
+  }
+
+ private:
+  auto Main() -> void {
+    for (;;) {
+      std::function<void(void)>* item;
+      {
+        std::unique_lock<std::mutex> lock{mutex_};
+        cv_.wait(lock, [&]() { return !queue_.empty(); });
+        item = queue_.front();
+        queue_.pop_front();
+      }
+      std::invoke(*item);
+      delete item;
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void(void)>*> queue_;
+};
+
+struct Result {
+  double allocs_per_item;
+  double dispatch_ns;
+  double latency_median_us;
+  double latency_p99_us;
+};
+
+/*
+ * Runs a benchmark, given a function that dispatches a single item. The
+ * dispatched work captures a few values, similar to the lambdas used
+ * throughout the firmware.
+ */
+template <typename DispatchFn>
+static auto Run(DispatchFn dispatch) -> Result {
+  std::atomic<size_t> done{0};
+  uint64_t a = 1, b = 2, c = 3;
+
+  // Warm up any pools and queues, so that we measure steady-state behaviour.
+  for (size_t i = 0; i < 1000; i++) {
+    dispatch([&, a, b, c]() { done += (a + b + c) > 0; });
+  }
+  while (done < 1000) {
+    std::this_thread::yield();
+  }
+  done = 0;
+
+  ResetAllocStats();
+  uint64_t start = NowNs();
+  for (size_t i = 0; i < kBurstItems; i++) {
+    dispatch([&, a, b, c]() { done += (a + b + c) > 0; });
+  }
+  uint64_t dispatch_time = NowNs() - start;
+  while (done < kBurstItems) {
+    std::this_thread::yield();
+  }
+  AllocStats stats = GetAllocStats();
+
+  std::vector<uint64_t> latencies;
+  latencies.reserve(kLatencySamples);
+  for (size_t i = 0; i < kLatencySamples; i++) {
+    std::atomic<uint64_t> started{0};
+    uint64_t sent = NowNs();
+    dispatch([&]() { started = NowNs(); });
+    while (started == 0) {
+      std::this_thread::yield();
+    }
+    latencies.push_back(started - sent);
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  return Result{
+      .allocs_per_item = static_cast<double>(stats.num_allocs) / kBurstItems,
+      .dispatch_ns = static_cast<double>(dispatch_time) / kBurstItems,
+      .latency_median_us = latencies[latencies.size() / 2] / 1000.0,
+      .latency_p99_us = latencies[latencies.size() * 99 / 100] / 1000.0,
+  };
+}
+
+static auto Print(const char* name, const Result& r) -> void {
+  printf("%-10s %12.2f %12.1f %12.1f %12.1f\n", name, r.allocs_per_item,
+         r.dispatch_ns, r.latency_median_us, r.latency_p99_us);
+}
+
+}  // namespace bench
+
+int main(int argc, char** argv) {
+  using namespace bench;
+
+  printf("%-10s %12s %12s %12s %12s\n", "method", "allocs/item",
+         "dispatch ns", "latency us", "p99 us");
+
+  // Neither pool can be destroyed whilst its workers are running, so both
+  // are leaked, just as the firmware's worker pool lives forever.
+  auto* legacy = new LegacyPool();
+  Print("legacy", Run([&](auto fn) { legacy->Dispatch(fn); }));
+
+  auto* pool = new tasks::WorkerPool();
+  Print("dispatch", Run([&](auto fn) { pool->Dispatch<void>(fn); }));
+  Print("post", Run([&](auto fn) { pool->Post(fn); }));
+  Print("post-high",
+        Run([&](auto fn) { pool->Post(fn, tasks::WorkPriority::kHigh); }));
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2024 jacqueline <me@jacqueline.id.au>
+ *
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+/*
+ * Host-side benchmark for util::LruCache. Each workload mimics one of the
+ * firmware's caches, and runs the same sequence of lookups (with an insert
+ * after every miss) against both the current cache and 'legacy', which
+ * reproduces the cache as it was before it was made flat: a std::pmr::list of
+ * entries, indexed by a std::pmr::map, with two lookups per Get.
+ *
+ * For each, this reports the time per operation, heap allocations per
+ * operation, and hit rate. Both caches must agree on every lookup, and on the
+ * final order of their entries; the benchmark fails if they don't.
+ *
+ * Absolute numbers are obviously not representative of an ESP32, but relative
+ * changes between runs are what we care about for catching regressions.
+ */
+
+#include <time.h>
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "alloc_tracking.hpp"
+#include "lru_cache.hpp"
+#include "memory_resource.hpp"
+
+namespace bench {
+
+static constexpr size_t kOps = 1000000;
+
+static auto NowNs() -> uint64_t {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* The previous util::LruCache. */
+template <int Size, typename K, typename V>
+class LegacyLruCache {
+ public:
+  LegacyLruCache()
+      : entries_(&memory::kSpiRamResource),
+        key_to_it_(&memory::kSpiRamResource) {}
+
+  auto Put(K key, V val) -> void {
+    if (key_to_it_.contains(key)) {
+      entries_.erase(key_to_it_[key]);
+      key_to_it_.erase(key);
+    } else if (entries_.size() >= Size) {
+      key_to_it_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.push_front({key, val});
+    key_to_it_[key] = entries_.begin();
+  }
+
+  auto Get(K key) -> std::optional<V> {
+    if (!key_to_it_.contains(key)) {
+      return {};
+    }
+    auto it = key_to_it_[key];
+    entries_.splice(entries_.begin(), entries_, it);
+    return it->second;
+  }
+
+  auto Get() const -> std::vector<std::pair<K, V>> {
+    return {entries_.begin(), entries_.end()};
+  }
+
+ private:
+  std::pmr::list<std::pair<K, V>> entries_;
+  std::pmr::map<K, decltype(entries_.begin())> key_to_it_;
+};
+
+struct Result {
+  double ns_per_op;
+  double allocs_per_op;
+  double hit_rate;
+  std::vector<bool> hits;
+};
+
+/*
+ * Looks up each key in turn, inserting it if it was missing. `lookup` is given
+ * each key as a string_view or other lightweight form, just as the firmware's
+ * callers have it.
+ */
+template <typename Cache, typename Keys, typename Lookup, typename Insert>
+static auto Run(Cache& cache,
+                const Keys& keys,
+                const std::vector<size_t>& sequence,
+                Lookup lookup,
+                Insert insert) -> Result {
+  Result res{};
+  res.hits.reserve(sequence.size());
+
+  ResetAllocStats();
+  uint64_t start = NowNs();
+  size_t num_hits = 0;
+  for (size_t i : sequence) {
+    bool hit = lookup(cache, keys[i]).has_value();
+    if (!hit) {
+      insert(cache, keys[i], i);
+    }
+    num_hits += hit;
+    res.hits.push_back(hit);
+  }
+  uint64_t elapsed = NowNs() - start;
+  AllocStats stats = GetAllocStats();
+
+  res.ns_per_op = static_cast<double>(elapsed) / sequence.size();
+  res.allocs_per_op = static_cast<double>(stats.num_allocs) / sequence.size();
+  res.hit_rate = static_cast<double>(num_hits) / sequence.size();
+  return res;
+}
+
+/*
+ * Picks keys with a skewed distribution, so that some are hit often and the
+ * rest churn through the cache.
+ */
+static auto Sequence(size_t num_keys) -> std::vector<size_t> {
+  std::mt19937 rng{1234};
+  std::geometric_distribution<size_t> dist{0.2};
+  std::vector<size_t> out;
+  out.reserve(kOps);
+  for (size_t i = 0; i < kOps; i++) {
+    out.push_back(dist(rng) % num_keys);
+  }
+  return out;
+}
+
+static auto Print(const char* name, const Result& r) -> void {
+  printf("%-18s %10.1f %12.2f %10.3f\n", name, r.ns_per_op, r.allocs_per_op,
+         r.hit_rate);
+}
+
+template <typename A, typename B>
+static auto Check(const char* name,
+                  const Result& ra,
+                  const Result& rb,
+                  const A& a,
+                  const B& b) -> bool {
+  auto ea = a.Get();
+  auto eb = b.Get();
+  bool ok = ra.hits == rb.hits && ea.size() == eb.size();
+  for (size_t i = 0; ok && i < ea.size(); i++) {
+    ok = ea[i].first == eb[i].first && ea[i].second == eb[i].second;
+  }
+  if (!ok) {
+    printf("%s: caches disagree!\n", name);
+  }
+  return ok;
+}
+
+/* TagParserImpl's cache of parsed tags, keyed by path. */
+static auto TagCache() -> bool {
+  using Value = std::shared_ptr<int>;
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < 24; i++) {
+    char buf[96];
+    snprintf(buf, sizeof(buf),
+             "/Music/Some Artist %zu/Their Album %zu/%02zu - A Track.flac",
+             i % 5, i % 7, i);
+    paths.push_back(buf);
+  }
+  auto seq = Sequence(paths.size());
+
+  LegacyLruCache<8, std::pmr::string, Value> legacy;
+  auto rl = Run(
+      legacy, paths, seq,
+      [](auto& c, std::string_view p) {
+        return c.Get({p.data(), p.size()});
+      },
+      [](auto& c, std::string_view p, size_t i) {
+        c.Put({p.data(), p.size(), &memory::kSpiRamResource},
+              std::make_shared<int>(i));
+      });
+  Print("tags legacy", rl);
+
+  util::LruCache<8, std::pmr::string, Value> flat;
+  auto rf = Run(
+      flat, paths, seq,
+      [](auto& c, std::string_view p) { return c.Get(p); },
+      [](auto& c, std::string_view p, size_t i) {
+        c.Put({p.data(), p.size(), &memory::kSpiRamResource},
+              std::make_shared<int>(i));
+      });
+  Print("tags flat", rf);
+
+  auto la = legacy.Get();
+  auto fa = flat.Get();
+  bool ok = rl.hits == rf.hits && la.size() == fa.size();
+  for (size_t i = 0; ok && i < la.size(); i++) {
+    ok = la[i].first == fa[i].first && *la[i].second == *fa[i].second;
+  }
+  if (!ok) {
+    printf("tags: caches disagree!\n");
+  }
+  return ok;
+}
+
+/* NvsStorage's per-device bluetooth volumes, keyed by MAC address. */
+static auto BtVolumes() -> bool {
+  using Mac = std::array<uint8_t, 6>;
+  std::vector<Mac> macs;
+  for (uint8_t i = 0; i < 16; i++) {
+    macs.push_back({0x10, 0x20, 0x30, 0x40, i, static_cast<uint8_t>(i * 7)});
+  }
+  auto seq = Sequence(macs.size());
+
+  auto lookup = [](auto& c, const Mac& m) { return c.Get(m); };
+  auto insert = [](auto& c, const Mac& m, size_t i) {
+    c.Put(m, static_cast<uint8_t>(i));
+  };
+
+  LegacyLruCache<10, Mac, uint8_t> legacy;
+  auto rl = Run(legacy, macs, seq, lookup, insert);
+  Print("volumes legacy", rl);
+
+  util::LruCache<10, Mac, uint8_t> flat;
+  auto rf = Run(flat, macs, seq, lookup, insert);
+  Print("volumes flat", rf);
+
+  return Check("volumes", rl, rf, legacy, flat);
+}
+
+}  // namespace bench
+
+int main(int argc, char** argv) {
+  using namespace bench;
+
+  printf("%-18s %10s %12s %10s\n", "cache", "ns/op", "allocs/op", "hit rate");
+  bool ok = TagCache();
+  ok &= BtVolumes();
+
+  return ok ? 0 : 1;
+}